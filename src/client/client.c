@@ -27,7 +27,7 @@ usage(void)
           "Commands:\n"
           "\thello\n"
           "\t\tsend hello message to entropy eater;\n"
-          "\tfeed --food <data>\n"
+          "\tfeed --food <data> [--food <data> ...]\n"
           "\t\tfeed entropy eater with data;\n"
           "\tsweep\n"
           "\t\tsweep entropy eater's room;\n"
@@ -35,9 +35,25 @@ usage(void)
           "\t\tdisinfect entropy eater's room;\n"
           "\tcure\n"
           "\t\tcure ill entropy eater;\n"
-          "\trps --sign <rock|paper|scissors>\n"
-          "\t\tplay in the rock-paper-scissors game with entropy eater\n",
-          program, program);
+          "\trps --sign <rock|paper|scissors> [--sign <...> ...]\n"
+          "\t\tplay in the rock-paper-scissors game with entropy eater;\n"
+          "\t\tseveral signs are played in a single batch;\n"
+          "\tsnapshot --file <path>\n"
+          "\t\tsave the state of entropy eater's brain to the file;\n"
+          "\trestore --file <path>\n"
+          "\t\trestore the state of entropy eater's brain from the file;\n"
+          "\tcreate\n"
+          "\t\tcreate an entropy eater (requires --id);\n"
+          "\tdestroy\n"
+          "\t\tdestroy an entropy eater (requires --id);\n"
+          "\texport\n"
+          "\t\texport status of an entropy eater via sysfs.\n"
+          "\n"
+          "Options accepted by all the commands:\n"
+          "\t--id <id>\n"
+          "\t\taddress the command to the entropy eater with the\n"
+          "\t\tidentifier; the default eater is %d\n",
+          program, program, EATER_ID_DEFAULT);
 }
 
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
@@ -69,14 +85,22 @@ typedef int (*command_handler_t)(struct command_t *command);
 
 /// Data for FEED command.
 struct command_feed_data_t {
-  uint8_t *food;
-  size_t   count;
+  uint8_t *food[EATER_FEED_PORTIONS_MAX];
+  size_t   counts[EATER_FEED_PORTIONS_MAX];
+  size_t   n;
 };
 
 
 /// Data for RPS command.
 struct command_rps_data_t {
-  enum rps_sign_t sign;
+  uint8_t signs[EATER_RPS_BATCH_MAX];
+  size_t  n;
+};
+
+
+/// Data for SNAPSHOT and RESTORE commands.
+struct command_snapshot_data_t {
+  const char *file;
 };
 
 
@@ -88,9 +112,10 @@ struct command_global_data_t {
 
 /// Command data.
 union command_data_t {
-  struct command_feed_data_t   feed_data;
-  struct command_rps_data_t    rps_data;
-  struct command_global_data_t global_data;
+  struct command_feed_data_t     feed_data;
+  struct command_rps_data_t      rps_data;
+  struct command_snapshot_data_t snapshot_data;
+  struct command_global_data_t   global_data;
 };
 
 
@@ -177,8 +202,9 @@ cmd_hello_handler(struct command_t *command)
 static int
 cmd_feed_handler(struct command_t *command)
 {
-  int ret = eater_cmd_feed(command->data.feed_data.food,
-                           command->data.feed_data.count);
+  int ret = eater_cmd_feed_batch(command->data.feed_data.food,
+                                 command->data.feed_data.counts,
+                                 command->data.feed_data.n);
   if (ret != EATER_OK) {
     error("cannot send 'FEED' command to eater: %m", errno);
     return -1;
@@ -191,9 +217,18 @@ static int
 cmd_feed_opts_handler(struct command_t *command,
                       const char *optname, char *optvalue)
 {
+  struct command_feed_data_t *feed_data = &command->data.feed_data;
+
   if (strcmp(optname, "food") == 0) {
-    command->data.feed_data.food  = optvalue;
-    command->data.feed_data.count = strlen(optvalue);
+    if (feed_data->n == EATER_FEED_PORTIONS_MAX) {
+      error("at most %d portions of food can be fed at once",
+            EATER_FEED_PORTIONS_MAX);
+      return -1;
+    }
+
+    feed_data->food[feed_data->n]   = optvalue;
+    feed_data->counts[feed_data->n] = strlen(optvalue);
+    feed_data->n                   += 1;
   } else {
     /* this is impossible */
     assert( false );
@@ -206,7 +241,7 @@ cmd_feed_opts_handler(struct command_t *command,
 static bool
 cmd_feed_opts_validator(const struct command_t *command)
 {
-  if (command->data.feed_data.food == NULL) {
+  if (command->data.feed_data.n == 0) {
     error("'food' parameter is required for '%s' command", command->name);
     return false;
   }
@@ -257,14 +292,86 @@ cmd_cure_handler(struct command_t *command)
 }
 
 
+static int
+cmd_create_handler(struct command_t *command)
+{
+  int ret;
+
+  ret = eater_cmd_create();
+  if (ret != EATER_OK) {
+    error("cannot send 'CREATE' command to eater: %m", errno);
+    return -1;
+  }
+  return 0;
+}
+
+
+static int
+cmd_destroy_handler(struct command_t *command)
+{
+  int ret;
+
+  ret = eater_cmd_destroy();
+  if (ret != EATER_OK) {
+    error("cannot send 'DESTROY' command to eater: %m", errno);
+    return -1;
+  }
+  return 0;
+}
+
+
+static int
+cmd_export_handler(struct command_t *command)
+{
+  int ret;
+
+  ret = eater_cmd_export_status();
+  if (ret != EATER_OK) {
+    error("cannot send 'EXPORT_STATUS' command to eater: %m", errno);
+    return -1;
+  }
+  return 0;
+}
+
+
 static int
 cmd_rps_handler(struct command_t *command)
 {
-  int ret = eater_cmd_play_rps(command->data.rps_data.sign);
+  int    ret;
+  size_t i;
+  size_t counts[RPS_DRAW + 1] = { 0 };
+
+  struct command_rps_data_t *rps_data = &command->data.rps_data;
+  uint8_t                    results[EATER_RPS_BATCH_MAX];
+  char                       state[EATER_SOCIAL_STATE_SIZE_MAX];
+
+  if (rps_data->n == 1) {
+    ret = eater_cmd_play_rps(rps_data->signs[0]);
+    if (ret != EATER_OK) {
+      error("cannot send 'PLAY_RPS' command to eater: %m", errno);
+      return -1;
+    }
+    return 0;
+  }
+
+  ret = eater_cmd_play_rps_batch(rps_data->signs, rps_data->n,
+                                 results, state);
   if (ret != EATER_OK) {
-    error("cannot send 'PLAY_RPS' command to eater: %m", errno);
+    error("cannot send 'PLAY_RPS_BATCH' command to eater: %m", errno);
     return -1;
   }
+
+  for (i = 0; i < rps_data->n; ++i) {
+    if (results[i] <= RPS_DRAW) {
+      ++counts[results[i]];
+    }
+  }
+
+  printf("won: %zu, lost: %zu, draws: %zu\n"
+         "social state: %s\n",
+         counts[RPS_WINNER_FIRST], counts[RPS_WINNER_SECOND],
+         counts[RPS_DRAW], state);
+
   return 0;
 }
 
@@ -273,13 +380,21 @@ static int
 cmd_rps_opts_handler(struct command_t *command,
                      const char *optname, char *optvalue)
 {
+  struct command_rps_data_t *rps_data = &command->data.rps_data;
+
   if (strcmp(optname, "sign") == 0) {
+    if (rps_data->n == EATER_RPS_BATCH_MAX) {
+      error("at most %d games can be played at once",
+            EATER_RPS_BATCH_MAX);
+      return -1;
+    }
+
     if (strcmp(optvalue, "rock") == 0) {
-      command->data.rps_data.sign = RPS_SIGN_ROCK;
+      rps_data->signs[rps_data->n++] = RPS_SIGN_ROCK;
     } else if (strcmp(optvalue, "paper") == 0) {
-      command->data.rps_data.sign = RPS_SIGN_PAPER;
+      rps_data->signs[rps_data->n++] = RPS_SIGN_PAPER;
     } else if (strcmp(optvalue, "scissors") == 0) {
-      command->data.rps_data.sign = RPS_SIGN_SCISSORS;
+      rps_data->signs[rps_data->n++] = RPS_SIGN_SCISSORS;
     } else {
       error("invalid value '%s' for the '%s' parameter", optvalue, optname);
     }
@@ -295,7 +410,7 @@ cmd_rps_opts_handler(struct command_t *command,
 static bool
 cmd_rps_opts_validator(const struct command_t *command)
 {
-  if (command->data.rps_data.sign == (enum rps_sign_t) -1) {
+  if (command->data.rps_data.n == 0) {
     error("'sign' parameter is required for '%s' command", command->name);
     return false;
   }
@@ -304,6 +419,107 @@ cmd_rps_opts_validator(const struct command_t *command)
 }
 
 
+static int
+cmd_snapshot_handler(struct command_t *command)
+{
+  int      ret;
+  uint8_t *data;
+  size_t   count;
+  FILE    *file;
+
+  ret = eater_cmd_snapshot(&data, &count);
+  if (ret != EATER_OK) {
+    error("cannot send 'SNAPSHOT' command to eater: %m", errno);
+    return -1;
+  }
+
+  file = fopen(command->data.snapshot_data.file, "wb");
+  if (file == NULL) {
+    error("cannot open '%s': %m", command->data.snapshot_data.file);
+    free(data);
+    return -1;
+  }
+
+  if (fwrite(data, 1, count, file) != count) {
+    error("cannot write '%s': %m", command->data.snapshot_data.file);
+    fclose(file);
+    free(data);
+    return -1;
+  }
+
+  fclose(file);
+  free(data);
+
+  return 0;
+}
+
+
+static int
+cmd_restore_handler(struct command_t *command)
+{
+  int      ret;
+  uint8_t  data[EATER_SNAPSHOT_SIZE_MAX + 1];
+  size_t   count;
+  FILE    *file;
+
+  file = fopen(command->data.snapshot_data.file, "rb");
+  if (file == NULL) {
+    error("cannot open '%s': %m", command->data.snapshot_data.file);
+    return -1;
+  }
+
+  count = fread(data, 1, sizeof(data), file);
+  if (ferror(file)) {
+    error("cannot read '%s': %m", command->data.snapshot_data.file);
+    fclose(file);
+    return -1;
+  }
+
+  fclose(file);
+
+  if (count > EATER_SNAPSHOT_SIZE_MAX) {
+    error("'%s' is too large to be a snapshot",
+          command->data.snapshot_data.file);
+    return -1;
+  }
+
+  ret = eater_cmd_restore(data, count);
+  if (ret != EATER_OK) {
+    error("cannot send 'RESTORE' command to eater: %m", errno);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static int
+cmd_snapshot_opts_handler(struct command_t *command,
+                          const char *optname, char *optvalue)
+{
+  if (strcmp(optname, "file") == 0) {
+    command->data.snapshot_data.file = optvalue;
+  } else {
+    /* this is impossible */
+    assert( false );
+  }
+
+  return 0;
+}
+
+
+static bool
+cmd_snapshot_opts_validator(const struct command_t *command)
+{
+  if (command->data.snapshot_data.file == NULL) {
+    error("'file' parameter is required for '%s' command", command->name);
+    return false;
+  }
+
+  return true;
+}
+
+
 struct command_t commands[] = {
   {
     .name                = "hello",
@@ -325,7 +541,7 @@ struct command_t commands[] = {
 
     .data = {
       .feed_data = {
-        .food = NULL,
+        .n = 0,
       },
     },
 
@@ -376,7 +592,7 @@ struct command_t commands[] = {
 
     .data = {
       .rps_data = {
-        .sign = (enum rps_sign_t) -1,
+        .n = 0,
       },
     },
 
@@ -385,9 +601,135 @@ struct command_t commands[] = {
       { 0 },
     }
   },
+  {
+    .name                = "snapshot",
+    .requires_connection = true,
+    .handler             = cmd_snapshot_handler,
+    .opts_handler        = cmd_snapshot_opts_handler,
+    .opts_validator      = cmd_snapshot_opts_validator,
+
+    .data = {
+      .snapshot_data = {
+        .file = NULL,
+      },
+    },
+
+    .options = {
+      { "file", required_argument, NULL, 'f' },
+      { 0 },
+    }
+  },
+  {
+    .name                = "restore",
+    .requires_connection = true,
+    .handler             = cmd_restore_handler,
+    .opts_handler        = cmd_snapshot_opts_handler,
+    .opts_validator      = cmd_snapshot_opts_validator,
+
+    .data = {
+      .snapshot_data = {
+        .file = NULL,
+      },
+    },
+
+    .options = {
+      { "file", required_argument, NULL, 'f' },
+      { 0 },
+    }
+  },
+  {
+    .name                = "create",
+    .requires_connection = true,
+    .handler             = cmd_create_handler,
+    .opts_handler        = NULL,
+    .opts_validator      = NULL,
+
+    .options = {
+      { 0 },
+    },
+  },
+  {
+    .name                = "destroy",
+    .requires_connection = true,
+    .handler             = cmd_destroy_handler,
+    .opts_handler        = NULL,
+    .opts_validator      = NULL,
+
+    .options = {
+      { 0 },
+    },
+  },
+  {
+    .name                = "export",
+    .requires_connection = true,
+    .handler             = cmd_export_handler,
+    .opts_handler        = NULL,
+    .opts_validator      = NULL,
+
+    .options = {
+      { 0 },
+    },
+  },
 };
 
 
+/// Option addressing a command to an eater. Accepted by all the commands
+/// requiring connection.
+static const struct option id_option = { "id", required_argument, NULL, 'i' };
+
+
+/// Eater the command is addressed to.
+static uint32_t eater_id = EATER_ID_DEFAULT;
+
+
+/**
+ * Appends #id_option to the options of the command.
+ *
+ * @param command command
+ */
+static void
+add_id_option(struct command_t *command)
+{
+  int i;
+
+  for (i = 0; command->options[i].name != NULL; ++i) {
+    /* nothing */
+  }
+
+  assert( i < MAX_COMMAND_OPTIONS );
+
+  command->options[i]     = id_option;
+  command->options[i + 1] = (struct option) { 0 };
+}
+
+
+/**
+ * Handles #id_option.
+ *
+ * @param optvalue option value
+ *
+ * @retval  0 success
+ * @retval -1 invalid identifier
+ */
+static int
+id_opt_handler(const char *optvalue)
+{
+  char         *end;
+  unsigned long id;
+
+  errno = 0;
+  id    = strtoul(optvalue, &end, 10);
+  if (errno != 0 || *optvalue == '\0' || *end != '\0' || id > UINT32_MAX) {
+    error("invalid value '%s' for the 'id' parameter", optvalue);
+    return -1;
+  }
+
+  eater_id = id;
+
+  return 0;
+}
+
+
 /// Name of fake global command.
 #define GLOBAL_COMMAND "global"
 
@@ -526,6 +868,10 @@ main(int argc, char *argv[])
 
   remove_command(command, &argc, argv);
 
+  if (command->requires_connection) {
+    add_id_option(command);
+  }
+
   while (true) {
     int  optind = 0;
     char opt;
@@ -542,7 +888,13 @@ main(int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
-    ret = command_opts_handler(command, command->options[optind].name, optarg);
+    if (strcmp(command->options[optind].name, id_option.name) == 0) {
+      ret = id_opt_handler(optarg);
+    } else {
+      ret = command_opts_handler(command, command->options[optind].name,
+                                 optarg);
+    }
+
     if (ret != 0) {
       /* error message is supposed to be printed by the handler */
       return EXIT_FAILURE;
@@ -560,6 +912,8 @@ main(int argc, char *argv[])
       error("cannot connect to entropy eater");
       return EXIT_FAILURE;
     }
+
+    eater_select(eater_id);
   }
 
   ret = command_handler(command);
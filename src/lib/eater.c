@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <netlink/netlink.h>
 #include <netlink/msg.h>
@@ -15,11 +17,13 @@ struct connection_t {
                                  * to #EATER_PROTO_NAME. */
 
   struct nl_handle *sock;       /**< Netlink socket used for communications. */
+
+  uint32_t id;                  /**< Eater the commands are addressed to. */
 };
 
 
 /// Global connection to entropy eater.
-static struct connection_t connection = { 0, NULL };
+static struct connection_t connection = { 0, NULL, EATER_ID_DEFAULT };
 
 
 /**
@@ -98,9 +102,17 @@ eater_disconnect(void)
 }
 
 
+void
+eater_select(uint32_t id)
+{
+  connection.id = id;
+}
+
+
 static struct nl_msg *
 eater_prepare_message(enum eater_cmd_t cmd)
 {
+  int            ret;
   struct nl_msg *msg;
   void          *header;
 
@@ -119,6 +131,15 @@ eater_prepare_message(enum eater_cmd_t cmd)
     goto error;
   }
 
+  /* messages to the default eater are understood by older modules too */
+  if (connection.id != EATER_ID_DEFAULT) {
+    ret = nla_put_u32(msg, EATER_ATTR_ID, connection.id);
+    if (ret < 0) {
+      errno = -ret;
+      goto error;
+    }
+  }
+
   return msg;
 
 error:
@@ -213,19 +234,34 @@ out:
 
 int
 eater_cmd_feed(uint8_t *data, size_t count)
+{
+  return eater_cmd_feed_batch(&data, &count, 1);
+}
+
+
+int
+eater_cmd_feed_batch(uint8_t *data[], size_t counts[], size_t n)
 {
   int ret;
+  size_t i;
   struct nl_msg *msg;
 
+  if (n > EATER_FEED_PORTIONS_MAX) {
+    errno = EINVAL;
+    return EATER_ERROR;
+  }
+
   msg = eater_prepare_message(EATER_CMD_FEED);
   if (msg == NULL) {
     return EATER_ERROR;
   }
 
-  ret = nla_put(msg, EATER_ATTR_FOOD, count, data);
-  if (ret < 0) {
-    errno = -ret;
-    goto error;
+  for (i = 0; i < n; ++i) {
+    ret = nla_put(msg, EATER_ATTR_FOOD, counts[i], data[i]);
+    if (ret < 0) {
+      errno = -ret;
+      goto error;
+    }
   }
 
   ret = nl_send_auto_complete(connection.sock, msg);
@@ -310,3 +346,253 @@ eater_cmd_cure(void)
 {
   return eater_send_noarg_cmd(EATER_CMD_CURE);
 }
+
+
+int
+eater_cmd_create(void)
+{
+  return eater_send_noarg_cmd(EATER_CMD_CREATE);
+}
+
+
+int
+eater_cmd_destroy(void)
+{
+  return eater_send_noarg_cmd(EATER_CMD_DESTROY);
+}
+
+
+int
+eater_cmd_export_status(void)
+{
+  return eater_send_noarg_cmd(EATER_CMD_EXPORT_STATUS);
+}
+
+
+/// Snapshot received in reply to #EATER_CMD_SNAPSHOT.
+struct snapshot_t {
+  uint8_t *data;                /**< Snapshot; NULL if not received. */
+  size_t   count;               /**< Size of the snapshot. */
+  int      error;               /**< Error occurred while receiving. */
+};
+
+
+static int
+eater_cmd_snapshot_cb(struct nl_msg *msg, void *arg)
+{
+  int                ret;
+  struct nlattr     *attrs[EATER_ATTR_MAX + 1];
+  struct snapshot_t *snapshot = arg;
+
+  ret = genlmsg_parse(nlmsg_hdr(msg), 0, attrs, EATER_ATTR_MAX, NULL);
+  if (ret < 0 || attrs[EATER_ATTR_SNAPSHOT] == NULL) {
+    snapshot->error = EPROTO;
+    return NL_SKIP;
+  }
+
+  snapshot->count = nla_len(attrs[EATER_ATTR_SNAPSHOT]);
+  snapshot->data  = malloc(snapshot->count);
+  if (snapshot->data == NULL) {
+    snapshot->error = ENOMEM;
+    return NL_SKIP;
+  }
+
+  memcpy(snapshot->data, nla_data(attrs[EATER_ATTR_SNAPSHOT]),
+         snapshot->count);
+
+  return NL_OK;
+}
+
+
+int
+eater_cmd_snapshot(uint8_t **data, size_t *count)
+{
+  int ret;
+  struct nl_msg *msg;
+  struct snapshot_t snapshot = { NULL, 0, EPROTO };
+
+  msg = eater_prepare_message(EATER_CMD_SNAPSHOT);
+  if (msg == NULL) {
+    return EATER_ERROR;
+  }
+
+  ret = nl_send_auto_complete(connection.sock, msg);
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  ret = nl_socket_modify_cb(connection.sock, NL_CB_VALID,
+                            NL_CB_CUSTOM, eater_cmd_snapshot_cb, &snapshot);
+  assert( ret == 0 );
+
+  ret = nl_recvmsgs_default(connection.sock);
+
+  /* the callback must not outlive 'snapshot' */
+  nl_socket_modify_cb(connection.sock, NL_CB_VALID, NL_CB_DEFAULT, NULL, NULL);
+
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  if (snapshot.data == NULL) {
+    errno = snapshot.error;
+    goto error;
+  }
+
+  *data  = snapshot.data;
+  *count = snapshot.count;
+
+  ret = EATER_OK;
+  goto out;
+
+error:
+  free(snapshot.data);
+  ret = EATER_ERROR;
+out:
+  nlmsg_free(msg);
+  return ret;
+}
+
+
+int
+eater_cmd_restore(const uint8_t *data, size_t count)
+{
+  int ret;
+  struct nl_msg *msg;
+
+  if (count > EATER_SNAPSHOT_SIZE_MAX) {
+    errno = EINVAL;
+    return EATER_ERROR;
+  }
+
+  msg = eater_prepare_message(EATER_CMD_RESTORE);
+  if (msg == NULL) {
+    return EATER_ERROR;
+  }
+
+  ret = nla_put(msg, EATER_ATTR_SNAPSHOT, count, data);
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  ret = nl_send_auto_complete(connection.sock, msg);
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  ret = nl_recvmsgs_default(connection.sock);
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  ret = EATER_OK;
+  goto out;
+
+error:
+  ret = EATER_ERROR;
+out:
+  nlmsg_free(msg);
+  return ret;
+}
+
+
+/// Results received in reply to #EATER_CMD_PLAY_RPS_BATCH.
+struct rps_batch_t {
+  uint8_t *results;             /**< Where to store the results. */
+  size_t   count;               /**< Number of games played. */
+  char    *state;               /**< Where to store the social state. */
+  int      error;               /**< Error occurred while receiving; zero
+                                 * if the reply has been received. */
+};
+
+
+static int
+eater_cmd_play_rps_batch_cb(struct nl_msg *msg, void *arg)
+{
+  int                 ret;
+  struct nlattr      *attrs[EATER_ATTR_MAX + 1];
+  struct rps_batch_t *batch = arg;
+
+  ret = genlmsg_parse(nlmsg_hdr(msg), 0, attrs, EATER_ATTR_MAX, NULL);
+  if (ret < 0 ||
+      attrs[EATER_ATTR_RPS_RESULTS] == NULL ||
+      attrs[EATER_ATTR_SOCIAL_STATE] == NULL ||
+      (size_t) nla_len(attrs[EATER_ATTR_RPS_RESULTS]) != batch->count) {
+    batch->error = EPROTO;
+    return NL_SKIP;
+  }
+
+  memcpy(batch->results, nla_data(attrs[EATER_ATTR_RPS_RESULTS]),
+         batch->count);
+  nla_strlcpy(batch->state, attrs[EATER_ATTR_SOCIAL_STATE],
+              EATER_SOCIAL_STATE_SIZE_MAX);
+
+  batch->error = 0;
+
+  return NL_OK;
+}
+
+
+int
+eater_cmd_play_rps_batch(const uint8_t *signs, size_t count,
+                         uint8_t *results, char *state)
+{
+  int ret;
+  struct nl_msg *msg;
+  struct rps_batch_t batch = { results, count, state, EPROTO };
+
+  if (count == 0 || count > EATER_RPS_BATCH_MAX) {
+    errno = EINVAL;
+    return EATER_ERROR;
+  }
+
+  msg = eater_prepare_message(EATER_CMD_PLAY_RPS_BATCH);
+  if (msg == NULL) {
+    return EATER_ERROR;
+  }
+
+  ret = nla_put(msg, EATER_ATTR_RPS_SIGNS, count, signs);
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  ret = nl_send_auto_complete(connection.sock, msg);
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  ret = nl_socket_modify_cb(connection.sock, NL_CB_VALID,
+                            NL_CB_CUSTOM, eater_cmd_play_rps_batch_cb, &batch);
+  assert( ret == 0 );
+
+  ret = nl_recvmsgs_default(connection.sock);
+
+  /* the callback must not outlive 'batch' */
+  nl_socket_modify_cb(connection.sock, NL_CB_VALID, NL_CB_DEFAULT, NULL, NULL);
+
+  if (ret < 0) {
+    errno = -ret;
+    goto error;
+  }
+
+  if (batch.error != 0) {
+    errno = batch.error;
+    goto error;
+  }
+
+  ret = EATER_OK;
+  goto out;
+
+error:
+  ret = EATER_ERROR;
+out:
+  nlmsg_free(msg);
+  return ret;
+}
@@ -13,6 +13,7 @@
 
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "eater_interface.h"
 
@@ -47,6 +48,16 @@ void
 eater_disconnect(void);
 
 
+/**
+ * Addresses all the subsequent commands to the eater with the identifier.
+ * Commands are addressed to #EATER_ID_DEFAULT until this is called.
+ *
+ * @param id eater identifier
+ */
+void
+eater_select(uint32_t id);
+
+
 int
 eater_cmd_hello(void);
 
@@ -63,6 +74,19 @@ int
 eater_cmd_feed(uint8_t *data, size_t count);
 
 
+/**
+ * Feeds several portions of data to entropy eater in a single message.
+ *
+ * @param data   portions of data to feed
+ * @param counts sizes of the portions
+ * @param n      number of portions; must not exceed #EATER_FEED_PORTIONS_MAX
+ *
+ * @return
+ */
+int
+eater_cmd_feed_batch(uint8_t *data[], size_t counts[], size_t n);
+
+
 /**
  * Sweeps eater's room.
  *
@@ -93,6 +117,38 @@ int
 eater_cmd_cure(void);
 
 
+/**
+ * Creates the selected eater (see eater_select()).
+ *
+ *
+ * @return execution status
+ */
+int
+eater_cmd_create(void);
+
+
+/**
+ * Destroys the selected eater (see eater_select()). The default eater can't
+ * be destroyed.
+ *
+ *
+ * @return execution status
+ */
+int
+eater_cmd_destroy(void);
+
+
+/**
+ * Exports status of the selected eater (see eater_select()) via sysfs
+ * instead of the one exported so far.
+ *
+ *
+ * @return execution status
+ */
+int
+eater_cmd_export_status(void);
+
+
 /**
  * Plays in rock-paper-scissors game with eater.
  *
@@ -104,4 +160,49 @@ int
 eater_cmd_play_rps(enum rps_sign_t sign);
 
 
+/**
+ * Saves the state of eater's brain. The snapshot can be passed back to
+ * eater_cmd_restore() after the module has been reloaded.
+ *
+ * @param data  where to store the snapshot; must be freed with free()
+ * @param count where to store the size of the snapshot
+ *
+ * @return execution status
+ */
+int
+eater_cmd_snapshot(uint8_t **data, size_t *count);
+
+
+/**
+ * Restores the state of eater's brain from the snapshot made by
+ * eater_cmd_snapshot().
+ *
+ * @param data  snapshot
+ * @param count size of the snapshot; must not exceed
+ *              #EATER_SNAPSHOT_SIZE_MAX
+ *
+ * @return execution status
+ */
+int
+eater_cmd_restore(const uint8_t *data, size_t count);
+
+
+/**
+ * Plays several games of rock-paper-scissors with eater at once.
+ *
+ * @param signs   signs to show
+ * @param count   number of games; must not exceed #EATER_RPS_BATCH_MAX
+ * @param results where to store #rps_result_t results of the games (user
+ *                is the first player); must have room for @p count items
+ * @param state   where to store the name of eater's social state after the
+ *                games; must have room for #EATER_SOCIAL_STATE_SIZE_MAX
+ *                characters
+ *
+ * @return execution status
+ */
+int
+eater_cmd_play_rps_batch(const uint8_t *signs, size_t count,
+                         uint8_t *results, char *state);
+
+
 #endif /* _EATER_H_ */
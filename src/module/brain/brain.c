@@ -1,36 +1,243 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/mutex.h>
+
 #include "utils/trace.h"
+#include "utils/assert.h"
 
 #include "brain/brain.h"
+#include "brain/utils.h"
+#include "brain/params.h"
 #include "brain/living_fsm.h"
 #include "brain/sanitation_fsm.h"
 #include "brain/feeding_fsm.h"
 #include "brain/social_fsm.h"
 
 
+/// Seed of FSMs' random streams; zero makes FSMs draw from the kernel's
+/// generator.
+static unsigned long brain_seed;
+
+
+module_param_named(seed, brain_seed, ulong, S_IRUGO);
+MODULE_PARM_DESC(seed,
+                 "Seeds deterministic random generators of the eater's "
+                 "brain, so that identical inputs produce identical lives; "
+                 "0 (default) uses the kernel's generator");
+
+
+/// Offsets of FSMs in #brain_t in the order they are stored in snapshot.
+static const size_t brain_fsm_offsets[] = {
+  offsetof(struct brain_t, living.fsm),
+  offsetof(struct brain_t, sanitation.fsm),
+  offsetof(struct brain_t, feeding.fsm),
+  offsetof(struct brain_t, social.fsm),
+};
+
+
+#define BRAIN_FSM_COUNT ARRAY_SIZE(brain_fsm_offsets)
+
+
+/**
+ * Returns i-th FSM of the brain in snapshot order.
+ *
+ * @param brain brain
+ * @param i     index in #brain_fsm_offsets
+ *
+ * @return FSM
+ */
+static struct fsm_t *
+brain_fsm(struct brain_t *brain, size_t i)
+{
+  return (struct fsm_t *) ((char *) brain + brain_fsm_offsets[i]);
+}
+
+
+/// Serializes brain_build().
+static DEFINE_MUTEX(brain_build_lock);
+
+
+/// Serializes export of status.
+static DEFINE_MUTEX(brain_status_lock);
+
+
+/// Brain whose status is exported; protected by #brain_status_lock.
+static struct brain_t *brain_status_owner;
+
+
+/// Status attributes of #brain_status_owner.
+static struct status_attr_t *brain_status_attrs;
+
+
+/// Number of items in #brain_status_attrs.
+static size_t brain_status_count;
+
+
+/// Status attribute templates of FSMs.
+static const struct {
+  const struct status_attr_t *attrs; /**< Templates. */
+  const size_t               *count; /**< Number of templates. */
+} brain_status_templates[] = {
+  { living_fsm_status_attrs,     &living_fsm_status_attr_count     },
+  { sanitation_fsm_status_attrs, &sanitation_fsm_status_attr_count },
+  { feeding_fsm_status_attrs,    &feeding_fsm_status_attr_count    },
+  { social_fsm_status_attrs,     &social_fsm_status_attr_count     },
+};
+
+
+void
+brain_random_init(const struct brain_t *brain,
+                  struct random_stream_t *stream, enum brain_stream_t id)
+{
+  /* streams of the default eater (0) are the same as before the herd */
+  random_stream_init(stream, brain_seed,
+                     brain->id * BRAIN_STREAMS_COUNT + id);
+}
+
+
+/**
+ * Initializes facilities shared by the FSMs of all the brains.
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+static int
+brain_init_fsm_classes(void)
+{
+  int ret;
+
+  ret = living_fsm_class_init();
+  if (ret != 0) {
+    return ret;
+  }
+
+  ret = sanitation_fsm_class_init();
+  if (ret != 0) {
+    goto error_living_fsm_class_cleanup;
+  }
+
+  ret = feeding_fsm_class_init();
+  if (ret != 0) {
+    goto error_sanitation_fsm_class_cleanup;
+  }
+
+  ret = social_fsm_class_init();
+  if (ret != 0) {
+    goto error_feeding_fsm_class_cleanup;
+  }
+
+  return 0;
+
+error_feeding_fsm_class_cleanup:
+  feeding_fsm_class_cleanup();
+error_sanitation_fsm_class_cleanup:
+  sanitation_fsm_class_cleanup();
+error_living_fsm_class_cleanup:
+  living_fsm_class_cleanup();
+  return ret;
+}
+
+
+/**
+ * Cleanups facilities shared by the FSMs of all the brains.
+ */
+static void
+brain_cleanup_fsm_classes(void)
+{
+  social_fsm_class_cleanup();
+  feeding_fsm_class_cleanup();
+  sanitation_fsm_class_cleanup();
+  living_fsm_class_cleanup();
+}
+
+
 int
 brain_init(void)
 {
   int ret;
 
-  ret = living_fsm_init();
+  ret = brain_params_init();
+  if (ret != 0) {
+    TRACE_ERR("Failed to initialize brain parameters: %d", ret);
+    return ret;
+  }
+
+  ret = brain_init_fsm_classes();
+  if (ret != 0) {
+    TRACE_ERR("Failed to initialize brain FSM classes: %d", ret);
+    goto error_params_cleanup;
+  }
+
+  return 0;
+
+error_params_cleanup:
+  brain_params_cleanup();
+  return ret;
+}
+
+
+void
+brain_cleanup(void)
+{
+  brain_cleanup_fsm_classes();
+  brain_params_cleanup();
+}
+
+
+struct brain_t *
+brain_create(u32 id)
+{
+  struct brain_t *brain;
+
+  brain = kzalloc(sizeof(*brain), GFP_KERNEL);
+  if (brain == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  brain->id    = id;
+  brain->built = false;
+  atomic_set(&brain->refs, 1);
+  INIT_HLIST_NODE(&brain->hash);
+
+  return brain;
+}
+
+
+/**
+ * Initializes all the FSMs of the brain.
+ *
+ * @param brain brain
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+static int
+brain_init_fsms(struct brain_t *brain)
+{
+  int ret;
+
+  ret = living_fsm_init(brain);
   if (ret != 0) {
     TRACE_ERR("Failed to initialize living FSM: %d", ret);
     return ret;
   }
 
-  ret = sanitation_fsm_init();
+  ret = sanitation_fsm_init(brain);
   if (ret != 0) {
     TRACE_ERR("Failed to initialize sanitation FSM: %d", ret);
     goto error_living_fsm_cleanup;
   }
 
-  ret = feeding_fsm_init();
+  ret = feeding_fsm_init(brain);
   if (ret != 0) {
     TRACE_ERR("Failed to initialize feeding FSM: %d", ret);
     goto error_sanitation_fsm_cleanup;
   }
 
-  ret = social_fsm_init();
+  ret = social_fsm_init(brain);
   if (ret != 0) {
     TRACE_ERR("Failed to initialize social FSM: %d", ret);
     goto error_feeding_fsm_cleanup;
@@ -39,20 +246,236 @@ brain_init(void)
   return 0;
 
 error_feeding_fsm_cleanup:
-  feeding_fsm_cleanup();
+  feeding_fsm_cleanup(brain);
 error_sanitation_fsm_cleanup:
-  sanitation_fsm_cleanup();
+  sanitation_fsm_cleanup(brain);
 error_living_fsm_cleanup:
-  living_fsm_cleanup();
+  living_fsm_cleanup(brain);
   return ret;
 }
 
 
+int
+brain_build(struct brain_t *brain)
+{
+  int ret = 0;
+
+  if (ACCESS_ONCE(brain->built)) {
+    /* pairs with smp_wmb() below */
+    smp_rmb();
+    return 0;
+  }
+
+  mutex_lock(&brain_build_lock);
+
+  if (!brain->built) {
+    ret = brain_init_fsms(brain);
+    if (ret == 0) {
+      /* FSMs must be seen initialized by whoever sees the flag */
+      smp_wmb();
+      brain->built = true;
+
+      TRACE_DEBUG("Brain of eater %u built", brain->id);
+      ret = 1;
+    }
+  }
+
+  mutex_unlock(&brain_build_lock);
+
+  return ret;
+}
+
+
+/**
+ * Frees the brain once RCU grace period is over.
+ *
+ * @param rcu embedded RCU head
+ */
+static void
+brain_free_rcu(struct rcu_head *rcu)
+{
+  kfree(container_of(rcu, struct brain_t, rcu));
+}
+
+
 void
-brain_cleanup(void)
+brain_destroy(struct brain_t *brain)
+{
+  brain_status_remove(brain);
+
+  if (brain->built) {
+    living_fsm_die_nobly(brain);
+
+    /* other FSMs may notify living FSM, so it goes last */
+    social_fsm_cleanup(brain);
+    feeding_fsm_cleanup(brain);
+    sanitation_fsm_cleanup(brain);
+    living_fsm_cleanup(brain);
+  }
+
+  call_rcu(&brain->rcu, brain_free_rcu);
+}
+
+
+/**
+ * Removes exported status files. Must be called with #brain_status_lock
+ * held.
+ */
+static void
+__brain_status_remove(void)
 {
-  social_fsm_cleanup();
-  feeding_fsm_cleanup();
-  sanitation_fsm_cleanup();
-  living_fsm_cleanup();
+  if (brain_status_owner == NULL) {
+    return;
+  }
+
+  status_remove_files(brain_status_attrs, brain_status_count);
+  kfree(brain_status_attrs);
+
+  brain_status_owner = NULL;
+  brain_status_attrs = NULL;
+  brain_status_count = 0;
+}
+
+
+int
+brain_status_create(struct brain_t *brain, bool replace)
+{
+  int    ret = 0;
+  size_t i;
+  size_t j;
+  size_t count = 0;
+
+  struct status_attr_t *attrs;
+
+  ASSERT( brain->built );
+
+  for (i = 0; i < ARRAY_SIZE(brain_status_templates); ++i) {
+    count += *brain_status_templates[i].count;
+  }
+
+  mutex_lock(&brain_status_lock);
+
+  if (brain_status_owner == brain ||
+      (brain_status_owner != NULL && !replace)) {
+    goto out;
+  }
+
+  attrs = kcalloc(count, sizeof(*attrs), GFP_KERNEL);
+  if (attrs == NULL) {
+    ret = -ENOMEM;
+    goto out;
+  }
+
+  count = 0;
+  for (i = 0; i < ARRAY_SIZE(brain_status_templates); ++i) {
+    for (j = 0; j < *brain_status_templates[i].count; ++j, ++count) {
+      attrs[count]      = brain_status_templates[i].attrs[j];
+      attrs[count].data = (char *) brain + (size_t) attrs[count].data;
+    }
+  }
+
+  __brain_status_remove();
+
+  ret = status_create_files(attrs, count);
+  if (ret != 0) {
+    TRACE_ERR("Failed to create sysfs attributes of eater %u: %d",
+              brain->id, ret);
+    kfree(attrs);
+    goto out;
+  }
+
+  brain_status_owner = brain;
+  brain_status_attrs = attrs;
+  brain_status_count = count;
+
+  TRACE_INFO("Status of eater %u exported", brain->id);
+
+out:
+  mutex_unlock(&brain_status_lock);
+  return ret;
+}
+
+
+void
+brain_status_remove(struct brain_t *brain)
+{
+  mutex_lock(&brain_status_lock);
+
+  if (brain_status_owner == brain) {
+    __brain_status_remove();
+  }
+
+  mutex_unlock(&brain_status_lock);
+}
+
+
+size_t
+brain_snapshot(struct brain_t *brain, void *buffer, size_t size)
+{
+  size_t i;
+  size_t offset = sizeof(struct brain_snapshot_t);
+
+  struct brain_snapshot_t *header = buffer;
+
+  for (i = 0; i < BRAIN_FSM_COUNT; ++i) {
+    offset += fsm_snapshot(brain_fsm(brain, i), (char *) buffer + offset,
+                           offset < size ? size - offset : 0);
+  }
+
+  if (offset <= size) {
+    header->magic     = BRAIN_SNAPSHOT_MAGIC;
+    header->version   = BRAIN_SNAPSHOT_VERSION;
+    header->fsm_count = BRAIN_FSM_COUNT;
+  }
+
+  return offset;
+}
+
+
+int
+brain_restore(struct brain_t *brain, const void *buffer, size_t size)
+{
+  size_t  i;
+  ssize_t ret;
+  size_t  offset = sizeof(struct brain_snapshot_t);
+
+  const struct brain_snapshot_t *header = buffer;
+  struct fsm_restore_t           restores[BRAIN_FSM_COUNT];
+
+  if (size < sizeof(*header) || header->magic != BRAIN_SNAPSHOT_MAGIC) {
+    TRACE_ERR("Not a brain snapshot");
+    return -EINVAL;
+  }
+
+  if (header->version != BRAIN_SNAPSHOT_VERSION ||
+      header->fsm_count != BRAIN_FSM_COUNT) {
+    TRACE_ERR("Unsupported brain snapshot version %u",
+              (unsigned int) header->version);
+    return -EINVAL;
+  }
+
+  /* either all the FSMs are restored or none: everything that may fail is
+   * done before the first one is changed */
+  for (i = 0; i < BRAIN_FSM_COUNT; ++i) {
+    ret = fsm_restore_prepare(brain_fsm(brain, i), &restores[i],
+                              (const char *) buffer + offset, size - offset);
+    if (ret < 0) {
+      goto error_abort;
+    }
+
+    offset += ret;
+  }
+
+  for (i = 0; i < BRAIN_FSM_COUNT; ++i) {
+    fsm_restore_commit(brain_fsm(brain, i), &restores[i]);
+  }
+
+  return 0;
+
+error_abort:
+  while (i-- > 0) {
+    fsm_restore_abort(&restores[i]);
+  }
+
+  return ret;
 }
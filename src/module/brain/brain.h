@@ -3,7 +3,7 @@
  * @author Aliaksiej Artamonaŭ <aliaksiej.artamonau@gmail.com>
  * @date   Sun Oct 10 10:41:38 2010
  *
- * @brief  Provides initialization/cleanup facilities for all the FSMs.
+ * @brief  Brain of entropy eater: all the FSMs of a single eater.
  *
  *
  */
@@ -11,22 +11,193 @@
 #define _BRAIN__BRAIN_H_
 
 
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <asm/atomic.h>
+
+#include "status/status.h"
+
+#include "brain/living_fsm.h"
+#include "brain/sanitation_fsm.h"
+#include "brain/feeding_fsm.h"
+#include "brain/social_fsm.h"
+
+
+/// Magic number identifying brain snapshots ("EATR").
+#define BRAIN_SNAPSHOT_MAGIC 0x52544145
+
+
+/// Version of snapshot format. Must be bumped whenever layout of
+/// #brain_snapshot_t, #fsm_snapshot_t or data saved by any of FSMs changes.
+#define BRAIN_SNAPSHOT_VERSION 4
+
+
+/// Header of brain snapshot. Followed by snapshots of living, sanitation,
+/// feeding and social FSMs (see #fsm_snapshot_t). All the fields are in host
+/// byte order.
+struct brain_snapshot_t {
+  u32 magic;                    /**< #BRAIN_SNAPSHOT_MAGIC. */
+  u16 version;                  /**< #BRAIN_SNAPSHOT_VERSION. */
+  u16 fsm_count;                /**< Number of FSM snapshots. */
+} __attribute__((packed));
+
+
+/// Brain of a single entropy eater. Brains are created by herd_create()
+/// and are freed after RCU grace period once the last reference is dropped
+/// (see herd_put()). FSMs are not initialized until brain_build() is called,
+/// so that eaters nobody talks to cost just an allocation.
+struct brain_t {
+  u32               id;         /**< Eater identifier. */
+  atomic_t          refs;       /**< Reference counter. */
+  struct hlist_node hash;       /**< Links brain into herd hash table. */
+  struct rcu_head   rcu;        /**< Used to free the brain. */
+  struct brain_t   *reap_next;  /**< Next dead brain waiting to be reaped
+                                 * (see herd_reap()). */
+
+  bool              built;      /**< FSMs have been initialized. */
+
+  struct living_fsm_t     living;
+  struct sanitation_fsm_t sanitation;
+  struct feeding_fsm_t    feeding;
+  struct social_fsm_t     social;
+};
+
+
 /**
- * Initializes all the FSMs.
+ * Casts a pointer to FSM embedded into a brain to the brain.
  *
+ * @param _fsm    pointer to FSM
+ * @param _member name of the FSM in #brain_t
  *
- * @return
+ * @return containing brain
+ */
+#define brain_of(_fsm, _member) \
+  container_of(_fsm, struct brain_t, _member)
+
+
+/**
+ * Private data of status attribute templates exported by FSMs: offset of
+ * the member in #brain_t. Rebased onto the brain by brain_status_create().
+ *
+ * @param _member member of #brain_t
+ */
+#define BRAIN_STATUS_DATA(_member) \
+  ((void *) offsetof(struct brain_t, _member))
+
+
+/**
+ * Initializes facilities shared by all the brains.
+ *
+ *
+ * @retval  0 success
+ * @retval <0 error code
  */
 int
 brain_init(void);
 
 
 /**
- * Cleanups all the FSMs.
+ * Cleanups facilities shared by all the brains. All the brains must be
+ * destroyed by now.
  *
  */
 void
 brain_cleanup(void);
 
 
+/**
+ * Creates a brain. FSMs are left uninitialized (see brain_build()).
+ *
+ * @param id eater identifier
+ *
+ * @return the brain with one reference held or ERR_PTR() of error code
+ */
+struct brain_t *
+brain_create(u32 id);
+
+
+/**
+ * Initializes all the FSMs of the brain unless it's been done already. Must
+ * be called before any FSM of the brain is used. May sleep.
+ *
+ * @param brain brain
+ *
+ * @retval  1 the brain has been built by this call
+ * @retval  0 the brain had been built already
+ * @retval <0 error code; the brain stays unbuilt
+ */
+int
+brain_build(struct brain_t *brain);
+
+
+/**
+ * Makes the eater die nobly, cleanups all the FSMs and frees the brain
+ * after RCU grace period. May sleep.
+ *
+ * @param brain brain to destroy
+ */
+void
+brain_destroy(struct brain_t *brain);
+
+
+/**
+ * Exports status of all the FSMs of a built brain via sysfs. Attributes are
+ * named the same for all the brains, so status of only one brain is
+ * exported at a time.
+ *
+ * @param brain   brain
+ * @param replace whether to take over the files if status of another brain
+ *                is exported; otherwise nothing is done in this case
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+int
+brain_status_create(struct brain_t *brain, bool replace);
+
+
+/**
+ * Removes status files created by brain_status_create(). Does nothing if
+ * status of the brain is not exported.
+ *
+ * @param brain brain
+ */
+void
+brain_status_remove(struct brain_t *brain);
+
+
+/**
+ * Saves all the FSMs into a snapshot. FSMs are saved one by one, so the
+ * snapshot is consistent only if eater is not disturbed meanwhile.
+ *
+ * @param brain  brain to save
+ * @param buffer buffer to write the snapshot to
+ * @param size   size of the buffer
+ *
+ * @return size of the snapshot; if it's larger than the size of the buffer
+ *         the snapshot has not been written completely
+ */
+size_t
+brain_snapshot(struct brain_t *brain, void *buffer, size_t size);
+
+
+/**
+ * Restores all the FSMs from a snapshot made by brain_snapshot(), possibly
+ * by another version of the module. Either all the FSMs are restored or
+ * none of them is changed.
+ *
+ * @param brain  brain to restore
+ * @param buffer buffer containing the snapshot
+ * @param size   size of the buffer
+ *
+ * @retval  0 success
+ * @retval <0 error code; -EINVAL if snapshot is malformed or has
+ *            incompatible version
+ */
+int
+brain_restore(struct brain_t *brain, const void *buffer, size_t size);
+
+
 #endif /* _BRAIN__BRAIN_H_ */
@@ -1,8 +1,17 @@
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/hash.h>
+#include <asm/atomic.h>
+
 #include "fsm/fsm.h"
+#include "fsm/clock.h"
+#include "fsm/stats.h"
 
 #include "utils/assert.h"
 #include "utils/entropy.h"
 
+#include "brain/brain.h"
 #include "brain/utils.h"
 #include "brain/params.h"
 #include "brain/feeding_fsm.h"
@@ -10,11 +19,20 @@
 #include "brain/sanitation_fsm.h"
 
 
+/// X-macro list of feeding FSM events.
+#define FEEDING_EVENTS(X)                                               \
+  X(FEEDING_EVENT_INIT)                                                 \
+  /* Folds entropy eaten on all CPUs into the balance. Emitted by      \
+   * feeders whose local accumulator has reached the fold threshold. */ \
+  X(FEEDING_EVENT_FEED)                                                 \
+  /* Applies feeding times elapsed so far. Emitted by the state timeout \
+   * when the eater is about to starve. */                              \
+  X(FEEDING_EVENT_FEEDING_TIME)
+
+
 /// Feeding FSM events.
 enum feeding_event_t {
-  FEEDING_EVENT_INIT,
-  FEEDING_EVENT_FEED,
-  FEEDING_EVENT_FEEDING_TIME,
+  FEEDING_EVENTS(FSM_ENUM_ITEM)
   __FEEDING_EVENT_LAST
 };
 
@@ -22,31 +40,20 @@ enum feeding_event_t {
 #define FEEDING_EVENTS_COUNT __FEEDING_EVENT_LAST
 
 
-/// Checks that event is valid.
-#define ASSERT_VALID_EVENT(event) \
-  ASSERT_IN_RANGE(event, 0, FEEDING_EVENTS_COUNT - 1)
+FSM_DEFINE_TO_STR(feeding_event_to_str, enum feeding_event_t,
+                  FEEDING_EVENTS, FEEDING_EVENTS_COUNT)
 
 
-static inline const char *
-feeding_event_to_str(enum feeding_event_t event)
-{
-  static const char *strs[] = {
-    "FEEDING_EVENT_INIT",
-    "FEEDING_EVENT_FEED",
-    "FEEDING_EVENT_FEEDING_TIME",
-  };
-
-  ASSERT_VALID_EVENT(event);
-
-  return strs[event];
-}
+/// X-macro list of feeding FSM states.
+#define FEEDING_STATES(X)                       \
+  X(FEEDING_STATE_NORMAL)                       \
+  X(FEEDING_STATE_HUNGRY)                       \
+  X(FEEDING_STATE_OVEREATEN)
 
 
 /// Feeding FSM states.
 enum feeding_state_t {
-  FEEDING_STATE_NORMAL,
-  FEEDING_STATE_HUNGRY,
-  FEEDING_STATE_OVEREATEN,
+  FEEDING_STATES(FSM_ENUM_ITEM)
   __FEEDING_STATE_LAST
 };
 
@@ -54,63 +61,181 @@ enum feeding_state_t {
 #define FEEDING_STATES_COUNT __FEEDING_STATE_LAST
 
 
-/// Checks that state is valid.
-#define ASSERT_VALID_STATE(state) \
-  ASSERT_IN_RANGE(state, 0, FEEDING_STATES_COUNT - 1)
+FSM_DEFINE_TO_STR(feeding_state_to_str, enum feeding_state_t,
+                  FEEDING_STATES, FEEDING_STATES_COUNT)
+
+
+/// Number of bits in index of entropy accumulators.
+#define FEEDING_SLOTS_BITS 8
+
+
+/// Number of entropy accumulators per CPU.
+#define FEEDING_SLOTS_COUNT (1 << FEEDING_SLOTS_BITS)
+
+
+/// Accumulators of entropy eaten on a CPU, shared by all the feeding FSMs.
+/// FSM uses the slot picked by hash of its tag and owns it till the slot is
+/// drained. Slot keeps the owner's tag in the upper half and pending entropy
+/// in the lower one; zero marks a free slot.
+struct feeding_slots_t {
+  atomic64_t slots[FEEDING_SLOTS_COUNT]; /**< Accumulators. */
+};
+
+
+/// Per-CPU accumulators. Allocated dynamically since they are too large for
+/// the per-CPU area reserved for modules.
+static struct feeding_slots_t __percpu *feeding_slots;
+
+
+/// Last tag given to a feeding FSM.
+static atomic_t feeding_fsm_last_tag = ATOMIC_INIT(0);
 
 
-static inline const char *
-feeding_state_to_str(enum feeding_state_t state)
+/// Returns tag of the FSM owning the slot.
+static inline u32
+feeding_slot_tag(u64 slot)
 {
-  static const char *strs[] = {
-    "FEEDING_STATE_NORMAL",
-    "FEEDING_STATE_HUNGRY",
-    "FEEDING_STATE_OVEREATEN",
-  };
+  return slot >> 32;
+}
 
-  ASSERT_VALID_STATE(state);
 
-  return strs[state];
+/// Returns entropy pending in the slot.
+static inline u32
+feeding_slot_entropy(u64 slot)
+{
+  return (u32) slot;
 }
 
 
-/// Feeding FSM type.
-struct feeding_fsm_t {
-  int entropy_balance;           /**< Consumed entropy balance. Should be
-                                  * close to zero. */
+/**
+ * Returns the slot FSM accumulates entropy in on the CPU.
+ *
+ * @param feeding_fsm feeding FSM
+ * @param slots       accumulators of the CPU
+ *
+ * @return slot
+ */
+static inline atomic64_t *
+feeding_fsm_slot(const struct feeding_fsm_t *feeding_fsm,
+                 struct feeding_slots_t *slots)
+{
+  return &slots->slots[hash_32(feeding_fsm->tag, FEEDING_SLOTS_BITS)];
+}
 
-  struct fsm_t fsm;
-};
 
+/**
+ * Sums accumulators without draining them.
+ *
+ * @param feeding_fsm feeding FSM
+ *
+ * @return pending entropy
+ */
+static int
+feeding_fsm_pending(const struct feeding_fsm_t *feeding_fsm)
+{
+  int cpu;
+  int entropy = atomic_read(&feeding_fsm->overflow);
+  u64 slot;
+
+  for_each_possible_cpu(cpu) {
+    slot = atomic64_read(feeding_fsm_slot(feeding_fsm,
+                                          per_cpu_ptr(feeding_slots, cpu)));
+    if (feeding_slot_tag(slot) == feeding_fsm->tag) {
+      entropy += feeding_slot_entropy(slot);
+    }
+  }
 
-/// Feeding FSM.
-static struct feeding_fsm_t feeding_fsm;
+  return entropy;
+}
+
+
+/**
+ * Drains accumulators and frees the slots.
+ *
+ * @param feeding_fsm feeding FSM
+ *
+ * @return entropy drained
+ */
+static int
+feeding_fsm_drain_pending(struct feeding_fsm_t *feeding_fsm)
+{
+  int         cpu;
+  int         entropy = atomic_xchg(&feeding_fsm->overflow, 0);
+  u64         old;
+  u64         prev;
+  atomic64_t *slot;
+
+  for_each_possible_cpu(cpu) {
+    slot = feeding_fsm_slot(feeding_fsm, per_cpu_ptr(feeding_slots, cpu));
+    old  = atomic64_read(slot);
+
+    /* feeders may be adding to the slot meanwhile */
+    while (feeding_slot_tag(old) == feeding_fsm->tag) {
+      prev = atomic64_cmpxchg(slot, old, 0);
+      if (prev == old) {
+        entropy += feeding_slot_entropy(old);
+        break;
+      }
+
+      old = prev;
+    }
+  }
+
+  return entropy;
+}
+
+
+/// Exports FSM state via sysfs.
+static ssize_t
+feeding_fsm_state_attr_show(const char *name,
+                            struct feeding_fsm_t *feeding_fsm,
+                            char *buffer);
 
 
 /// Exports entropy_balance via sysfs.
 static ssize_t
 feeding_fsm_entropy_balance_attr_show(const char *name,
-                                      const struct feeding_fsm_t *feeding_fsm,
+                                      struct feeding_fsm_t *feeding_fsm,
                                       char *buffer);
 
 
-/// Sysfs attributes.
-static struct status_attr_t feeding_fsm_attrs[] = {
+const struct status_attr_t feeding_fsm_status_attrs[] = {
+  STATUS_ATTR(feeding_fsm_state,
+              (status_attr_show_t) feeding_fsm_state_attr_show,
+              BRAIN_STATUS_DATA(feeding)),
+  FSM_STATS_ATTR(feeding_fsm_stats, BRAIN_STATUS_DATA(feeding.fsm)),
   STATUS_ATTR(entropy_balance,
               (status_attr_show_t) feeding_fsm_entropy_balance_attr_show,
-              &feeding_fsm),
+              BRAIN_STATUS_DATA(feeding)),
 };
 
 
+const size_t feeding_fsm_status_attr_count =
+  ARRAY_SIZE(feeding_fsm_status_attrs);
+
+
 /**
  * Returns feeding FSM state by current entropy balance.
  *
+ * @param params          parameters
  * @param entropy_balance entropy balance
  *
  * @return feeding state
  */
 static enum feeding_state_t
-classify_entropy_balance(int entropy_balance);
+classify_entropy_balance(const struct brain_params_t *params,
+                         int entropy_balance);
+
+
+/**
+ * Recomputes fold threshold after entropy balance has changed.
+ *
+ * @param feeding_fsm feeding FSM
+ * @param params      parameters
+ */
+static void
+feeding_fsm_update_fold_threshold(struct feeding_fsm_t *feeding_fsm,
+                                  const struct brain_params_t *params);
 
 
 /// Handles #FEEDING_EVENT_INIT event.
@@ -125,18 +250,10 @@ feeding_fsm_feeding_time_handler(enum feeding_state_t state,
                                  struct feeding_fsm_t *feeding_fsm);
 
 
-/// Data for #FEEDING_EVENT_FEED event.
-struct feeding_event_feed_data_t {
-  size_t count;                 /**< Length of the food data. */
-  u8    *food;                  /**< Food. */
-};
-
-
 /// Handles #FEEDING_EVENT_FEED event.
 static int
 feeding_fsm_feed_handler(enum feeding_state_t state,
-                         struct feeding_fsm_t *feeding_fsm,
-                         struct feeding_event_feed_data_t *feed_data);
+                         struct feeding_fsm_t *feeding_fsm);
 
 
 /// Feeding FSM event handlers.
@@ -149,141 +266,507 @@ struct fsm_event_handler_t feeding_fsm_handlers[FEEDING_EVENTS_COUNT] = {
     FEEDING_EVENT_FEEDING_TIME,
     (fsm_event_handler_no_data_t) feeding_fsm_feeding_time_handler
   ),
-  EVENT         (
+  EVENT_NO_DATA (
     FEEDING_EVENT_FEED,
-    (fsm_event_handler_t)         feeding_fsm_feed_handler
+    (fsm_event_handler_no_data_t) feeding_fsm_feed_handler
   )
 };
 
 
+/// Returns time left till the eater starves if not fed.
+static unsigned long
+feeding_fsm_starvation_timeout(enum feeding_state_t state,
+                               const struct feeding_fsm_t *feeding_fsm);
+
+
+/// Feeding FSM state timeouts.
+static const struct fsm_state_timeout_t
+feeding_fsm_timeouts[FEEDING_STATES_COUNT] = {
+  [FEEDING_STATE_NORMAL]    = { .event = FEEDING_EVENT_FEEDING_TIME,
+                                .delay = (fsm_timeout_delay_fn_t)
+                                         feeding_fsm_starvation_timeout },
+  [FEEDING_STATE_HUNGRY]    = { .event = FEEDING_EVENT_FEEDING_TIME,
+                                .delay = (fsm_timeout_delay_fn_t)
+                                         feeding_fsm_starvation_timeout },
+  [FEEDING_STATE_OVEREATEN] = { .event = FEEDING_EVENT_FEEDING_TIME,
+                                .delay = (fsm_timeout_delay_fn_t)
+                                         feeding_fsm_starvation_timeout },
+};
+
+
+/// Feeding FSM timer slacks.
+static const unsigned long
+feeding_fsm_slacks[FEEDING_EVENTS_COUNT] = {
+  [FEEDING_EVENT_FEEDING_TIME] = EATER_TIMER_SLACK,
+};
+
+
+/// Feeding FSM data saved in snapshots.
+struct feeding_fsm_snapshot_t {
+  s32 entropy_balance;          /**< See #feeding_fsm_t. */
+  u32 next_feeding_time;        /**< Time left till the next feeding time
+                                 * (virtual ms). */
+  u32 feeding_period;           /**< See #feeding_fsm_t (virtual ms). */
+  s32 hunger;                   /**< See #feeding_fsm_t. */
+} __attribute__((packed));
+
+
+/// Saves feeding FSM data into snapshot.
+static void
+feeding_fsm_save(const struct feeding_fsm_t *feeding_fsm,
+                 struct feeding_fsm_snapshot_t *snapshot)
+{
+  unsigned long now = fsm_clock_now();
+
+  snapshot->entropy_balance   =
+    feeding_fsm->entropy_balance + feeding_fsm_pending(feeding_fsm);
+  snapshot->next_feeding_time =
+    time_after(feeding_fsm->next_feeding_time, now) ?
+    jiffies_to_msecs(feeding_fsm->next_feeding_time - now) : 0;
+  snapshot->feeding_period    = jiffies_to_msecs(feeding_fsm->feeding_period);
+  snapshot->hunger            = feeding_fsm->hunger;
+}
+
+
+/// Checks feeding FSM data saved in snapshot.
+static bool
+feeding_fsm_validate(const struct feeding_fsm_snapshot_t *snapshot)
+{
+  return snapshot->feeding_period != 0 && snapshot->hunger > 0;
+}
+
+
+/// Loads feeding FSM data from snapshot.
+static void
+feeding_fsm_load(struct feeding_fsm_t *feeding_fsm,
+                 const struct feeding_fsm_snapshot_t *snapshot)
+{
+  feeding_fsm->entropy_balance   = snapshot->entropy_balance;
+  feeding_fsm->next_feeding_time =
+    fsm_clock_now() + msecs_to_jiffies(snapshot->next_feeding_time);
+  feeding_fsm->feeding_period    = msecs_to_jiffies(snapshot->feeding_period);
+  feeding_fsm->hunger            = snapshot->hunger;
+
+  /* pending entropy has been eaten by the eater being replaced */
+  feeding_fsm_drain_pending(feeding_fsm);
+  feeding_fsm_update_fold_threshold(feeding_fsm, brain_params_read_lock());
+  brain_params_read_unlock();
+}
+
+
+/// Returns identifier of the eater the FSM belongs to.
+static u32
+feeding_fsm_instance(const struct feeding_fsm_t *feeding_fsm)
+{
+  return brain_of(feeding_fsm, feeding)->id;
+}
+
+
+/// Feeding FSM statistics.
+FSM_DEFINE_STATS(feeding_fsm_stats);
+
+
+/// Feeding FSM class.
+static const struct fsm_class_t feeding_fsm_class = {
+  .name          = "feeding_fsm",
+  .state_count   = FEEDING_STATES_COUNT,
+  .event_count   = FEEDING_EVENTS_COUNT,
+  .show_state    = (fsm_state_show_fn_t) feeding_state_to_str,
+  .show_event    = (fsm_event_show_fn_t) feeding_event_to_str,
+  .data_offset   = offsetof(struct feeding_fsm_t, fsm),
+  .handlers      = feeding_fsm_handlers,
+  .transitions   = NULL,
+  .timeouts      = feeding_fsm_timeouts,
+  .guards        = NULL,
+  .slacks        = feeding_fsm_slacks,
+  .stats         = &feeding_fsm_stats,
+  .instance      = (u32 (*)(const void *)) feeding_fsm_instance,
+  .snapshot_size = sizeof(struct feeding_fsm_snapshot_t),
+  .save          = (void (*)(const void *, void *)) feeding_fsm_save,
+  .validate      = (bool (*)(const void *)) feeding_fsm_validate,
+  .load          = (void (*)(void *, const void *)) feeding_fsm_load,
+};
+
+
 int
-feeding_fsm_init(void)
+feeding_fsm_class_init(void)
 {
   int ret;
 
-  ret = fsm_init(&feeding_fsm.fsm, "feeding_fsm",
-                 FEEDING_STATES_COUNT, FEEDING_EVENTS_COUNT,
-                 (fsm_state_show_fn_t) feeding_state_to_str,
-                 (fsm_event_show_fn_t) feeding_event_to_str,
-                 &feeding_fsm, feeding_fsm_handlers);
+  feeding_slots = alloc_percpu(struct feeding_slots_t);
+  if (feeding_slots == NULL) {
+    TRACE_ERR("Failed to allocate entropy accumulators");
+    return -ENOMEM;
+  }
 
+  ret = fsm_class_init(&feeding_fsm_class);
   if (ret != 0) {
-    return ret;
+    goto error_free_slots;
   }
 
-  ret = fsm_emit_simple(&feeding_fsm.fsm, FEEDING_EVENT_INIT);
+  return 0;
+
+error_free_slots:
+  free_percpu(feeding_slots);
+  feeding_slots = NULL;
+  return ret;
+}
+
+
+void
+feeding_fsm_class_cleanup(void)
+{
+  fsm_class_cleanup(&feeding_fsm_class);
+
+  free_percpu(feeding_slots);
+  feeding_slots = NULL;
+}
+
+
+int
+feeding_fsm_init(struct brain_t *brain)
+{
+  int ret;
+
+  struct feeding_fsm_t *feeding_fsm = &brain->feeding;
+
+  /* zero tag would make a slot look free */
+  do {
+    feeding_fsm->tag = atomic_inc_return(&feeding_fsm_last_tag);
+  } while (feeding_fsm->tag == 0);
+
+  atomic_set(&feeding_fsm->overflow, 0);
+
+  brain_random_init(brain, &feeding_fsm->random, BRAIN_STREAM_FEEDING);
+
+  ret = fsm_init(&feeding_fsm->fsm, &feeding_fsm_class);
   if (ret != 0) {
-    goto error;
+    return ret;
   }
 
-  ret = status_create_files(feeding_fsm_attrs, ARRAY_SIZE(feeding_fsm_attrs));
+  ret = fsm_emit_simple(&feeding_fsm->fsm, FEEDING_EVENT_INIT);
   if (ret != 0) {
-    TRACE_ERR("Failed to create feeding FSM sysfs attributes: %d", ret);
-    goto error;
+    goto error_fsm_cleanup;
   }
 
   return 0;
 
-error:
-  fsm_cleanup(&feeding_fsm.fsm);
+error_fsm_cleanup:
+  fsm_cleanup(&feeding_fsm->fsm);
   return ret;
 }
 
 
 void
-feeding_fsm_cleanup(void)
+feeding_fsm_cleanup(struct brain_t *brain)
 {
-  status_remove_files(feeding_fsm_attrs, ARRAY_SIZE(feeding_fsm_attrs));
-  fsm_cleanup(&feeding_fsm.fsm);
+  fsm_cleanup(&brain->feeding.fsm);
+
+  /* frees the slots for other eaters */
+  feeding_fsm_drain_pending(&brain->feeding);
 }
 
 
-static int
-feeding_fsm_init_handler(enum feeding_state_t state,
-                         struct feeding_fsm_t *feeding_fsm)
+/**
+ * Returns number of feeding times after which entropy balance falls to the
+ * critically low level.
+ *
+ * @param balance entropy balance
+ * @param hunger  entropy required by every feeding time
+ * @param params  parameters
+ *
+ * @return number of feeding times; 0 if the balance is already critical
+ */
+static unsigned long
+feeding_times_left(int balance, int hunger,
+                   const struct brain_params_t *params)
 {
-  int ret;
+  int low = EATER_ENTROPY_BALANCE_CRITICALLY_LOW(params);
 
-  feeding_fsm->entropy_balance = 0;
+  if (balance <= low) {
+    return 0;
+  }
 
-  ret = fsm_postpone_event(&feeding_fsm->fsm,
-                           FEEDING_EVENT_FEEDING_TIME,
-                           EATER_FEEDING_TIME_PERIOD);
-  if (ret != 0) {
-    return ret;
+  return DIV_ROUND_UP(balance - low, hunger);
+}
+
+
+/**
+ * Returns number of feeding times that have come by now.
+ *
+ * @param next_feeding_time when the first of them comes
+ * @param feeding_period    period between them
+ * @param now               current virtual time
+ *
+ * @return number of feeding times
+ */
+static unsigned long
+feeding_times_due(unsigned long next_feeding_time,
+                  unsigned long feeding_period, unsigned long now)
+{
+  if (time_before(now, next_feeding_time)) {
+    return 0;
   }
 
-  return FEEDING_STATE_NORMAL;
+  return (now - next_feeding_time) / feeding_period + 1;
 }
 
 
+/**
+ * Returns entropy balance after several feeding times.
+ *
+ * @param balance entropy balance
+ * @param hunger  entropy required by every feeding time
+ * @param count   number of feeding times
+ * @param params  parameters
+ *
+ * @return new entropy balance
+ */
 static int
-feeding_fsm_feeding_time_handler(enum feeding_state_t state,
-                                 struct feeding_fsm_t *feeding_fsm)
+feeding_balance_after(int balance, int hunger, unsigned long count,
+                      const struct brain_params_t *params)
+{
+  /* eater does not survive the feeding time that brings the balance to the
+   * critical level, so there's no point in counting the ones after it */
+  count = min(count, feeding_times_left(balance, hunger, params));
+
+  return balance - count * hunger;
+}
+
+
+/**
+ * Draws period and hunger of the coming feeding times.
+ *
+ * @param feeding_fsm feeding FSM
+ * @param params      parameters
+ */
+static void
+feeding_fsm_draw_appetite(struct feeding_fsm_t *feeding_fsm,
+                          const struct brain_params_t *params)
+{
+  feeding_fsm->feeding_period =
+    EATER_FEEDING_TIME_PERIOD(params, &feeding_fsm->random);
+  feeding_fsm->hunger         =
+    EATER_HUNGER_ENTROPY_REQUIRED(params, &feeding_fsm->random);
+}
+
+
+/**
+ * Folds entropy pending in per-CPU accumulators into the balance.
+ *
+ * @param feeding_fsm feeding FSM
+ */
+static void
+feeding_fsm_fold(struct feeding_fsm_t *feeding_fsm)
 {
-  int ret;
   int old_balance = feeding_fsm->entropy_balance;
+  int entropy     = feeding_fsm_drain_pending(feeding_fsm);
 
-  brain_msg("it's a good time to get some food");
+  if (entropy == 0) {
+    return;
+  }
 
-  feeding_fsm->entropy_balance -= EATER_HUNGER_ENTROPY_REQUIRED;
+  feeding_fsm->entropy_balance += entropy;
+
+  brain_msg("thank you for all the food");
 
   TRACE_INFO("Entropy balance changed from %d to %d",
              old_balance, feeding_fsm->entropy_balance);
+}
 
-  /* rescheduling hungriness feeling */
-  ret = fsm_postpone_event(&feeding_fsm->fsm,
-                           FEEDING_EVENT_FEEDING_TIME,
-                           EATER_FEEDING_TIME_PERIOD);
-  if (ret != 0) {
-    return ret;
+
+static void
+feeding_fsm_update_fold_threshold(struct feeding_fsm_t *feeding_fsm,
+                                  const struct brain_params_t *params)
+{
+  int balance = feeding_fsm->entropy_balance;
+  int low     = EATER_ENTROPY_BALANCE_CRITICALLY_LOW(params);
+  int high    = EATER_ENTROPY_BALANCE_CRITICALLY_HIGH(params);
+  int boundary;
+
+  /* entropy only grows between folds, so the threshold is chosen so that
+   * even if every CPU accumulates just below it, the balance with all
+   * pending entropy added can't reach the next boundary of
+   * classify_entropy_balance() or the critically high level */
+
+  if (balance < low / 2) {
+    boundary = low / 2;
+  } else if (balance <= high / 2) {
+    boundary = high / 2 + 1;
+  } else {
+    boundary = high;
   }
 
-  if (feeding_fsm->entropy_balance <= EATER_ENTROPY_BALANCE_CRITICALLY_LOW) {
-    TRACE_INFO("Entropy balance has fallen to the critically low level: %d",
-               feeding_fsm->entropy_balance);
-    living_fsm_die();
+  /* critical levels may have been changed at runtime */
+  if (boundary <= balance) {
+    boundary = balance;
   }
 
-  return classify_entropy_balance(feeding_fsm->entropy_balance);
+  ACCESS_ONCE(feeding_fsm->fold_threshold) =
+    (boundary - balance) / num_possible_cpus();
 }
 
 
-static int
-feeding_fsm_feed_handler(enum feeding_state_t state,
-                         struct feeding_fsm_t *feeding_fsm,
-                         struct feeding_event_feed_data_t *feed_data)
+/**
+ * Folds pending entropy and applies all the feeding times elapsed since the
+ * last call. Period and hunger are drawn once per call instead of once per
+ * feeding time. Must be called by every handler before looking at entropy
+ * balance.
+ *
+ * @param feeding_fsm feeding FSM
+ * @param params      parameters
+ */
+static void
+feeding_fsm_catch_up(struct feeding_fsm_t *feeding_fsm,
+                     const struct brain_params_t *params)
 {
-  int old_balance;
-  unsigned int entropy =
-    entropy_estimate(feed_data->food, feed_data->count) * feed_data->count;
+  int           old_balance;
+  unsigned long now = fsm_clock_now();
+  unsigned long count;
+
+  /* entropy eaten so far is accounted before hunger so that pending food
+   * can't be mistaken for starvation */
+  feeding_fsm_fold(feeding_fsm);
+
+  count = feeding_times_due(feeding_fsm->next_feeding_time,
+                            feeding_fsm->feeding_period, now);
+  if (count == 0) {
+    return;
+  }
 
-  old_balance                   = feeding_fsm->entropy_balance;
-  feeding_fsm->entropy_balance += entropy;
+  old_balance = feeding_fsm->entropy_balance;
 
-  brain_msg("thank you for all the food");
+  feeding_fsm->next_feeding_time += count * feeding_fsm->feeding_period;
+  feeding_fsm->entropy_balance    =
+    feeding_balance_after(feeding_fsm->entropy_balance,
+                          feeding_fsm->hunger, count, params);
+
+  brain_msg("it's a good time to get some food");
 
   TRACE_INFO("Entropy balance changed from %d to %d",
              old_balance, feeding_fsm->entropy_balance);
 
-  if (feeding_fsm->entropy_balance >= EATER_ENTROPY_BALANCE_CRITICALLY_HIGH) {
+  feeding_fsm_draw_appetite(feeding_fsm, params);
+}
+
+
+static unsigned long
+feeding_fsm_starvation_timeout(enum feeding_state_t state,
+                               const struct feeding_fsm_t *feeding_fsm)
+{
+  unsigned long now   = fsm_clock_now();
+  unsigned long death = feeding_fsm->next_feeding_time;
+  unsigned long left;
+
+  left = feeding_times_left(feeding_fsm->entropy_balance, feeding_fsm->hunger,
+                            brain_params_read_lock());
+  brain_params_read_unlock();
+
+  if (left != 0) {
+    death += (left - 1) * feeding_fsm->feeding_period;
+  }
+
+  return time_after(death, now) ? death - now : 0;
+}
+
+
+static int
+feeding_fsm_init_handler(enum feeding_state_t state,
+                         struct feeding_fsm_t *feeding_fsm)
+{
+  const struct brain_params_t *params = brain_params_read_lock();
+
+  feeding_fsm->entropy_balance = 0;
+  feeding_fsm_update_fold_threshold(feeding_fsm, params);
+
+  feeding_fsm_draw_appetite(feeding_fsm, params);
+  brain_params_read_unlock();
+
+  feeding_fsm->next_feeding_time =
+    fsm_clock_now() + feeding_fsm->feeding_period;
+
+  fsm_restart_state_timeout(&feeding_fsm->fsm);
+
+  return FEEDING_STATE_NORMAL;
+}
+
+
+/**
+ * Applies everything that has happened since the last event and classifies
+ * the resulting balance. Common part of the handlers. Death at a critical
+ * level is requested on every call, so that a request that could not be
+ * posted is repeated by the next event.
+ *
+ * @param feeding_fsm feeding FSM
+ *
+ * @return new state or error code
+ */
+static int
+feeding_fsm_revise_balance(struct feeding_fsm_t *feeding_fsm)
+{
+  int ret = 0;
+  int balance;
+
+  struct brain_t              *brain  = brain_of(feeding_fsm, feeding);
+  const struct brain_params_t *params = brain_params_read_lock();
+
+  feeding_fsm_catch_up(feeding_fsm, params);
+  feeding_fsm_update_fold_threshold(feeding_fsm, params);
+
+  balance = feeding_fsm->entropy_balance;
+
+  if (balance >= EATER_ENTROPY_BALANCE_CRITICALLY_HIGH(params)) {
     TRACE_INFO("Entropy balance has risen to critically high level: %d",
-               feeding_fsm->entropy_balance);
-    living_fsm_die();
+               balance);
+    ret = living_fsm_die(brain, &feeding_fsm->fsm);
+  } else if (balance <= EATER_ENTROPY_BALANCE_CRITICALLY_LOW(params)) {
+    TRACE_INFO("Entropy balance has fallen to the critically low level: %d",
+               balance);
+    ret = living_fsm_die(brain, &feeding_fsm->fsm);
+  }
+
+  if (ret == 0) {
+    ret = classify_entropy_balance(params, balance);
   }
 
-  sanitation_fsm_just_eaten();
+  brain_params_read_unlock();
 
-  return classify_entropy_balance(feeding_fsm->entropy_balance);
+  return ret;
+}
+
+
+static int
+feeding_fsm_feeding_time_handler(enum feeding_state_t state,
+                                 struct feeding_fsm_t *feeding_fsm)
+{
+  /* period might have changed */
+  fsm_restart_state_timeout(&feeding_fsm->fsm);
+
+  return feeding_fsm_revise_balance(feeding_fsm);
+}
+
+
+static int
+feeding_fsm_feed_handler(enum feeding_state_t state,
+                         struct feeding_fsm_t *feeding_fsm)
+{
+  /* starvation has been put off */
+  fsm_restart_state_timeout(&feeding_fsm->fsm);
+
+  return feeding_fsm_revise_balance(feeding_fsm);
 }
 
 
 static enum feeding_state_t
-classify_entropy_balance(int entropy_balance)
+classify_entropy_balance(const struct brain_params_t *params,
+                         int entropy_balance)
 {
-  if (entropy_balance > EATER_ENTROPY_BALANCE_CRITICALLY_HIGH / 2) {
+  int low  = EATER_ENTROPY_BALANCE_CRITICALLY_LOW(params);
+  int high = EATER_ENTROPY_BALANCE_CRITICALLY_HIGH(params);
+
+  if (entropy_balance > high / 2) {
     return FEEDING_STATE_OVEREATEN;
-  } else if (entropy_balance < EATER_ENTROPY_BALANCE_CRITICALLY_LOW / 2) {
+  } else if (entropy_balance < low / 2) {
     return FEEDING_STATE_HUNGRY;
   } else {
     return FEEDING_STATE_NORMAL;
@@ -291,31 +774,165 @@ classify_entropy_balance(int entropy_balance)
 }
 
 
+/**
+ * Adds eaten entropy to the local accumulator and folds all the
+ * accumulators if the local one has reached the threshold. If the slot is
+ * taken by another eater or the entropy does not fit into it, the entropy
+ * is folded right away.
+ *
+ * @param feeding_fsm feeding FSM
+ * @param entropy     entropy eaten
+ */
+static void
+feeding_fsm_eat(struct feeding_fsm_t *feeding_fsm, unsigned int entropy)
+{
+  int         ret;
+  u64         old;
+  u64         new;
+  u64         prev;
+  bool        fold;
+  atomic64_t *slot;
+
+  slot = feeding_fsm_slot(feeding_fsm, get_cpu_ptr(feeding_slots));
+  old  = atomic64_read(slot);
+
+  for (;;) {
+    if (old == 0) {
+      new = ((u64) feeding_fsm->tag << 32) | entropy;
+    } else if (feeding_slot_tag(old) == feeding_fsm->tag &&
+               entropy <= UINT_MAX - feeding_slot_entropy(old)) {
+      new = old + entropy;
+    } else {
+      /* entropy carrying into the tag would hand the slot to another
+       * eater, so it's folded as if the slot were taken */
+      new = 0;
+      break;
+    }
+
+    prev = atomic64_cmpxchg(slot, old, new);
+    if (prev == old) {
+      break;
+    }
+
+    old = prev;
+  }
+
+  put_cpu_ptr(feeding_slots);
+
+  if (new != 0) {
+    fold = feeding_slot_entropy(new) >=
+           (u32) ACCESS_ONCE(feeding_fsm->fold_threshold);
+  } else {
+    atomic_add(entropy, &feeding_fsm->overflow);
+    fold = true;
+  }
+
+  if (fold) {
+    ret = fsm_emit_simple(&feeding_fsm->fsm, FEEDING_EVENT_FEED);
+    if (ret < 0) {
+      TRACE_ERR("Failed to fold eaten entropy: %d", ret);
+    }
+  }
+}
+
+
 void
-feeding_fsm_feed(u8 *food, size_t count)
+feeding_fsm_feed(struct brain_t *brain, u8 *food, size_t count)
 {
-  int ret;
-  struct feeding_event_feed_data_t data = {
-    .food  = food,
-    .count = count,
-  };
+  feeding_fsm_eat(&brain->feeding, entropy_estimate(food, count) * count);
+  sanitation_fsm_just_eaten(brain);
+}
+
+
+void
+feeding_fsm_feed_batch(struct brain_t *brain,
+                       struct feeding_fsm_food_t food[], size_t count)
+{
+  size_t       i;
+  unsigned int entropy = 0;
+  unsigned int portion;
+
+  for (i = 0; i < count; ++i) {
+    portion = entropy_estimate(food[i].food, food[i].count) * food[i].count;
+
+    if (portion > UINT_MAX - entropy) {
+      feeding_fsm_eat(&brain->feeding, entropy);
+      entropy = 0;
+    }
+
+    entropy += portion;
+  }
+
+  sanitation_fsm_just_eaten_batch(brain, count);
+  feeding_fsm_eat(&brain->feeding, entropy);
+}
 
-  ret = fsm_emit(&feeding_fsm.fsm, FEEDING_EVENT_FEED, &data);
 
-  ASSERT( ret == 0 );
+/**
+ * Computes entropy balance the eater would have if pending entropy and the
+ * feeding times elapsed so far were applied. Works on a consistent copy of
+ * FSM data and changes nothing, so readers can call it at any rate; the
+ * actual catch up is left to events and the starvation timeout.
+ *
+ * @param feeding_fsm feeding FSM
+ * @param params      parameters
+ *
+ * @return entropy balance
+ */
+static int
+feeding_fsm_peek_balance(const struct feeding_fsm_t *feeding_fsm,
+                         const struct brain_params_t *params)
+{
+  int           balance;
+  int           hunger;
+  unsigned long next_feeding_time;
+  unsigned long feeding_period;
+  unsigned      seq;
+
+  do {
+    seq               = fsm_read_begin(&feeding_fsm->fsm);
+    balance           = feeding_fsm->entropy_balance +
+                        feeding_fsm_pending(feeding_fsm);
+    next_feeding_time = feeding_fsm->next_feeding_time;
+    feeding_period    = feeding_fsm->feeding_period;
+    hunger            = feeding_fsm->hunger;
+  } while (fsm_read_retry(&feeding_fsm->fsm, seq));
+
+  return feeding_balance_after(balance, hunger,
+                               feeding_times_due(next_feeding_time,
+                                                 feeding_period,
+                                                 fsm_clock_now()),
+                               params);
+}
+
+
+static ssize_t
+feeding_fsm_state_attr_show(const char *name,
+                            struct feeding_fsm_t *feeding_fsm,
+                            char *buffer)
+{
+  enum feeding_state_t state;
+
+  const struct brain_params_t *params = brain_params_read_lock();
+
+  state = classify_entropy_balance(params,
+                                   feeding_fsm_peek_balance(feeding_fsm,
+                                                            params));
+  brain_params_read_unlock();
+
+  return snprintf(buffer, PAGE_SIZE, "%s\n", feeding_state_to_str(state));
 }
 
 
 static ssize_t
 feeding_fsm_entropy_balance_attr_show(const char *name,
-                                      const struct feeding_fsm_t *feeding_fsm,
+                                      struct feeding_fsm_t *feeding_fsm,
                                       char *buffer)
 {
   int balance;
 
-  fsm_read_lock(&feeding_fsm->fsm);
-  balance = feeding_fsm->entropy_balance;
-  fsm_read_unlock(&feeding_fsm->fsm);
+  balance = feeding_fsm_peek_balance(feeding_fsm, brain_params_read_lock());
+  brain_params_read_unlock();
 
   return snprintf(buffer, PAGE_SIZE, "%d\n", balance);
 }
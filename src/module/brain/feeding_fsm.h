@@ -12,33 +12,130 @@
 #define _BRAIN__FEEDING_FSM_H_
 
 
+#include <linux/types.h>
+#include <asm/atomic.h>
+
+#include "utils/random.h"
+
+#include "status/status.h"
+
+#include "fsm/fsm.h"
+
+
+struct brain_t;
+
+
+/// Feeding FSM type. Feeding times are not ticked by timers: the ones that
+/// have elapsed are applied in bulk by feeding_fsm_catch_up() whenever FSM
+/// gets an event. The only timer is armed for the feeding time the eater
+/// would starve at.
+struct feeding_fsm_t {
+  int entropy_balance;           /**< Consumed entropy balance. Should be
+                                  * close to zero. Does not include entropy
+                                  * pending in accumulators. */
+  int fold_threshold;            /**< Pending entropy a CPU may accumulate
+                                  * before folding it; read without the
+                                  * lock. */
+
+  u32      tag;                  /**< Identifies FSM in per-CPU entropy
+                                  * accumulators shared by all the feeding
+                                  * FSMs. Feeders add to them without taking
+                                  * FSM lock; they are drained under the
+                                  * lock by feeding_fsm_fold(). */
+  atomic_t overflow;             /**< Entropy eaten while accumulator slot
+                                  * was taken by another eater. */
+
+  unsigned long next_feeding_time; /**< When the next feeding time comes
+                                    * (virtual jiffies). */
+  unsigned long feeding_period;    /**< Period between feeding times. */
+  int           hunger;            /**< Entropy required by every feeding
+                                    * time. */
+
+  struct random_stream_t random;   /**< Random stream. */
+
+  struct fsm_t fsm;
+};
+
+
+/// Templates of feeding FSM status attributes (see brain_status_create()).
+extern const struct status_attr_t feeding_fsm_status_attrs[];
+
+
+/// Number of items in #feeding_fsm_status_attrs.
+extern const size_t feeding_fsm_status_attr_count;
+
+
+/**
+ * Initializes facilities shared by all the feeding FSMs. Must be called before
+ * any brain is built.
+ *
+ * @return execution status
+ */
+int
+feeding_fsm_class_init(void);
+
+
+/**
+ * Cleanups facilities shared by all the feeding FSMs. All the brains must be
+ * destroyed by now.
+ */
+void
+feeding_fsm_class_cleanup(void);
+
+
 /**
  * Initializes feeding FSM.
  *
+ * @param brain brain the FSM is part of
  *
  * @retval  0 FSM initialized successfully
  * @retval <0 error occurred
  */
 int
-feeding_fsm_init(void);
+feeding_fsm_init(struct brain_t *brain);
 
 
 /**
  * Cleanups resources held by feeding FSM.
  *
+ * @param brain brain the FSM is part of
  */
 void
-feeding_fsm_cleanup(void);
+feeding_fsm_cleanup(struct brain_t *brain);
+
+
+/// Single portion of food.
+struct feeding_fsm_food_t {
+  size_t count;                 /**< Length of the food data. */
+  u8    *food;                  /**< Food. */
+};
 
 
 /**
- * Feed entropy eater.
+ * Feed entropy eater. Eaten entropy is accumulated on the local CPU without
+ * taking FSM lock and is folded into FSM only when it could change FSM
+ * state.
  *
+ * @param brain eater's brain
  * @param food  food
  * @param count length of the food data
  */
 void
-feeding_fsm_feed(u8 *food, size_t count);
+feeding_fsm_feed(struct brain_t *brain, u8 *food, size_t count);
+
+
+/**
+ * Feed entropy eater with several portions of food at once. Entropy of all
+ * the portions is accumulated at once (see feeding_fsm_feed()) and the
+ * meals are reported to sanitation FSM as a single batch.
+ *
+ * @param brain eater's brain
+ * @param food  portions of food
+ * @param count number of portions
+ */
+void
+feeding_fsm_feed_batch(struct brain_t *brain,
+                       struct feeding_fsm_food_t food[], size_t count);
 
 
 #endif /* _BRAIN__FEEDING_FSM_H_ */
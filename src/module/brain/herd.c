@@ -0,0 +1,339 @@
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/hash.h>
+#include <linux/spinlock.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <asm/atomic.h>
+
+#include "utils/trace.h"
+#include "utils/assert.h"
+
+#include "eater_interface.h"
+
+#include "brain/brain.h"
+#include "brain/herd.h"
+
+
+/// Hash table of all the eaters.
+static struct hlist_head herd_table[HERD_HASH_SIZE];
+
+
+/// Number of eaters in #herd_table.
+static unsigned int herd_size;
+
+
+/// Serializes writers of #herd_table and #herd_dead.
+static DEFINE_SPINLOCK(herd_lock);
+
+
+/// Brains of dead eaters waiting for herd_reap_fn(), linked by
+/// brain_t::reap_next. Each holds a reference taken by herd_reap().
+static struct brain_t *herd_dead;
+
+
+/**
+ * Removes dead eaters from the herd.
+ *
+ * @param work #herd_reap_work
+ */
+static void
+herd_reap_fn(struct work_struct *work);
+
+
+static DECLARE_WORK(herd_reap_work, herd_reap_fn);
+
+
+/**
+ * Returns hash table bucket of the eater.
+ *
+ * @param id eater identifier
+ *
+ * @return bucket
+ */
+static struct hlist_head *
+herd_bucket(u32 id)
+{
+  return &herd_table[hash_32(id, HERD_HASH_BITS)];
+}
+
+
+/**
+ * Looks up an eater. Must be called under RCU read lock or with #herd_lock
+ * held.
+ *
+ * @param id eater identifier
+ *
+ * @return brain or NULL if there is no such eater
+ */
+static struct brain_t *
+herd_lookup(u32 id)
+{
+  struct brain_t    *brain;
+  struct hlist_node *node;
+
+  hlist_for_each_entry_rcu(brain, node, herd_bucket(id), hash) {
+    if (brain->id == id) {
+      return brain;
+    }
+  }
+
+  return NULL;
+}
+
+
+int
+herd_init(void)
+{
+  int ret;
+
+  ret = herd_create(EATER_ID_DEFAULT);
+  if (ret != 0) {
+    TRACE_ERR("Failed to create the default eater: %d", ret);
+  }
+
+  return ret;
+}
+
+
+void
+herd_cleanup(void)
+{
+  int                i;
+  struct brain_t    *brain;
+  struct hlist_node *node;
+  struct hlist_node *next;
+
+  /* eaters that die nobly are not reaped, so nobody can get into the queue
+   * once it's flushed */
+  for (i = 0; i < HERD_HASH_SIZE; ++i) {
+    hlist_for_each_entry(brain, node, &herd_table[i], hash) {
+      if (brain->built) {
+        living_fsm_die_nobly(brain);
+      }
+    }
+  }
+
+  flush_work(&herd_reap_work);
+
+  for (i = 0; i < HERD_HASH_SIZE; ++i) {
+    hlist_for_each_entry_safe(brain, node, next, &herd_table[i], hash) {
+      hlist_del_rcu(&brain->hash);
+      herd_put(brain);
+    }
+  }
+
+  herd_size = 0;
+
+  /* waiting for brains to be freed */
+  rcu_barrier();
+}
+
+
+int
+herd_create(u32 id)
+{
+  int             ret = 0;
+  struct brain_t *brain;
+
+  /* allocation may sleep, so the brain is discarded if it has turned out
+   * to be a duplicate; it's not built yet, so that's cheap */
+  brain = brain_create(id);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  spin_lock(&herd_lock);
+
+  if (herd_lookup(id) != NULL) {
+    ret = -EEXIST;
+  } else if (herd_size >= HERD_SIZE_MAX) {
+    ret = -ENOSPC;
+  } else {
+    hlist_add_head_rcu(&brain->hash, herd_bucket(id));
+    ++herd_size;
+  }
+
+  spin_unlock(&herd_lock);
+
+  if (ret != 0) {
+    brain_destroy(brain);
+  }
+
+  return ret;
+}
+
+
+int
+herd_destroy(u32 id)
+{
+  struct brain_t *brain;
+
+  if (id == EATER_ID_DEFAULT) {
+    return -EPERM;
+  }
+
+  spin_lock(&herd_lock);
+
+  brain = herd_lookup(id);
+  if (brain != NULL) {
+    hlist_del_rcu(&brain->hash);
+    --herd_size;
+  }
+
+  spin_unlock(&herd_lock);
+
+  if (brain == NULL) {
+    return -ENOENT;
+  }
+
+  /* dropping the reference held by the table */
+  herd_put(brain);
+
+  return 0;
+}
+
+
+struct brain_t *
+herd_get(u32 id)
+{
+  int             ret;
+  struct brain_t *brain;
+
+  rcu_read_lock();
+
+  brain = herd_lookup(id);
+  if (brain != NULL && !atomic_inc_not_zero(&brain->refs)) {
+    brain = NULL;
+  }
+
+  rcu_read_unlock();
+
+  if (brain == NULL) {
+    return ERR_PTR(-ENOENT);
+  }
+
+  ret = brain_build(brain);
+  if (ret < 0) {
+    herd_put(brain);
+    return ERR_PTR(ret);
+  }
+
+  /* the default eater exports its status once it's built unless some other
+   * eater has been exported explicitly */
+  if (ret > 0 && id == EATER_ID_DEFAULT) {
+    ret = brain_status_create(brain, false);
+    if (ret != 0) {
+      TRACE_ERR("Failed to export status of the default eater: %d", ret);
+    }
+  }
+
+  return brain;
+}
+
+
+int
+herd_export(u32 id)
+{
+  int             ret;
+  struct brain_t *brain;
+
+  brain = herd_get(id);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  ret = brain_status_create(brain, true);
+  herd_put(brain);
+
+  return ret;
+}
+
+
+void
+herd_put(struct brain_t *brain)
+{
+  if (atomic_dec_and_test(&brain->refs)) {
+    brain_destroy(brain);
+  }
+}
+
+
+void
+herd_reap(struct brain_t *brain)
+{
+  /* the brain is being destroyed already */
+  if (!atomic_inc_not_zero(&brain->refs)) {
+    return;
+  }
+
+  spin_lock(&herd_lock);
+  brain->reap_next = herd_dead;
+  herd_dead        = brain;
+  spin_unlock(&herd_lock);
+
+  schedule_work(&herd_reap_work);
+}
+
+
+static void
+herd_reap_fn(struct work_struct *work)
+{
+  struct brain_t *brain;
+  struct brain_t *next;
+  struct brain_t *newborn;
+  bool            unlinked;
+
+  spin_lock(&herd_lock);
+  brain     = herd_dead;
+  herd_dead = NULL;
+  spin_unlock(&herd_lock);
+
+  for (; brain != NULL; brain = next) {
+    next     = brain->reap_next;
+    newborn  = NULL;
+    unlinked = false;
+
+    /* the default eater is always there, so a new one is born instead */
+    if (brain->id == EATER_ID_DEFAULT) {
+      newborn = brain_create(brain->id);
+      if (IS_ERR(newborn)) {
+        TRACE_ERR("Failed to revive the default eater: %ld",
+                  PTR_ERR(newborn));
+        newborn = NULL;
+      }
+    }
+
+    spin_lock(&herd_lock);
+
+    /* the eater may have been destroyed by a command meanwhile */
+    if (herd_lookup(brain->id) == brain) {
+      if (newborn != NULL) {
+        hlist_replace_rcu(&brain->hash, &newborn->hash);
+        newborn = NULL;
+        unlinked = true;
+      } else if (brain->id != EATER_ID_DEFAULT) {
+        hlist_del_rcu(&brain->hash);
+        --herd_size;
+        unlinked = true;
+      }
+    }
+
+    spin_unlock(&herd_lock);
+
+    TRACE_WARNING("Eater %u died", brain->id);
+
+    if (newborn != NULL) {
+      brain_destroy(newborn);
+    }
+
+    if (unlinked) {
+      /* dropping the reference held by the table */
+      herd_put(brain);
+    }
+
+    /* dropping the reference taken by herd_reap() */
+    herd_put(brain);
+  }
+}
@@ -0,0 +1,134 @@
+/**
+ * @file   herd.h
+ *
+ * @brief Herd of entropy eaters addressed by identifiers. Brains are kept in
+ * a hash table; lookups are lockless under RCU and take a reference to the
+ * brain, so an eater destroyed while a command is being processed is freed
+ * only after the command is done with it. The default eater is created when
+ * the herd is initialized and can't be destroyed.
+ *
+ * Eaters are created cold: FSMs of a brain are built by the first lookup,
+ * i.e. when the first command is addressed to the eater. Status files are
+ * created for the default eater once it's built, unless status of another
+ * eater has been exported explicitly by herd_export().
+ *
+ * Eaters that die are removed from the herd by herd_reap(); the default
+ * eater is born again instead.
+ *
+ *
+ */
+
+#ifndef _BRAIN__HERD_H_
+#define _BRAIN__HERD_H_
+
+
+#include <linux/types.h>
+
+#include "brain/brain.h"
+
+
+/// Number of bits in hash of eater identifier.
+#define HERD_HASH_BITS 16
+
+
+/// Number of buckets in the herd hash table.
+#define HERD_HASH_SIZE (1 << HERD_HASH_BITS)
+
+
+/// Maximum number of eaters in the herd including the default one.
+#define HERD_SIZE_MAX (1 << 19)
+
+
+/**
+ * Initializes the herd and creates the default eater.
+ *
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+int
+herd_init(void);
+
+
+/**
+ * Destroys all the eaters. Must not race with any other herd functions.
+ *
+ */
+void
+herd_cleanup(void);
+
+
+/**
+ * Creates an eater.
+ *
+ * @param id eater identifier
+ *
+ * @retval  0 success
+ * @retval <0 error code; -EEXIST if eater with the same identifier exists,
+ *            -ENOSPC if there are #HERD_SIZE_MAX eaters already
+ */
+int
+herd_create(u32 id);
+
+
+/**
+ * Destroys an eater. The eater is freed once all the references to it are
+ * dropped.
+ *
+ * @param id eater identifier
+ *
+ * @retval  0 success
+ * @retval <0 error code; -ENOENT if there is no such eater, -EPERM for the
+ *            default eater
+ */
+int
+herd_destroy(u32 id);
+
+
+/**
+ * Looks up an eater and takes a reference to its brain. Builds the brain if
+ * it's not built yet (see brain_build()). May sleep.
+ *
+ * @param id eater identifier
+ *
+ * @return brain to be released by herd_put() or ERR_PTR() of error code;
+ *         -ENOENT if there is no such eater
+ */
+struct brain_t *
+herd_get(u32 id);
+
+
+/**
+ * Exports status of an eater via sysfs instead of the one exported so far
+ * (see brain_status_create()).
+ *
+ * @param id eater identifier
+ *
+ * @retval  0 success
+ * @retval <0 error code; -ENOENT if there is no such eater
+ */
+int
+herd_export(u32 id);
+
+
+/**
+ * Removes a dead eater from the herd. The eater is unlinked from a work
+ * item, so it can be called from event handlers; commands still holding
+ * the brain keep it alive till they are done.
+ *
+ * @param brain brain of the dead eater
+ */
+void
+herd_reap(struct brain_t *brain);
+
+
+/**
+ * Drops a reference taken by herd_get(). May sleep.
+ *
+ * @param brain brain
+ */
+void
+herd_put(struct brain_t *brain);
+
+
+#endif /* _BRAIN__HERD_H_ */
@@ -2,19 +2,27 @@
 #include "utils/random.h"
 
 #include "fsm/fsm.h"
+#include "fsm/stats.h"
 
+#include "brain/brain.h"
+#include "brain/herd.h"
 #include "brain/params.h"
 #include "brain/living_fsm.h"
 #include "brain/utils.h"
 
 
+/// X-macro list of living FSM events.
+#define LIVING_EVENTS(X)                        \
+  X(LIVING_EVENT_DIE)                           \
+  X(LIVING_EVENT_DIE_NOBLY)                     \
+  X(LIVING_EVENT_FALL_ILL)                      \
+  X(LIVING_EVENT_REVISE_ILLNESS)                \
+  X(LIVING_EVENT_CURE_ILLNESS)
+
+
 /// Living FSM events
 enum living_event_t {
-  LIVING_EVENT_DIE,
-  LIVING_EVENT_DIE_NOBLY,
-  LIVING_EVENT_FALL_ILL,
-  LIVING_EVENT_REVISE_ILLNESS,
-  LIVING_EVENT_CURE_ILLNESS,
+  LIVING_EVENTS(FSM_ENUM_ITEM)
   __LIVING_EVENT_LAST
 };
 
@@ -22,34 +30,21 @@ enum living_event_t {
 #define LIVING_EVENTS_COUNT __LIVING_EVENT_LAST
 
 
-/// Ensures that event is valid one.
-#define ASSERT_VALID_EVENT(event) \
-  ASSERT_IN_RANGE(event, 0, LIVING_EVENTS_COUNT - 1)
-
-
-static inline const char *
-living_event_to_str(enum living_event_t event)
-{
-  static const char *strs[] = {
-    "LIVING_EVENT_DIE",
-    "LIVING_EVENT_DIE_NOBLY",
-    "LIVING_EVENT_FALL_ILL",
-    "LIVING_EVENT_REVISE_ILLNESS",
-    "LIVING_EVENT_CURE_ILLNESS",
-  };
+FSM_DEFINE_TO_STR(living_event_to_str, enum living_event_t,
+                  LIVING_EVENTS, LIVING_EVENTS_COUNT)
 
-  ASSERT_VALID_EVENT(event);
 
-  return strs[event];
-}
+/// X-macro list of living FSM states.
+#define LIVING_STATES(X)                        \
+  X(LIVING_STATE_ALIVE)                         \
+  X(LIVING_STATE_ILL)                           \
+  X(LIVING_STATE_VERY_ILL)                      \
+  X(LIVING_STATE_DEAD)
 
 
 /// Living FSM states.
 enum living_state_t {
-  LIVING_STATE_ALIVE,
-  LIVING_STATE_ILL,
-  LIVING_STATE_VERY_ILL,
-  LIVING_STATE_DEAD,
+  LIVING_STATES(FSM_ENUM_ITEM)
   __LIVING_STATE_LAST
 };
 
@@ -57,35 +52,18 @@ enum living_state_t {
 #define LIVING_STATES_COUNT __LIVING_STATE_LAST
 
 
-/// Ensures that state is valid.
-#define ASSERT_VALID_STATE(state) \
-  ASSERT_IN_RANGE(state, 0, LIVING_STATES_COUNT - 1)
+FSM_DEFINE_TO_STR(living_state_to_str, enum living_state_t,
+                  LIVING_STATES, LIVING_STATES_COUNT)
 
 
-static inline const char *
-living_state_to_str(enum living_state_t state)
-{
-  static const char *strs[] = {
-    "LIVING_STATE_ALIVE",
-    "LIVING_STATE_ILL",
-    "LIVING_STATE_VERY_ILL",
-    "LIVING_STATE_DEAD",
-  };
-
-  ASSERT_VALID_STATE(state);
-
-  return strs[state];
-}
-
-
-/// Living FSM type.
-struct living_fsm_t {
-  struct fsm_t fsm;
+const struct status_attr_t living_fsm_status_attrs[] = {
+  FSM_STATE_ATTR(living_fsm_state, BRAIN_STATUS_DATA(living.fsm)),
+  FSM_STATS_ATTR(living_fsm_stats, BRAIN_STATUS_DATA(living.fsm)),
 };
 
 
-/// Living FSM.
-static struct living_fsm_t living_fsm;
+const size_t living_fsm_status_attr_count =
+  ARRAY_SIZE(living_fsm_status_attrs);
 
 
 /// Handles #LIVING_EVENT_DIE_NOBLY event.
@@ -95,88 +73,271 @@ living_fsm_die_nobly_handler(enum living_state_t state,
 
 
 /// Handles #LIVING_EVENT_DIE event.
-static int __noreturn
+static int
 living_fsm_die_handler(enum living_state_t state,
                        struct living_fsm_t *living_fsm);
 
 
-/// Handles #LIVING_EVENT_FALL_ILL event.
+/// Handles #LIVING_EVENT_FALL_ILL event in #LIVING_STATE_ALIVE state.
 static int
 living_fsm_fall_ill_handler(enum living_state_t state,
                             struct living_fsm_t *living_fsm);
 
 
-/// Handles #LIVING_EVENT_REVISE_ILLNESS event.
+/// Handles #LIVING_EVENT_FALL_ILL event in #LIVING_STATE_ILL state.
+static int
+living_fsm_fall_very_ill_handler(enum living_state_t state,
+                                 struct living_fsm_t *living_fsm);
+
+
+/// Handles #LIVING_EVENT_FALL_ILL event in #LIVING_STATE_VERY_ILL state.
+static int
+living_fsm_fall_ill_fatally_handler(enum living_state_t state,
+                                    struct living_fsm_t *living_fsm);
+
+
+/// Handles #LIVING_EVENT_REVISE_ILLNESS event in #LIVING_STATE_ILL state.
 static int
 living_fsm_revise_illness_handler(enum living_state_t state,
                                   struct living_fsm_t *living_fsm);
 
 
-/// Handles #LIVING_EVENT_CURE_ILLNESS event.
+/// Handles #LIVING_EVENT_CURE_ILLNESS event in #LIVING_STATE_ALIVE state.
 static int
-living_fsm_cure_illness_handler(enum living_state_t state,
-                                struct living_fsm_t *living_fsm);
-
-
-struct fsm_event_handler_t living_fsm_handlers[LIVING_EVENTS_COUNT] = {
-  EVENT_NO_DATA (
-    LIVING_EVENT_DIE_NOBLY,
-    (fsm_event_handler_no_data_t) living_fsm_die_nobly_handler
-  ),
-  EVENT_NO_DATA (
-    LIVING_EVENT_DIE,
-    (fsm_event_handler_no_data_t) living_fsm_die_handler
-  ),
-  EVENT_NO_DATA (
-    LIVING_EVENT_FALL_ILL,
-    (fsm_event_handler_no_data_t) living_fsm_fall_ill_handler
-  ),
-  EVENT_NO_DATA (
-    LIVING_EVENT_REVISE_ILLNESS,
-    (fsm_event_handler_no_data_t) living_fsm_revise_illness_handler
-  ),
-  EVENT_NO_DATA (
-    LIVING_EVENT_CURE_ILLNESS,
-    (fsm_event_handler_no_data_t) living_fsm_cure_illness_handler
-  ),
+living_fsm_cure_not_needed_handler(enum living_state_t state,
+                                   struct living_fsm_t *living_fsm);
+
+
+/// Handles #LIVING_EVENT_CURE_ILLNESS event in #LIVING_STATE_ILL state.
+static int
+living_fsm_cure_ill_handler(enum living_state_t state,
+                            struct living_fsm_t *living_fsm);
+
+
+/// Handles #LIVING_EVENT_CURE_ILLNESS event in #LIVING_STATE_VERY_ILL state.
+static int
+living_fsm_cure_very_ill_handler(enum living_state_t state,
+                                 struct living_fsm_t *living_fsm);
+
+
+/* X-macro list of living FSM transitions.
+ *
+ * Stale illness revisions (the ones that were not canceled in time) are just
+ * ignored. Dead eater ignores everything. */
+#define LIVING_TRANSITIONS(PURE, ACTION)                                \
+  ACTION(LIVING_STATE_ALIVE,    LIVING_EVENT_DIE,                       \
+         living_fsm_die_handler)                                        \
+  ACTION(LIVING_STATE_ALIVE,    LIVING_EVENT_DIE_NOBLY,                 \
+         living_fsm_die_nobly_handler)                                  \
+  ACTION(LIVING_STATE_ALIVE,    LIVING_EVENT_FALL_ILL,                  \
+         living_fsm_fall_ill_handler)                                   \
+  PURE  (LIVING_STATE_ALIVE,    LIVING_EVENT_REVISE_ILLNESS,            \
+         LIVING_STATE_ALIVE)                                            \
+  ACTION(LIVING_STATE_ALIVE,    LIVING_EVENT_CURE_ILLNESS,              \
+         living_fsm_cure_not_needed_handler)                            \
+                                                                        \
+  ACTION(LIVING_STATE_ILL,      LIVING_EVENT_DIE,                       \
+         living_fsm_die_handler)                                        \
+  ACTION(LIVING_STATE_ILL,      LIVING_EVENT_DIE_NOBLY,                 \
+         living_fsm_die_nobly_handler)                                  \
+  ACTION(LIVING_STATE_ILL,      LIVING_EVENT_FALL_ILL,                  \
+         living_fsm_fall_very_ill_handler)                              \
+  ACTION(LIVING_STATE_ILL,      LIVING_EVENT_REVISE_ILLNESS,            \
+         living_fsm_revise_illness_handler)                             \
+  ACTION(LIVING_STATE_ILL,      LIVING_EVENT_CURE_ILLNESS,              \
+         living_fsm_cure_ill_handler)                                   \
+                                                                        \
+  ACTION(LIVING_STATE_VERY_ILL, LIVING_EVENT_DIE,                       \
+         living_fsm_die_handler)                                        \
+  ACTION(LIVING_STATE_VERY_ILL, LIVING_EVENT_DIE_NOBLY,                 \
+         living_fsm_die_nobly_handler)                                  \
+  ACTION(LIVING_STATE_VERY_ILL, LIVING_EVENT_FALL_ILL,                  \
+         living_fsm_fall_ill_fatally_handler)                           \
+  PURE  (LIVING_STATE_VERY_ILL, LIVING_EVENT_REVISE_ILLNESS,            \
+         LIVING_STATE_VERY_ILL)                                         \
+  ACTION(LIVING_STATE_VERY_ILL, LIVING_EVENT_CURE_ILLNESS,              \
+         living_fsm_cure_very_ill_handler)                              \
+                                                                        \
+  PURE  (LIVING_STATE_DEAD,     LIVING_EVENT_DIE,                       \
+         LIVING_STATE_DEAD)                                             \
+  PURE  (LIVING_STATE_DEAD,     LIVING_EVENT_DIE_NOBLY,                 \
+         LIVING_STATE_DEAD)                                             \
+  PURE  (LIVING_STATE_DEAD,     LIVING_EVENT_FALL_ILL,                  \
+         LIVING_STATE_DEAD)                                             \
+  PURE  (LIVING_STATE_DEAD,     LIVING_EVENT_REVISE_ILLNESS,            \
+         LIVING_STATE_DEAD)                                             \
+  PURE  (LIVING_STATE_DEAD,     LIVING_EVENT_CURE_ILLNESS,              \
+         LIVING_STATE_DEAD)
+
+
+/// Returns timeout of #LIVING_STATE_ILL state.
+static unsigned long
+living_fsm_ill_timeout(enum living_state_t state,
+                       struct living_fsm_t *living_fsm)
+{
+  unsigned long delay;
+
+  delay = EATER_ILL_TO_VERY_ILL_PERIOD(brain_params_read_lock(),
+                                       &living_fsm->random);
+  brain_params_read_unlock();
+
+  return delay;
+}
+
+
+/// Returns timeout of #LIVING_STATE_VERY_ILL state.
+static unsigned long
+living_fsm_very_ill_timeout(enum living_state_t state,
+                            struct living_fsm_t *living_fsm)
+{
+  unsigned long delay;
+
+  delay = EATER_VERY_ILL_LIVING_PERIOD(brain_params_read_lock(),
+                                       &living_fsm->random);
+  brain_params_read_unlock();
+
+  return delay;
+}
+
+
+/// Living FSM state timeouts.
+static const struct fsm_state_timeout_t
+living_fsm_timeouts[LIVING_STATES_COUNT] = {
+  [LIVING_STATE_ILL]      = { .event = LIVING_EVENT_REVISE_ILLNESS,
+                              .delay = (fsm_timeout_delay_fn_t)
+                                       living_fsm_ill_timeout },
+  [LIVING_STATE_VERY_ILL] = { .event = LIVING_EVENT_DIE,
+                              .delay = (fsm_timeout_delay_fn_t)
+                                       living_fsm_very_ill_timeout },
+};
+
+
+/// Checks whether #LIVING_EVENT_CURE_ILLNESS can change anything.
+static bool
+living_fsm_cure_check(enum living_state_t state,
+                      const struct living_fsm_t *living_fsm)
+{
+  return state == LIVING_STATE_ILL || state == LIVING_STATE_VERY_ILL;
+}
+
+
+/// Tells the user that cure is not needed.
+static void
+living_fsm_cure_reject(enum living_state_t state,
+                       const struct living_fsm_t *living_fsm)
+{
+  if (state == LIVING_STATE_ALIVE) {
+    brain_msg("thanks for you care but I don't require this help now");
+  }
+}
+
+
+/// Living FSM event guards.
+static const struct fsm_guard_t
+living_fsm_guards[LIVING_EVENTS_COUNT] = {
+  [LIVING_EVENT_CURE_ILLNESS] = {
+    .check  = (bool (*)(int, const void *)) living_fsm_cure_check,
+    .reject = (void (*)(int, const void *)) living_fsm_cure_reject,
+  },
+};
+
+
+/// Living FSM transition table.
+static const struct fsm_transition_t
+living_fsm_transitions[LIVING_STATES_COUNT][LIVING_EVENTS_COUNT] = {
+  LIVING_TRANSITIONS(FSM_PURE, FSM_ACTION)
+};
+
+
+/// Living FSM timer slacks. Death is not deferred.
+static const unsigned long
+living_fsm_slacks[LIVING_EVENTS_COUNT] = {
+  [LIVING_EVENT_REVISE_ILLNESS] = EATER_TIMER_SLACK,
 };
 
 
+/// Returns identifier of the eater the FSM belongs to.
+static u32
+living_fsm_instance(const struct living_fsm_t *living_fsm)
+{
+  return brain_of(living_fsm, living)->id;
+}
+
+
+/// Living FSM statistics.
+FSM_DEFINE_STATS(living_fsm_stats);
+
+
+/// Living FSM class.
+static const struct fsm_class_t living_fsm_class = {
+  .name          = "living_fsm",
+  .state_count   = LIVING_STATES_COUNT,
+  .event_count   = LIVING_EVENTS_COUNT,
+  .show_state    = (fsm_state_show_fn_t) living_state_to_str,
+  .show_event    = (fsm_event_show_fn_t) living_event_to_str,
+  .data_offset   = offsetof(struct living_fsm_t, fsm),
+  .handlers      = NULL,
+  .transitions   = &living_fsm_transitions[0][0],
+  .timeouts      = living_fsm_timeouts,
+  .guards        = living_fsm_guards,
+  .slacks        = living_fsm_slacks,
+  .stats         = &living_fsm_stats,
+  .instance      = (u32 (*)(const void *)) living_fsm_instance,
+  .snapshot_size = 0,
+  .save          = NULL,
+  .validate      = NULL,
+  .load          = NULL,
+};
+
+
+int
+living_fsm_class_init(void)
+{
+  return fsm_class_init(&living_fsm_class);
+}
+
+
+void
+living_fsm_class_cleanup(void)
+{
+  fsm_class_cleanup(&living_fsm_class);
+}
+
+
 int
-living_fsm_init(void)
+living_fsm_init(struct brain_t *brain)
 {
-  return fsm_init(&living_fsm.fsm, "living_fsm",
-                  LIVING_STATES_COUNT, LIVING_EVENTS_COUNT,
-                  (fsm_state_show_fn_t) living_state_to_str,
-                  (fsm_event_show_fn_t) living_event_to_str,
-                  &living_fsm, living_fsm_handlers);
+  struct living_fsm_t *living_fsm = &brain->living;
+
+  FSM_CHECK_TRANSITIONS(LIVING_TRANSITIONS, LIVING_STATES_COUNT);
+
+  brain_random_init(brain, &living_fsm->random, BRAIN_STREAM_LIVING);
+
+  return fsm_init(&living_fsm->fsm, &living_fsm_class);
 }
 
 
 void
-living_fsm_cleanup(void)
+living_fsm_cleanup(struct brain_t *brain)
 {
-  fsm_cleanup(&living_fsm.fsm);
+  fsm_cleanup(&brain->living.fsm);
 }
 
 
 void
-living_fsm_die_nobly(void)
+living_fsm_die_nobly(struct brain_t *brain)
 {
   int ret;
 
-  ret = fsm_emit_simple(&living_fsm.fsm, LIVING_EVENT_DIE_NOBLY);
+  ret = fsm_emit_simple(&brain->living.fsm, LIVING_EVENT_DIE_NOBLY);
   ASSERT( ret == 0 );
 }
 
 
-void __noreturn
-living_fsm_die(void)
+int
+living_fsm_die(struct brain_t *brain, struct fsm_t *from)
 {
-  fsm_emit_simple(&living_fsm.fsm, LIVING_EVENT_DIE);
-
-  /* suppressing gcc warning about noreturn function that does return */
-  panic("not really needed here");
+  return fsm_notify(from, &brain->living.fsm, LIVING_EVENT_DIE);
 }
 
 
@@ -189,12 +350,16 @@ living_fsm_die_nobly_handler(enum living_state_t state,
 }
 
 
-static int __noreturn
+static int
 living_fsm_die_handler(enum living_state_t state,
                        struct living_fsm_t *living_fsm)
 {
   brain_msg("you've been an awful owner; I'm dying in agony.");
-  panic("DEAD");
+
+  /* other eaters live on; this one is taken out of the herd */
+  herd_reap(brain_of(living_fsm, living));
+
+  return LIVING_STATE_DEAD;
 }
 
 
@@ -202,30 +367,30 @@ static int
 living_fsm_fall_ill_handler(enum living_state_t state,
                             struct living_fsm_t *living_fsm)
 {
-  enum living_state_t new_state;
-
-  switch (state) {
-  case LIVING_STATE_ILL:
-    new_state = LIVING_STATE_VERY_ILL;
-    brain_msg("another illness makes me very ill");
-    fsm_cancel_postponed_events_by_type(&living_fsm->fsm,
-                                        LIVING_EVENT_REVISE_ILLNESS);
-    fsm_postpone_event(&living_fsm->fsm,
-                       LIVING_EVENT_DIE, EATER_VERY_ILL_LIVING_PERIOD);
-    break;
-  case LIVING_STATE_VERY_ILL:
-    brain_msg("I'm already very ill; another illness just kills me");
-    living_fsm_die();
-    break;
-  default:
-    new_state = LIVING_STATE_ILL;
-    brain_msg("you're no the best owner possible; I got ill.");
-    fsm_postpone_event(&living_fsm->fsm,
-                       LIVING_EVENT_REVISE_ILLNESS,
-                       EATER_ILL_TO_VERY_ILL_PERIOD);
-  }
+  brain_msg("you're no the best owner possible; I got ill.");
 
-  return new_state;
+  return LIVING_STATE_ILL;
+}
+
+
+static int
+living_fsm_fall_very_ill_handler(enum living_state_t state,
+                                 struct living_fsm_t *living_fsm)
+{
+  brain_msg("another illness makes me very ill");
+
+  return LIVING_STATE_VERY_ILL;
+}
+
+
+static int
+living_fsm_fall_ill_fatally_handler(enum living_state_t state,
+                                    struct living_fsm_t *living_fsm)
+{
+  brain_msg("I'm already very ill; another illness just kills me");
+
+  /* lock is already held, so dying right here */
+  return living_fsm_die_handler(state, living_fsm);
 }
 
 
@@ -235,69 +400,57 @@ living_fsm_revise_illness_handler(enum living_state_t state,
 {
   bool self_cure;
 
-  switch (state) {
-  case LIVING_STATE_ILL:
-    break;
-  default:
-    ASSERT( !"invalid state" );
-  }
-
   /* do we cured without any help */
-  self_cure = get_random_bool();
+  self_cure = random_stream_bool(&living_fsm->random);
   if (self_cure) {
     brain_msg("you're lucky; somehow I got better without your help");
     return LIVING_STATE_ALIVE;
   } else {
     brain_msg("damn you; I'm getting worse");
-    fsm_postpone_event(&living_fsm->fsm,
-                       LIVING_EVENT_DIE, EATER_VERY_ILL_LIVING_PERIOD);
     return LIVING_STATE_VERY_ILL;
   }
 }
 
 
 static int
-living_fsm_cure_illness_handler(enum living_state_t state,
-                                struct living_fsm_t *living_fsm)
+living_fsm_cure_not_needed_handler(enum living_state_t state,
+                                   struct living_fsm_t *living_fsm)
 {
-  enum living_state_t new_state;
-
-  switch (state) {
-  case LIVING_STATE_ILL:
-    brain_msg("thank you for your help; I'm just fine now");
-    new_state = LIVING_STATE_ALIVE;
-    fsm_cancel_postponed_events_by_type(&living_fsm->fsm,
-                                        LIVING_EVENT_REVISE_ILLNESS);
-    break;
-  case LIVING_STATE_VERY_ILL:
-    brain_msg("finally you gave me some remedies; It feels much better now");
-    new_state = LIVING_STATE_ILL;
-    fsm_cancel_postponed_events_by_type(&living_fsm->fsm, LIVING_EVENT_DIE);
-    fsm_postpone_event(&living_fsm->fsm,
-                       LIVING_EVENT_REVISE_ILLNESS,
-                       EATER_ILL_TO_VERY_ILL_PERIOD);
-    break;
-  default:
-    brain_msg("thanks for you care but I don't require this help now");
-    new_state = state;
-  }
+  living_fsm_cure_reject(state, living_fsm);
 
-  return new_state;
+  return state;
 }
 
 
-void
-living_fsm_fall_ill(void)
+static int
+living_fsm_cure_ill_handler(enum living_state_t state,
+                            struct living_fsm_t *living_fsm)
 {
-  int ret;
+  brain_msg("thank you for your help; I'm just fine now");
 
-  ret = fsm_emit_simple(&living_fsm.fsm, LIVING_EVENT_FALL_ILL);
-  ASSERT( ret == 0 );
+  return LIVING_STATE_ALIVE;
+}
+
+
+static int
+living_fsm_cure_very_ill_handler(enum living_state_t state,
+                                 struct living_fsm_t *living_fsm)
+{
+  brain_msg("finally you gave me some remedies; It feels much better now");
+
+  return LIVING_STATE_ILL;
+}
+
+
+int
+living_fsm_fall_ill(struct brain_t *brain, struct fsm_t *from)
+{
+  return fsm_notify(from, &brain->living.fsm, LIVING_EVENT_FALL_ILL);
 }
 
 
 int
-living_fsm_cure_illness(void)
+living_fsm_cure_illness(struct brain_t *brain)
 {
-  return fsm_emit_simple(&living_fsm.fsm, LIVING_EVENT_CURE_ILLNESS);
+  return fsm_emit_simple(&brain->living.fsm, LIVING_EVENT_CURE_ILLNESS);
 }
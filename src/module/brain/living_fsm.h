@@ -11,59 +11,123 @@
 #define _BRAIN__LIVING_FSM_H_
 
 
+#include <linux/types.h>
 #include <linux/compiler.h>
 
+#include "utils/random.h"
+
+#include "status/status.h"
+
+#include "fsm/fsm.h"
+
+
+struct brain_t;
+
+
+/// Living FSM type.
+struct living_fsm_t {
+  struct random_stream_t random; /**< Random stream. */
+
+  struct fsm_t fsm;
+};
+
+
+/// Templates of living FSM status attributes (see brain_status_create()).
+extern const struct status_attr_t living_fsm_status_attrs[];
+
+
+/// Number of items in #living_fsm_status_attrs.
+extern const size_t living_fsm_status_attr_count;
+
+
+/**
+ * Initializes facilities shared by all the living FSMs. Must be called before
+ * any brain is built.
+ *
+ * @return execution status
+ */
+int
+living_fsm_class_init(void);
+
+
+/**
+ * Cleanups facilities shared by all the living FSMs. All the brains must be
+ * destroyed by now.
+ */
+void
+living_fsm_class_cleanup(void);
+
 
 /**
  * Initializes living FSM.
  *
+ * @param brain brain the FSM is part of
  *
  * @return execution status
  */
 int
-living_fsm_init(void);
+living_fsm_init(struct brain_t *brain);
 
 
 /**
  * Cleanups resources held by living FSM.
  *
+ * @param brain brain the FSM is part of
  */
 void
-living_fsm_cleanup(void);
+living_fsm_cleanup(struct brain_t *brain);
 
 
 /**
- * Makes entropy eater to die nobly (not causing kernel panic).
+ * Makes entropy eater to die nobly (without being reaped from the herd).
  *
- * @return execution status
+ * @param brain eater's brain
  */
 void
-living_fsm_die_nobly(void);
+living_fsm_die_nobly(struct brain_t *brain);
 
 
 /**
- * Kills entropy eater. Causes kernel panic.
+ * Kills entropy eater once the lock of the calling FSM has been released
+ * (see fsm_notify()). The dead eater is removed from the herd (see
+ * herd_reap()). Can be called only from event handlers of other FSMs of the
+ * same brain.
+ *
+ * @param brain eater's brain
+ * @param from  FSM whose event handler is calling
+ *
+ * @retval  0 death has been requested
+ * @retval <0 request could not be posted; the handler should fail so that
+ *            nothing is changed and the request is repeated later
  */
-void __noreturn
-living_fsm_die(void);
+int
+living_fsm_die(struct brain_t *brain, struct fsm_t *from);
 
 
 /**
- * Makes entropy eater ill.
+ * Makes entropy eater ill once the lock of the calling FSM has been released
+ * (see fsm_notify()). Can be called only from event handlers of other FSMs
+ * of the same brain.
  *
+ * @param brain eater's brain
+ * @param from  FSM whose event handler is calling
+ *
+ * @retval  0 illness has been requested
+ * @retval <0 request could not be posted (see living_fsm_die())
  */
-void
-living_fsm_fall_ill(void);
+int
+living_fsm_fall_ill(struct brain_t *brain, struct fsm_t *from);
 
 
 /**
  * Cures entropy eater's illness.
  *
+ * @param brain eater's brain
  *
  * @return execution status
  */
 int
-living_fsm_cure_illness(void);
+living_fsm_cure_illness(struct brain_t *brain);
 
 
 #endif /* _BRAIN__LIVING_FSM_H_ */
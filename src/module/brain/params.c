@@ -0,0 +1,397 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+
+#include "utils/trace.h"
+#include "utils/assert.h"
+
+#include "status/status.h"
+
+#include "brain/params.h"
+
+
+/// Upper bound of all the parameters. Keeps computations of deviated values
+/// from overflowing.
+#define BRAIN_PARAMS_VALUE_MAX (INT_MAX / 100)
+
+
+/// Named set of parameters.
+struct brain_params_preset_t {
+  const char            *name;   /**< Preset name. */
+  struct brain_params_t  params; /**< Parameters. */
+};
+
+
+/// Presets that can be loaded through 'params_preset' file. The first one is
+/// used by default. All of them must pass brain_params_check() with
+/// #TIME_BASE_MSECS of both debug and release builds, i.e. times must not
+/// exceed 357 * #TIME_BASE_MSECS.
+static const struct brain_params_preset_t brain_params_presets[] = {
+  {
+    .name   = "default",
+    .params = {
+      .time_deviation            = 10,
+      .feeding_period            = 30 * TIME_BASE_MSECS,
+      .entropy_deviation         = 10,
+      .hunger_entropy            = 1024,
+      .entropy_balance_low       = -10000,
+      .entropy_balance_high      = 10000,
+      .very_ill_living_period    = 270 * TIME_BASE_MSECS,
+      .ill_to_very_ill_period    = 270 * TIME_BASE_MSECS,
+      .bathroom_count_dirty      = 1,
+      .bathroom_count_insanitary = 3,
+      .go_to_bathroom_delay      = 25 * TIME_BASE_MSECS,
+      .infection_dice_roll_delay = 90 * TIME_BASE_MSECS,
+      .social_demotion_time      = 200 * TIME_BASE_MSECS,
+      .rps_count_promote         = 5,
+    },
+  },
+  {
+    .name   = "relaxed",
+    .params = {
+      .time_deviation            = 10,
+      .feeding_period            = 60 * TIME_BASE_MSECS,
+      .entropy_deviation         = 10,
+      .hunger_entropy            = 512,
+      .entropy_balance_low       = -20000,
+      .entropy_balance_high      = 20000,
+      .very_ill_living_period    = 350 * TIME_BASE_MSECS,
+      .ill_to_very_ill_period    = 350 * TIME_BASE_MSECS,
+      .bathroom_count_dirty      = 2,
+      .bathroom_count_insanitary = 5,
+      .go_to_bathroom_delay      = 50 * TIME_BASE_MSECS,
+      .infection_dice_roll_delay = 180 * TIME_BASE_MSECS,
+      .social_demotion_time      = 350 * TIME_BASE_MSECS,
+      .rps_count_promote         = 3,
+    },
+  },
+  {
+    .name   = "demanding",
+    .params = {
+      .time_deviation            = 20,
+      .feeding_period            = 15 * TIME_BASE_MSECS,
+      .entropy_deviation         = 20,
+      .hunger_entropy            = 2048,
+      .entropy_balance_low       = -5000,
+      .entropy_balance_high      = 5000,
+      .very_ill_living_period    = 135 * TIME_BASE_MSECS,
+      .ill_to_very_ill_period    = 135 * TIME_BASE_MSECS,
+      .bathroom_count_dirty      = 1,
+      .bathroom_count_insanitary = 2,
+      .go_to_bathroom_delay      = 12 * TIME_BASE_MSECS,
+      .infection_dice_roll_delay = 45 * TIME_BASE_MSECS,
+      .social_demotion_time      = 100 * TIME_BASE_MSECS,
+      .rps_count_promote         = 8,
+    },
+  },
+};
+
+
+struct brain_params_t __rcu *brain_params;
+
+
+/// Serializes writers of #brain_params.
+static DEFINE_MUTEX(brain_params_lock);
+
+
+/// Exports a parameter via sysfs. Takes offset of the parameter in
+/// #brain_params_t as data.
+static ssize_t
+brain_params_attr_show(const char *name, void *data, char *buffer);
+
+
+/// Changes a parameter via sysfs. Takes offset of the parameter in
+/// #brain_params_t as data.
+static ssize_t
+brain_params_attr_store(const char *name, void *data,
+                        const char *buffer, size_t count);
+
+
+/// Exports names of the presets via sysfs. Preset matching current
+/// parameters is shown in brackets.
+static ssize_t
+brain_params_preset_attr_show(const char *name, void *data, char *buffer);
+
+
+/// Loads a preset by its name.
+static ssize_t
+brain_params_preset_attr_store(const char *name, void *data,
+                               const char *buffer, size_t count);
+
+
+/// Initializer of status attribute of a parameter.
+#define BRAIN_PARAMS_ATTR(_name)                                        \
+  STATUS_ATTR_RW(param_##_name,                                         \
+                 brain_params_attr_show,                                \
+                 brain_params_attr_store,                               \
+                 (void *) offsetof(struct brain_params_t, _name)),
+
+
+/// Sysfs attributes.
+static struct status_attr_t brain_params_attrs[] = {
+  BRAIN_PARAMS(BRAIN_PARAMS_ATTR)
+  STATUS_ATTR_RW(params_preset,
+                 brain_params_preset_attr_show,
+                 brain_params_preset_attr_store,
+                 NULL),
+};
+
+
+/**
+ * Checks that parameters are consistent.
+ *
+ * @param params parameters to check
+ *
+ * @retval true  parameters are valid
+ * @retval false otherwise
+ */
+static bool
+brain_params_check(const struct brain_params_t *params)
+{
+  const int *values = (const int *) params;
+  size_t     i;
+
+  for (i = 0; i < sizeof(*params) / sizeof(int); ++i) {
+    if (abs(values[i]) > BRAIN_PARAMS_VALUE_MAX) {
+      return false;
+    }
+  }
+
+  return
+    params->time_deviation >= 0 && params->time_deviation <= 100 &&
+    params->entropy_deviation >= 0 && params->entropy_deviation <= 100 &&
+    params->feeding_period > 0 &&
+    params->hunger_entropy > 0 &&
+    params->entropy_balance_low < 0 && params->entropy_balance_high > 0 &&
+    params->very_ill_living_period > 0 &&
+    params->ill_to_very_ill_period > 0 &&
+    params->bathroom_count_dirty > 0 &&
+    params->bathroom_count_insanitary >= params->bathroom_count_dirty &&
+    params->go_to_bathroom_delay > 0 &&
+    params->infection_dice_roll_delay > 0 &&
+    params->social_demotion_time > 0 &&
+    params->rps_count_promote > 0;
+}
+
+
+/**
+ * Publishes new parameters and frees the old ones once all the readers are
+ * done with them. Must be called with #brain_params_lock held.
+ *
+ * @param params new parameters; owned by the callee
+ */
+static void
+brain_params_publish(struct brain_params_t *params)
+{
+  struct brain_params_t *old;
+
+  old = rcu_dereference_protected(brain_params,
+                                  lockdep_is_held(&brain_params_lock));
+  rcu_assign_pointer(brain_params, params);
+
+  if (old != NULL) {
+    synchronize_rcu();
+    kfree(old);
+  }
+}
+
+
+int
+brain_params_init(void)
+{
+  int                    ret;
+  size_t                 i;
+  struct brain_params_t *params;
+
+  for (i = 0; i < ARRAY_SIZE(brain_params_presets); ++i) {
+    if (!brain_params_check(&brain_params_presets[i].params)) {
+      TRACE_ERR("Brain parameters preset %s is invalid",
+                brain_params_presets[i].name);
+      return -EINVAL;
+    }
+  }
+
+  params = kmemdup(&brain_params_presets[0].params,
+                   sizeof(*params), GFP_KERNEL);
+  if (params == NULL) {
+    return -ENOMEM;
+  }
+
+  mutex_lock(&brain_params_lock);
+  brain_params_publish(params);
+  mutex_unlock(&brain_params_lock);
+
+  ret = status_create_files(brain_params_attrs,
+                            ARRAY_SIZE(brain_params_attrs));
+  if (ret != 0) {
+    TRACE_ERR("Failed to create brain parameters sysfs attributes: %d", ret);
+    goto error;
+  }
+
+  return 0;
+
+error:
+  brain_params_cleanup();
+  return ret;
+}
+
+
+void
+brain_params_cleanup(void)
+{
+  struct brain_params_t *params;
+
+  if (brain_params_attrs[0].has_file) {
+    status_remove_files(brain_params_attrs, ARRAY_SIZE(brain_params_attrs));
+  }
+
+  mutex_lock(&brain_params_lock);
+  params = rcu_dereference_protected(brain_params,
+                                     lockdep_is_held(&brain_params_lock));
+  rcu_assign_pointer(brain_params, NULL);
+  mutex_unlock(&brain_params_lock);
+
+  synchronize_rcu();
+  kfree(params);
+}
+
+
+static ssize_t
+brain_params_attr_show(const char *name, void *data, char *buffer)
+{
+  size_t offset = (size_t) data;
+  int    value;
+
+  rcu_read_lock();
+  value = *(const int *) ((const char *) rcu_dereference(brain_params) +
+                          offset);
+  rcu_read_unlock();
+
+  return snprintf(buffer, PAGE_SIZE, "%d\n", value);
+}
+
+
+static ssize_t
+brain_params_attr_store(const char *name, void *data,
+                        const char *buffer, size_t count)
+{
+  int                    ret;
+  long                   value;
+  size_t                 offset = (size_t) data;
+  struct brain_params_t *params;
+  char                   string[16];
+
+  if (count >= sizeof(string)) {
+    return -EINVAL;
+  }
+
+  /* strict_strtol() accepts only trailing newline */
+  memcpy(string, buffer, count);
+  string[count] = '\0';
+
+  ret = strict_strtol(strim(string), 10, &value);
+  if (ret != 0) {
+    return ret;
+  }
+
+  if (value < INT_MIN || value > INT_MAX) {
+    return -EINVAL;
+  }
+
+  mutex_lock(&brain_params_lock);
+
+  params = kmemdup(rcu_dereference_protected(brain_params,
+                                             lockdep_is_held(
+                                               &brain_params_lock)),
+                   sizeof(*params), GFP_KERNEL);
+  if (params == NULL) {
+    ret = -ENOMEM;
+    goto out;
+  }
+
+  *(int *) ((char *) params + offset) = value;
+
+  if (!brain_params_check(params)) {
+    kfree(params);
+    ret = -EINVAL;
+    goto out;
+  }
+
+  brain_params_publish(params);
+
+  TRACE_INFO("Brain parameter %s set to %ld", name, value);
+  ret = count;
+
+out:
+  mutex_unlock(&brain_params_lock);
+  return ret;
+}
+
+
+static ssize_t
+brain_params_preset_attr_show(const char *name, void *data, char *buffer)
+{
+  size_t  i;
+  ssize_t count = 0;
+  bool    selected;
+
+  rcu_read_lock();
+
+  for (i = 0; i < ARRAY_SIZE(brain_params_presets); ++i) {
+    selected = memcmp(rcu_dereference(brain_params),
+                     &brain_params_presets[i].params,
+                     sizeof(struct brain_params_t)) == 0;
+
+    count += scnprintf(buffer + count, PAGE_SIZE - count,
+                       selected ? "%s[%s]" : "%s%s",
+                       i == 0 ? "" : " ", brain_params_presets[i].name);
+  }
+
+  rcu_read_unlock();
+
+  count += scnprintf(buffer + count, PAGE_SIZE - count, "\n");
+
+  return count;
+}
+
+
+static ssize_t
+brain_params_preset_attr_store(const char *name, void *data,
+                               const char *buffer, size_t count)
+{
+  size_t                 i;
+  struct brain_params_t *params;
+
+  for (i = 0; i < ARRAY_SIZE(brain_params_presets); ++i) {
+    if (sysfs_streq(buffer, brain_params_presets[i].name)) {
+      break;
+    }
+  }
+
+  if (i == ARRAY_SIZE(brain_params_presets)) {
+    return -EINVAL;
+  }
+
+  /* presets have been checked on init; this just keeps an invalid block
+   * from ever going live */
+  if (!brain_params_check(&brain_params_presets[i].params)) {
+    return -EINVAL;
+  }
+
+  params = kmemdup(&brain_params_presets[i].params,
+                   sizeof(*params), GFP_KERNEL);
+  if (params == NULL) {
+    return -ENOMEM;
+  }
+
+  mutex_lock(&brain_params_lock);
+  brain_params_publish(params);
+  mutex_unlock(&brain_params_lock);
+
+  TRACE_INFO("Brain parameters preset %s loaded",
+             brain_params_presets[i].name);
+
+  return count;
+}
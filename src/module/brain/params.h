@@ -4,7 +4,10 @@
  * @date   Tue Sep 21 21:06:58 2010
  *
  * @brief  All the parameters adjusting entropy eaters behavior gathered in
- * one place.
+ * one place. Most of them can be changed at runtime through 'param_*' files
+ * in status directory or by loading one of the presets through
+ * 'params_preset' file. Values drawn before a change (e.g. timers that are
+ * already armed) are not affected by it.
  *
  *
  */
@@ -15,113 +18,243 @@
 
 
 #include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/rcupdate.h>
 
 #include "utils/assert.h"
 #include "utils/random.h"
 
 
-static inline int __deviate_value(int value, unsigned int deviation)
+static inline int __deviate_value(struct random_stream_t *stream,
+                                  int value, unsigned int deviation)
 {
   int range;
-  int randint;
-  int sign;
 
   ASSERT( deviation <= 100 );
 
   range = value * deviation / 100;
+  if (range <= 0) {
+    return value;
+  }
 
-  randint = get_random_int() % range;
-  sign    = get_random_int() & 0x1 ? 1 : -1;
-
-  return value + sign * (randint % range);
+  /* uniform over [value - range, value + range] */
+  return value - range + random_stream_range(stream, 2 * range + 1);
 }
 
 
-/// Base value of time used for all other time measurements.
+/// Base value of time used for all other time measurements (virtual ms).
+/// All the times are measured by FSM's virtual clock, so they can be scaled
+/// at runtime using 'time_scale' module parameter.
 #ifdef DEBUG
-#define TIME_BASE (msecs_to_jiffies(1000))
+#define TIME_BASE_MSECS 1000
 #else
-#define TIME_BASE (msecs_to_jiffies(1000) * 60)
+#define TIME_BASE_MSECS (1000 * 60)
 #endif
 
 
-/// In which bounds (in per cents) to randomize all the time parameters
-/// specified here.
-#define EATER_TIME_DEVIATION 10
+/// #TIME_BASE_MSECS in virtual jiffies.
+#define TIME_BASE (msecs_to_jiffies(TIME_BASE_MSECS))
 
 
-/// Periods between eaters' meals.
-#define __EATER_FEEDING_TIME_PERIOD (30 * TIME_BASE)
-#define EATER_FEEDING_TIME_PERIOD \
-  __deviate_value(__EATER_FEEDING_TIME_PERIOD, EATER_TIME_DEVIATION)
+/// Slack of eater's timers that don't have to be exact. Such timers are
+/// aligned to a multiple of the slack, so the timers of all the FSMs expiring
+/// within the same interval are fired by a single wakeup. The slack is small
+/// compared to the deviation of the time parameters below. Equals to
+/// #TIME_BASE but can be used in static initializers.
+#ifdef DEBUG
+#define EATER_TIMER_SLACK HZ
+#else
+#define EATER_TIMER_SLACK (HZ * 60)
+#endif
+
+
+/// X-macro list of tunable parameters.
+#define BRAIN_PARAMS(X)                                                 \
+  /* In which bounds (in per cents) to randomize all the time           \
+   * parameters. */                                                     \
+  X(time_deviation)                                                     \
+  /* Periods between eaters' meals (virtual ms). */                     \
+  X(feeding_period)                                                     \
+  /* Bounds deviation of entropy quantity that should be eaten when     \
+   * eater's hungry. */                                                 \
+  X(entropy_deviation)                                                  \
+  /* How much entropy should be consumed after eater got hungry. */     \
+  X(hunger_entropy)                                                     \
+  /* Critically low entropy balance level that causes eater's death. */ \
+  X(entropy_balance_low)                                                \
+  /* Critically high entropy balance level that causes eater's          \
+   * death. */                                                          \
+  X(entropy_balance_high)                                               \
+  /* How long entropy eater can live without cure when he's very ill    \
+   * (virtual ms). */                                                   \
+  X(very_ill_living_period)                                             \
+  /* How fast entropy eater moves from ill to very ill state without a  \
+   * cure (virtual ms). */                                              \
+  X(ill_to_very_ill_period)                                             \
+  /* Bathroom count making sanitation state dirty. */                   \
+  X(bathroom_count_dirty)                                               \
+  /* Bathroom count making sanitation state insanitary. */              \
+  X(bathroom_count_insanitary)                                          \
+  /* Delay between a meal and a need to go to bathroom (virtual ms). */ \
+  X(go_to_bathroom_delay)                                               \
+  /* How often there's a chance for eater to become infected in         \
+   * insanitary conditions (virtual ms). */                             \
+  X(infection_dice_roll_delay)                                          \
+  /* Time needed for entropy eater to become less happy (virtual        \
+   * ms). */                                                            \
+  X(social_demotion_time)                                               \
+  /* Number of times to play in rock-paper-scissors with eater to make  \
+   * it more happy. */                                                  \
+  X(rps_count_promote)
+
+
+/// Declares a field of #brain_params_t.
+#define BRAIN_PARAMS_FIELD(_name) int _name;
+
+
+/// Block of tunable parameters. Published via RCU: readers dereference
+/// #brain_params once per decision (see brain_params_read_lock()); writers
+/// replace the whole block.
+struct brain_params_t {
+  BRAIN_PARAMS(BRAIN_PARAMS_FIELD)
+};
+
+
+/// Current parameters. Use brain_params_read_lock() to read them.
+extern struct brain_params_t __rcu *brain_params;
+
+
+/**
+ * Starts reading current parameters. Everything a single decision depends on
+ * must be read through the returned pointer, so that all the values come
+ * from the same block and are consistent with each other (see
+ * brain_params_check()). Must not sleep until brain_params_read_unlock().
+ *
+ *
+ * @return current parameters
+ */
+static inline const struct brain_params_t *
+brain_params_read_lock(void)
+{
+  rcu_read_lock();
+  return rcu_dereference(brain_params);
+}
+
+
+/**
+ * Finishes reading parameters started by brain_params_read_lock(). The
+ * pointer returned by it must not be used anymore.
+ *
+ */
+static inline void
+brain_params_read_unlock(void)
+{
+  rcu_read_unlock();
+}
 
 
-/// Bounds deviation of entropy quantity that should be eaten when eater's
-/// hungry.
-#define EATER_ENTROPY_DEVIATION 10
+/**
+ * Randomizes time parameter.
+ *
+ * @param stream    random stream to draw from
+ * @param msecs     time (virtual ms)
+ * @param deviation deviation bounds in per cents
+ *
+ * @return time in virtual jiffies
+ */
+static inline unsigned long
+__deviate_time(struct random_stream_t *stream,
+               int msecs, unsigned int deviation)
+{
+  return msecs_to_jiffies(__deviate_value(stream, msecs, deviation));
+}
+
+
+/**
+ * Creates parameter files in status directory and publishes default
+ * parameters.
+ *
+ * @retval  0 success
+ * @retval <0 error occurred
+ */
+int
+brain_params_init(void);
+
+
+/**
+ * Removes parameter files and frees parameters.
+ */
+void
+brain_params_cleanup(void);
+
+
+/// Periods between eaters' meals.
+#define EATER_FEEDING_TIME_PERIOD(params, stream)                       \
+  __deviate_time((stream), (params)->feeding_period,                    \
+                 (params)->time_deviation)
 
 
 /// How much entropy should be consumed after eater got hungry.
-#define __EATER_HUNGER_ENTROPY_REQUIRED 1024
-#define EATER_HUNGER_ENTROPY_REQUIRED \
-  __deviate_value(__EATER_HUNGER_ENTROPY_REQUIRED, EATER_ENTROPY_DEVIATION)
+#define EATER_HUNGER_ENTROPY_REQUIRED(params, stream)                   \
+  __deviate_value((stream), (params)->hunger_entropy,                   \
+                  (params)->entropy_deviation)
 
 
 /// Critically low entropy balance level that causes eater's death.
-#define EATER_ENTROPY_BALANCE_CRITICALLY_LOW -10000
+#define EATER_ENTROPY_BALANCE_CRITICALLY_LOW(params)    \
+  ((params)->entropy_balance_low)
 
 
 /// Critically high entropy balance level that causes eater's death.
-#define EATER_ENTROPY_BALANCE_CRITICALLY_HIGH 10000
+#define EATER_ENTROPY_BALANCE_CRITICALLY_HIGH(params)   \
+  ((params)->entropy_balance_high)
 
 
 /// Determines how long entropy eater can live without cure when he's very ill.
-#define __EATER_VERY_ILL_LIVING_PERIOD (270 * TIME_BASE)
-#define EATER_VERY_ILL_LIVING_PERIOD \
-  __deviate_value(__EATER_VERY_ILL_LIVING_PERIOD, EATER_TIME_DEVIATION)
+#define EATER_VERY_ILL_LIVING_PERIOD(params, stream)                    \
+  __deviate_time((stream), (params)->very_ill_living_period,            \
+                 (params)->time_deviation)
 
 
 /// Determines how fast entropy eater moves from ill to very ill state
 /// without a cure.
-#define __EATER_ILL_TO_VERY_ILL_PERIOD (270 * TIME_BASE)
-#define EATER_ILL_TO_VERY_ILL_PERIOD \
-  __deviate_value(__EATER_ILL_TO_VERY_ILL_PERIOD, EATER_TIME_DEVIATION)
-
-
-/// Determines normal sanitation FSM state by bathroom count.
-#define EATER_BATHROOM_COUNT_NORMAL     0
+#define EATER_ILL_TO_VERY_ILL_PERIOD(params, stream)                    \
+  __deviate_time((stream), (params)->ill_to_very_ill_period,            \
+                 (params)->time_deviation)
 
 
 /// Determines dirty sanitation FSM state by bathroom count.
-#define EATER_BATHROOM_COUNT_DIRTY      1
+#define EATER_BATHROOM_COUNT_DIRTY(params) ((params)->bathroom_count_dirty)
 
 
 /// Determines insanitary sanitation FSM state by bathroom count.
-#define EATER_BATHROOM_COUNT_INSANITARY 3
+#define EATER_BATHROOM_COUNT_INSANITARY(params) \
+  ((params)->bathroom_count_insanitary)
 
 
 /// Delay between a meal and a need to go to bathroom.
-#define __EATER_GO_TO_BATHROOM_DELAY (25 * TIME_BASE)
-#define EATER_GO_TO_BATHROOM_DELAY \
-  __deviate_value(__EATER_GO_TO_BATHROOM_DELAY, EATER_TIME_DEVIATION)
+#define EATER_GO_TO_BATHROOM_DELAY(params, stream)                      \
+  __deviate_time((stream), (params)->go_to_bathroom_delay,              \
+                 (params)->time_deviation)
 
 
 /// Determines how often there will a chance for eater to become infected in
 /// insanitary conditions.
-#define __EATER_INFECTION_DICE_ROLL_DELAY (90 * TIME_BASE)
-#define EATER_INFECTION_DICE_ROLL_DELAY \
-  __deviate_value(__EATER_INFECTION_DICE_ROLL_DELAY, EATER_TIME_DEVIATION)
+#define EATER_INFECTION_DICE_ROLL_DELAY(params, stream)                 \
+  __deviate_time((stream), (params)->infection_dice_roll_delay,         \
+                 (params)->time_deviation)
 
 
 /// Time needed for entropy eater to become less happy.
-#define __EATER_SOCIAL_STATE_DEMOTION_TIME (200 * TIME_BASE)
-#define EATER_SOCIAL_STATE_DEMOTION_TIME \
-  __deviate_value(__EATER_SOCIAL_STATE_DEMOTION_TIME, EATER_TIME_DEVIATION)
+#define EATER_SOCIAL_STATE_DEMOTION_TIME(params, stream)                \
+  __deviate_time((stream), (params)->social_demotion_time,              \
+                 (params)->time_deviation)
 
 
 /// Number of times to play in rock-paper-scissors with eater to make it more
 /// happy.
-#define EATER_RPS_COUNT_SOCIAL_STATE_PROMOTE 5
+#define EATER_RPS_COUNT_SOCIAL_STATE_PROMOTE(params) \
+  ((params)->rps_count_promote)
 
 
 #endif /* _PARAMS_H_ */
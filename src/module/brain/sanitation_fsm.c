@@ -1,19 +1,29 @@
+#include <linux/bitops.h>
+
 #include "utils/assert.h"
 
 #include "fsm/fsm.h"
+#include "fsm/stats.h"
+#include "brain/brain.h"
 #include "brain/params.h"
 #include "brain/utils.h"
 #include "brain/sanitation_fsm.h"
 #include "brain/living_fsm.h"
 
 
+/// X-macro list of sanitation FSM events.
+#define SANITATION_EVENTS(X)                                            \
+  X(SANITATION_EVENT_JUST_EATEN)                                        \
+  X(SANITATION_EVENT_GO_TO_BATHROOM)                                    \
+  X(SANITATION_EVENT_SWEEP)                                             \
+  X(SANITATION_EVENT_DISINFECT)                                         \
+  /* Emitted at the sampled time the infection makes the eater ill. */  \
+  X(SANITATION_EVENT_FALL_ILL)
+
+
 /// Sanitation FSM events.
 enum sanitation_event_t {
-  SANITATION_EVENT_JUST_EATEN,
-  SANITATION_EVENT_GO_TO_BATHROOM,
-  SANITATION_EVENT_SWEEP,
-  SANITATION_EVENT_DISINFECT,
-  SANITATION_EVENT_INFECTION_DICE_ROLL,
+  SANITATION_EVENTS(FSM_ENUM_ITEM)
   __SANITATION_EVENT_LAST
 };
 
@@ -21,33 +31,25 @@ enum sanitation_event_t {
 #define SANITATION_EVENTS_COUNT __SANITATION_EVENT_LAST
 
 
-/// Ensures that event is valid.
-#define ASSERT_VALID_EVENT(event) \
-  ASSERT_IN_RANGE(event, 0, SANITATION_EVENTS_COUNT - 1)
+/// Maximum number of meals reported to FSM under a single lock
+/// acquisition.
+#define SANITATION_FSM_BATCH_SIZE 16
 
 
-static inline const char *
-sanitation_event_to_str(enum sanitation_event_t event)
-{
-  static const char *strs[] = {
-    "SANITATION_EVENT_JUST_EATEN",
-    "SANITATION_EVENT_GO_TO_BATHROOM",
-    "SANITATION_EVENT_SWEEP",
-    "SANITATION_EVENT_DISINFECT",
-    "SANITATION_EVENT_INFECTION_DICE_ROLL"
-  };
+FSM_DEFINE_TO_STR(sanitation_event_to_str, enum sanitation_event_t,
+                  SANITATION_EVENTS, SANITATION_EVENTS_COUNT)
 
-  ASSERT_VALID_EVENT(event);
 
-  return strs[event];
-}
+/// X-macro list of sanitation FSM states.
+#define SANITATION_STATES(X)                    \
+  X(SANITATION_STATE_NORMAL)                    \
+  X(SANITATION_STATE_DIRTY)                     \
+  X(SANITATION_STATE_INSANITARY)
 
 
 /// Sanitation FSM states.
 enum sanitation_state_t {
-  SANITATION_STATE_NORMAL,
-  SANITATION_STATE_DIRTY,
-  SANITATION_STATE_INSANITARY,
+  SANITATION_STATES(FSM_ENUM_ITEM)
   __SANITATION_STATE_LAST
 };
 
@@ -55,37 +57,8 @@ enum sanitation_state_t {
 #define SANITATION_STATES_COUNT __SANITATION_STATE_LAST
 
 
-/// Ensures that state is valid.
-#define ASSERT_VALID_STATE(state) \
-  ASSERT_IN_RANGE(state, 0, SANITATION_STATES_COUNT - 1);
-
-
-static inline const char *
-sanitation_state_to_str(enum sanitation_state_t state)
-{
-  static const char *strs[] = {
-    "SANITATION_STATE_NORMAL",
-    "SANITATION_STATE_DIRTY",
-    "SANITATION_STATE_INSANITARY",
-  };
-
-  ASSERT_VALID_STATE(state);
-
-  return strs[state];
-}
-
-
-/// Sanitation FSM type.
-struct sanitation_fsm_t {
-  unsigned int bathroom_count;  /**< Number of times eater went to "bathroom"
-                                 * that were not swept by the user. */
-  bool         infected;        /**< Infection is all around. */
-  struct fsm_t fsm;
-};
-
-
-/// Sanitation FSM.
-static struct sanitation_fsm_t sanitation_fsm;
+FSM_DEFINE_TO_STR(sanitation_state_to_str, enum sanitation_state_t,
+                  SANITATION_STATES, SANITATION_STATES_COUNT)
 
 
 /// Exports bathroom_count via sysfs.
@@ -103,17 +76,22 @@ sanitation_fsm_infected_attr_show(const char *name,
                                   char *buffer);
 
 
-/// Sysfs attributes.
-static struct status_attr_t sanitation_fsm_attrs[] = {
+const struct status_attr_t sanitation_fsm_status_attrs[] = {
+  FSM_STATE_ATTR(sanitation_fsm_state, BRAIN_STATUS_DATA(sanitation.fsm)),
+  FSM_STATS_ATTR(sanitation_fsm_stats, BRAIN_STATUS_DATA(sanitation.fsm)),
   STATUS_ATTR(bathroom_count,
               (status_attr_show_t) sanitation_fsm_bathroom_count_attr_show,
-              &sanitation_fsm),
+              BRAIN_STATUS_DATA(sanitation)),
   STATUS_ATTR(infected,
               (status_attr_show_t) sanitation_fsm_infected_attr_show,
-              &sanitation_fsm),
+              BRAIN_STATUS_DATA(sanitation)),
 };
 
 
+const size_t sanitation_fsm_status_attr_count =
+  ARRAY_SIZE(sanitation_fsm_status_attrs);
+
+
 /// Handles #SANITATION_EVENT_JUST_EATEN event.
 static int
 sanitation_fsm_just_eaten_handler(enum sanitation_state_t state,
@@ -138,11 +116,10 @@ sanitation_fsm_disinfect_handler(enum sanitation_state_t state,
                                  struct sanitation_fsm_t *sanitation_fsm);
 
 
-/// Handles #SANITATION_EVENT_INFECTION_DICE_ROLL event.
+/// Handles #SANITATION_EVENT_FALL_ILL event.
 static int
-sanitation_fsm_infection_dice_roll_handler(
-  enum sanitation_state_t state,
-  struct sanitation_fsm_t *sanitation_fsm);
+sanitation_fsm_fall_ill_handler(enum sanitation_state_t state,
+                                struct sanitation_fsm_t *sanitation_fsm);
 
 
 struct fsm_event_handler_t sanitation_fsm_handlers[SANITATION_EVENTS_COUNT] = {
@@ -163,85 +140,243 @@ struct fsm_event_handler_t sanitation_fsm_handlers[SANITATION_EVENTS_COUNT] = {
     (fsm_event_handler_no_data_t) sanitation_fsm_disinfect_handler
   ),
   EVENT_NO_DATA (
-    SANITATION_EVENT_INFECTION_DICE_ROLL,
-    (fsm_event_handler_no_data_t) sanitation_fsm_infection_dice_roll_handler
+    SANITATION_EVENT_FALL_ILL,
+    (fsm_event_handler_no_data_t) sanitation_fsm_fall_ill_handler
   ),
 };
 
 
+/// Checks whether #SANITATION_EVENT_SWEEP can change anything.
+static bool
+sanitation_fsm_sweep_check(enum sanitation_state_t state,
+                           const struct sanitation_fsm_t *sanitation_fsm)
+{
+  return state != SANITATION_STATE_NORMAL;
+}
+
+
+/// Tells the user that sweeping is not needed.
+static void
+sanitation_fsm_sweep_reject(enum sanitation_state_t state,
+                            const struct sanitation_fsm_t *sanitation_fsm)
+{
+  brain_msg("thanks, but this is not needed now");
+}
+
+
+/// Checks whether #SANITATION_EVENT_DISINFECT can change anything.
+static bool
+sanitation_fsm_disinfect_check(enum sanitation_state_t state,
+                               const struct sanitation_fsm_t *sanitation_fsm)
+{
+  return sanitation_fsm->infected && state != SANITATION_STATE_INSANITARY;
+}
+
+
+/// Tells the user why disinfection is useless.
+static void
+sanitation_fsm_disinfect_reject(enum sanitation_state_t state,
+                                const struct sanitation_fsm_t *sanitation_fsm)
+{
+  if (state == SANITATION_STATE_INSANITARY) {
+    brain_msg("this will not help");
+  } else {
+    brain_msg("it's not needed");
+  }
+}
+
+
+/// Sanitation FSM event guards.
+static const struct fsm_guard_t
+sanitation_fsm_guards[SANITATION_EVENTS_COUNT] = {
+  [SANITATION_EVENT_SWEEP] = {
+    .check  = (bool (*)(int, const void *)) sanitation_fsm_sweep_check,
+    .reject = (void (*)(int, const void *)) sanitation_fsm_sweep_reject,
+  },
+  [SANITATION_EVENT_DISINFECT] = {
+    .check  = (bool (*)(int, const void *)) sanitation_fsm_disinfect_check,
+    .reject = (void (*)(int, const void *)) sanitation_fsm_disinfect_reject,
+  },
+};
+
+
 /// Returns FSM state by bathroom count.
 static inline enum sanitation_state_t
 classify_bathroom_count(unsigned int count)
 {
-  if (count >= EATER_BATHROOM_COUNT_INSANITARY) {
-    return SANITATION_STATE_INSANITARY;
-  } else if (count >= EATER_BATHROOM_COUNT_DIRTY) {
-    return SANITATION_STATE_DIRTY;
+  enum sanitation_state_t state;
+
+  const struct brain_params_t *params = brain_params_read_lock();
+
+  if (count >= EATER_BATHROOM_COUNT_INSANITARY(params)) {
+    state = SANITATION_STATE_INSANITARY;
+  } else if (count >= EATER_BATHROOM_COUNT_DIRTY(params)) {
+    state = SANITATION_STATE_DIRTY;
   } else {
-    return SANITATION_STATE_NORMAL;
+    state = SANITATION_STATE_NORMAL;
   }
+
+  brain_params_read_unlock();
+
+  return state;
 }
 
 
+/// Sanitation FSM timer slacks.
+static const unsigned long
+sanitation_fsm_slacks[SANITATION_EVENTS_COUNT] = {
+  [SANITATION_EVENT_GO_TO_BATHROOM] = EATER_TIMER_SLACK,
+  [SANITATION_EVENT_FALL_ILL]       = EATER_TIMER_SLACK,
+};
+
+
+/// Sanitation FSM data saved in snapshots.
+struct sanitation_fsm_snapshot_t {
+  u32 bathroom_count;           /**< See #sanitation_fsm_t. */
+  u8  infected;                 /**< See #sanitation_fsm_t. */
+} __attribute__((packed));
+
+
+/// Saves sanitation FSM data into snapshot.
+static void
+sanitation_fsm_save(const struct sanitation_fsm_t *sanitation_fsm,
+                    struct sanitation_fsm_snapshot_t *snapshot)
+{
+  snapshot->bathroom_count = sanitation_fsm->bathroom_count;
+  snapshot->infected       = sanitation_fsm->infected;
+}
+
+
+/// Checks sanitation FSM data saved in snapshot.
+static bool
+sanitation_fsm_validate(const struct sanitation_fsm_snapshot_t *snapshot)
+{
+  return snapshot->infected <= 1;
+}
+
+
+/// Loads sanitation FSM data from snapshot.
+static void
+sanitation_fsm_load(struct sanitation_fsm_t *sanitation_fsm,
+                    const struct sanitation_fsm_snapshot_t *snapshot)
+{
+  sanitation_fsm->bathroom_count = snapshot->bathroom_count;
+  sanitation_fsm->infected       = snapshot->infected;
+}
+
+
+/// Returns identifier of the eater the FSM belongs to.
+static u32
+sanitation_fsm_instance(const struct sanitation_fsm_t *sanitation_fsm)
+{
+  return brain_of(sanitation_fsm, sanitation)->id;
+}
+
+
+/// Sanitation FSM statistics.
+FSM_DEFINE_STATS(sanitation_fsm_stats);
+
+
+/// Sanitation FSM class.
+static const struct fsm_class_t sanitation_fsm_class = {
+  .name          = "sanitation_fsm",
+  .state_count   = SANITATION_STATES_COUNT,
+  .event_count   = SANITATION_EVENTS_COUNT,
+  .show_state    = (fsm_state_show_fn_t) sanitation_state_to_str,
+  .show_event    = (fsm_event_show_fn_t) sanitation_event_to_str,
+  .data_offset   = offsetof(struct sanitation_fsm_t, fsm),
+  .handlers      = sanitation_fsm_handlers,
+  .transitions   = NULL,
+  .timeouts      = NULL,
+  .guards        = sanitation_fsm_guards,
+  .slacks        = sanitation_fsm_slacks,
+  .stats         = &sanitation_fsm_stats,
+  .instance      = (u32 (*)(const void *)) sanitation_fsm_instance,
+  .snapshot_size = sizeof(struct sanitation_fsm_snapshot_t),
+  .save          = (void (*)(const void *, void *)) sanitation_fsm_save,
+  .validate      = (bool (*)(const void *)) sanitation_fsm_validate,
+  .load          = (void (*)(void *, const void *)) sanitation_fsm_load,
+};
+
+
 int
-sanitation_fsm_init(void)
+sanitation_fsm_class_init(void)
 {
-  int ret;
+  return fsm_class_init(&sanitation_fsm_class);
+}
 
-  sanitation_fsm.bathroom_count = 0;
 
-  ret = fsm_init(&sanitation_fsm.fsm, "sanitation_fsm",
-                 SANITATION_STATES_COUNT, SANITATION_EVENTS_COUNT,
-                 (fsm_state_show_fn_t) sanitation_state_to_str,
-                 (fsm_event_show_fn_t) sanitation_event_to_str,
-                 &sanitation_fsm, sanitation_fsm_handlers);
-  if (ret != 0) {
-    return ret;
-  }
+void
+sanitation_fsm_class_cleanup(void)
+{
+  fsm_class_cleanup(&sanitation_fsm_class);
+}
 
-  ret = status_create_files(sanitation_fsm_attrs,
-                            ARRAY_SIZE(sanitation_fsm_attrs));
-  if (ret != 0) {
-    TRACE_ERR("Failed to create sanitation FSM sysfs attributes: %d", ret);
-    goto error;
-  }
 
-  return 0;
+int
+sanitation_fsm_init(struct brain_t *brain)
+{
+  struct sanitation_fsm_t *sanitation_fsm = &brain->sanitation;
 
-error:
-  fsm_cleanup(&sanitation_fsm.fsm);
-  return ret;
+  sanitation_fsm->bathroom_count = 0;
+  sanitation_fsm->infected       = false;
+  brain_random_init(brain, &sanitation_fsm->random, BRAIN_STREAM_SANITATION);
+
+  return fsm_init(&sanitation_fsm->fsm, &sanitation_fsm_class);
 }
 
 
 void
-sanitation_fsm_cleanup(void)
+sanitation_fsm_cleanup(struct brain_t *brain)
 {
-  fsm_cleanup(&sanitation_fsm.fsm);
+  fsm_cleanup(&brain->sanitation.fsm);
 }
 
 
 void
-sanitation_fsm_just_eaten(void)
+sanitation_fsm_just_eaten(struct brain_t *brain)
 {
   int ret;
 
-  ret = fsm_emit_simple(&sanitation_fsm.fsm, SANITATION_EVENT_JUST_EATEN);
+  ret = fsm_emit_simple(&brain->sanitation.fsm, SANITATION_EVENT_JUST_EATEN);
   ASSERT( ret == 0 );
 }
 
 
+void
+sanitation_fsm_just_eaten_batch(struct brain_t *brain, size_t count)
+{
+  int    ret;
+  int    events[SANITATION_FSM_BATCH_SIZE];
+  size_t batch;
+  size_t i;
+
+  for (i = 0; i < SANITATION_FSM_BATCH_SIZE; ++i) {
+    events[i] = SANITATION_EVENT_JUST_EATEN;
+  }
+
+  while (count != 0) {
+    batch = min_t(size_t, count, SANITATION_FSM_BATCH_SIZE);
+
+    ret = fsm_emit_batch(&brain->sanitation.fsm, events, NULL, NULL, batch);
+    ASSERT( ret == 0 );
+
+    count -= batch;
+  }
+}
+
+
 int
-sanitation_fsm_sweep(void)
+sanitation_fsm_sweep(struct brain_t *brain)
 {
-  return fsm_emit_simple(&sanitation_fsm.fsm, SANITATION_EVENT_SWEEP);
+  return fsm_emit_simple(&brain->sanitation.fsm, SANITATION_EVENT_SWEEP);
 }
 
 
 int
-sanitation_fsm_disinfect(void)
+sanitation_fsm_disinfect(struct brain_t *brain)
 {
-  return fsm_emit_simple(&sanitation_fsm.fsm, SANITATION_EVENT_DISINFECT);
+  return fsm_emit_simple(&brain->sanitation.fsm, SANITATION_EVENT_DISINFECT);
 }
 
 
@@ -251,7 +386,7 @@ sanitation_fsm_sweep_handler(enum sanitation_state_t state,
 {
   switch (state) {
   case SANITATION_STATE_NORMAL:
-    brain_msg("thanks, but this is not needed now");
+    sanitation_fsm_sweep_reject(state, sanitation_fsm);
     break;
   case SANITATION_STATE_DIRTY:
   case SANITATION_STATE_INSANITARY:
@@ -272,7 +407,7 @@ sanitation_fsm_disinfect_handler(enum sanitation_state_t state,
 {
   switch (state) {
   case SANITATION_STATE_INSANITARY:
-    brain_msg("this will not help");
+    sanitation_fsm_disinfect_reject(state, sanitation_fsm);
     break;
   case SANITATION_STATE_NORMAL:
   case SANITATION_STATE_DIRTY:
@@ -281,9 +416,9 @@ sanitation_fsm_disinfect_handler(enum sanitation_state_t state,
       sanitation_fsm->infected = false;
 
       fsm_cancel_postponed_events_by_type(&sanitation_fsm->fsm,
-                                          SANITATION_EVENT_INFECTION_DICE_ROLL);
+                                          SANITATION_EVENT_FALL_ILL);
     } else {
-      brain_msg("it's not needed");
+      sanitation_fsm_disinfect_reject(state, sanitation_fsm);
     }
 
     break;
@@ -296,6 +431,60 @@ sanitation_fsm_disinfect_handler(enum sanitation_state_t state,
 }
 
 
+/**
+ * Samples time left till the infection makes the eater ill. Eater used to
+ * roll a dice every #EATER_INFECTION_DICE_ROLL_DELAY and fall ill with
+ * probability 1/2, so the number of rolls up to the first successful one is
+ * geometrically distributed. It's drawn at once as one plus the number of
+ * trailing zero bits of random values; the time is the sum of the delays
+ * of that many rolls.
+ *
+ * @param sanitation_fsm sanitation FSM
+ *
+ * @return delay in virtual jiffies
+ */
+static unsigned long
+sanitation_fsm_sample_infection(struct sanitation_fsm_t *sanitation_fsm)
+{
+  u32           bits;
+  unsigned long rolls = 1;
+  unsigned long delay = 0;
+
+  const struct brain_params_t *params;
+
+  while ((bits = random_stream_u32(&sanitation_fsm->random)) == 0) {
+    rolls += 32;
+  }
+
+  rolls += __ffs(bits);
+
+  params = brain_params_read_lock();
+  while (rolls-- != 0) {
+    delay += EATER_INFECTION_DICE_ROLL_DELAY(params, &sanitation_fsm->random);
+  }
+  brain_params_read_unlock();
+
+  return delay;
+}
+
+
+/**
+ * Arms the timer of the next illness caused by the infection.
+ *
+ * @param sanitation_fsm sanitation FSM
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+static int
+sanitation_fsm_schedule_illness(struct sanitation_fsm_t *sanitation_fsm)
+{
+  return fsm_postpone_event(&sanitation_fsm->fsm,
+                            SANITATION_EVENT_FALL_ILL,
+                            sanitation_fsm_sample_infection(sanitation_fsm));
+}
+
+
 static int
 sanitation_fsm_go_to_bathroom_handler(enum sanitation_state_t state,
                                       struct sanitation_fsm_t *sanitation_fsm)
@@ -309,9 +498,7 @@ sanitation_fsm_go_to_bathroom_handler(enum sanitation_state_t state,
   if ((state != new_state) && (new_state == SANITATION_STATE_INSANITARY)) {
     sanitation_fsm->infected = true;
 
-    ret = fsm_postpone_event(&sanitation_fsm->fsm,
-                             SANITATION_EVENT_INFECTION_DICE_ROLL,
-                             EATER_INFECTION_DICE_ROLL_DELAY);
+    ret = sanitation_fsm_schedule_illness(sanitation_fsm);
     if (ret != 0) {
       return ret;
     }
@@ -325,11 +512,15 @@ static int
 sanitation_fsm_just_eaten_handler(enum sanitation_state_t state,
                                   struct sanitation_fsm_t *sanitation_fsm)
 {
-  int ret;
+  int           ret;
+  unsigned long delay;
+
+  delay = EATER_GO_TO_BATHROOM_DELAY(brain_params_read_lock(),
+                                     &sanitation_fsm->random);
+  brain_params_read_unlock();
 
   ret = fsm_postpone_event(&sanitation_fsm->fsm,
-                           SANITATION_EVENT_GO_TO_BATHROOM,
-                           EATER_GO_TO_BATHROOM_DELAY);
+                           SANITATION_EVENT_GO_TO_BATHROOM, delay);
   if (ret != 0) {
     return ret;
   }
@@ -339,27 +530,29 @@ sanitation_fsm_just_eaten_handler(enum sanitation_state_t state,
 
 
 static int
-sanitation_fsm_infection_dice_roll_handler(
-  enum sanitation_state_t state,
-  struct sanitation_fsm_t *sanitation_fsm)
+sanitation_fsm_fall_ill_handler(enum sanitation_state_t state,
+                                struct sanitation_fsm_t *sanitation_fsm)
 {
-  int  ret;
-  bool fall_ill = get_random_bool();
-
-  if (fall_ill) {
-    brain_msg("I fell ill in this insanitary conditions. "
-              "You should have taken care of me better.");
-    living_fsm_fall_ill();
-  }
+  int ret;
+  int schedule_ret;
 
+  /* infection stays until disinfected; the next illness is scheduled even
+   * if this one fails, so that the eater does not become immune */
+  schedule_ret = sanitation_fsm_schedule_illness(sanitation_fsm);
 
-  ret = fsm_postpone_event(&sanitation_fsm->fsm,
-                           SANITATION_EVENT_INFECTION_DICE_ROLL,
-                           EATER_INFECTION_DICE_ROLL_DELAY);
+  ret = living_fsm_fall_ill(brain_of(sanitation_fsm, sanitation),
+                            &sanitation_fsm->fsm);
   if (ret != 0) {
     return ret;
   }
 
+  brain_msg("I fell ill in this insanitary conditions. "
+            "You should have taken care of me better.");
+
+  if (schedule_ret != 0) {
+    return schedule_ret;
+  }
+
   return state;
 }
 
@@ -371,10 +564,12 @@ sanitation_fsm_bathroom_count_attr_show(
   char *buffer)
 {
   unsigned int bathroom_count;
+  unsigned     seq;
 
-  fsm_read_lock(&sanitation_fsm->fsm);
-  bathroom_count = sanitation_fsm->bathroom_count;
-  fsm_read_unlock(&sanitation_fsm->fsm);
+  do {
+    seq = fsm_read_begin(&sanitation_fsm->fsm);
+    bathroom_count = sanitation_fsm->bathroom_count;
+  } while (fsm_read_retry(&sanitation_fsm->fsm, seq));
 
   return snprintf(buffer, PAGE_SIZE, "%d\n", bathroom_count);
 }
@@ -385,11 +580,13 @@ sanitation_fsm_infected_attr_show(const char *name,
                                   const struct sanitation_fsm_t *sanitation_fsm,
                                   char *buffer)
 {
-  bool infected;
+  bool     infected;
+  unsigned seq;
 
-  fsm_read_lock(&sanitation_fsm->fsm);
-  infected = sanitation_fsm->infected;
-  fsm_read_unlock(&sanitation_fsm->fsm);
+  do {
+    seq = fsm_read_begin(&sanitation_fsm->fsm);
+    infected = sanitation_fsm->infected;
+  } while (fsm_read_retry(&sanitation_fsm->fsm, seq));
 
   return snprintf(buffer, PAGE_SIZE, "%s\n",
                   infected ? "true" : "false");
@@ -11,50 +11,118 @@
 #define _BRAIN__SANITATION_FSM_H_
 
 
+#include <linux/types.h>
+
+#include "utils/random.h"
+
+#include "status/status.h"
+
+#include "fsm/fsm.h"
+
+
+struct brain_t;
+
+
+/// Sanitation FSM type.
+struct sanitation_fsm_t {
+  unsigned int bathroom_count;  /**< Number of times eater went to "bathroom"
+                                 * that were not swept by the user. */
+  bool         infected;        /**< Infection is all around. */
+
+  struct random_stream_t random; /**< Random stream. */
+
+  struct fsm_t fsm;
+};
+
+
+/// Templates of sanitation FSM status attributes (see
+/// brain_status_create()).
+extern const struct status_attr_t sanitation_fsm_status_attrs[];
+
+
+/// Number of items in #sanitation_fsm_status_attrs.
+extern const size_t sanitation_fsm_status_attr_count;
+
+
+/**
+ * Initializes facilities shared by all the sanitation FSMs. Must be called
+ * before any brain is built.
+ *
+ * @return execution status
+ */
+int
+sanitation_fsm_class_init(void);
+
+
+/**
+ * Cleanups facilities shared by all the sanitation FSMs. All the brains must be
+ * destroyed by now.
+ */
+void
+sanitation_fsm_class_cleanup(void);
+
+
 /**
  * Initializes sanitation FSM.
  *
+ * @param brain brain the FSM is part of
  *
  * @return execution status
  */
 int
-sanitation_fsm_init(void);
+sanitation_fsm_init(struct brain_t *brain);
 
 
 /**
  * Cleanups the resources held by sanitation FSM.
  *
+ * @param brain brain the FSM is part of
  */
 void
-sanitation_fsm_cleanup(void);
+sanitation_fsm_cleanup(struct brain_t *brain);
 
 
 /**
  * Says to the sanitation FSM that eater has just eaten.
  *
+ * @param brain eater's brain
+ */
+void
+sanitation_fsm_just_eaten(struct brain_t *brain);
+
+
+/**
+ * Says to the sanitation FSM that eater has just eaten several times. Takes
+ * FSM lock once per #SANITATION_FSM_BATCH_SIZE meals instead of once per
+ * meal.
+ *
+ * @param brain eater's brain
+ * @param count number of meals
  */
 void
-sanitation_fsm_just_eaten(void);
+sanitation_fsm_just_eaten_batch(struct brain_t *brain, size_t count);
 
 
 /**
  * Sweep the "room" entropy eater's living in.
  *
+ * @param brain eater's brain
  *
  * @return execution status
  */
 int
-sanitation_fsm_sweep(void);
+sanitation_fsm_sweep(struct brain_t *brain);
 
 
 /**
  * Disinfect the "room".
  *
+ * @param brain eater's brain
  *
  * @return execution status
  */
 int
-sanitation_fsm_disinfect(void);
+sanitation_fsm_disinfect(struct brain_t *brain);
 
 
 #endif /* _BRAIN__SANITATION_FSM_H_ */
@@ -1,20 +1,34 @@
+#include <linux/jiffies.h>
+#include <linux/err.h>
+
 #include "fsm/fsm.h"
+#include "fsm/clock.h"
+#include "fsm/stats.h"
 
 #include "utils/assert.h"
 #include "utils/random.h"
 
+#include "brain/brain.h"
 #include "brain/params.h"
 #include "brain/utils.h"
 #include "brain/social_fsm.h"
 #include "brain/living_fsm.h"
 
 
+/// X-macro list of social FSM events.
+#define SOCIAL_EVENTS(X)                                                \
+  /* Applies demotions elapsed so far. Emitted by the state timeout   \
+   * when the eater is about to die of depression. */                   \
+  X(SOCIAL_EVENT_REVISE_STATE)                                          \
+  /* Emitted when user wants to play in rock-paper-scissors. */         \
+  X(SOCIAL_EVENT_PLAY_RPS)                                              \
+  /* Emitted when user wants to play several games at once. */          \
+  X(SOCIAL_EVENT_PLAY_RPS_BATCH)
+
+
 /// Social FSM events.
 enum social_event_t {
-  SOCIAL_EVENT_REVISE_STATE,    /**< Emitted when it's time to become less
-                                 * happy. */
-  SOCIAL_EVENT_PLAY_RPS,        /**< Emitted when user wants to play in
-                                 * rock-paper-scissors. */
+  SOCIAL_EVENTS(FSM_ENUM_ITEM)
   __SOCIAL_EVENT_LAST
 };
 
@@ -22,30 +36,20 @@ enum social_event_t {
 #define SOCIAL_EVENTS_COUNT __SOCIAL_EVENT_LAST
 
 
-/// Checks that event is valid.
-#define ASSERT_VALID_EVENT(event) \
-  ASSERT_IN_RANGE(event, 0, SOCIAL_EVENTS_COUNT - 1)
-
+FSM_DEFINE_TO_STR(social_event_to_str, enum social_event_t,
+                  SOCIAL_EVENTS, SOCIAL_EVENTS_COUNT)
 
-static inline const char *
-social_event_to_str(enum social_event_t event)
-{
-  static const char *strs[] = {
-    "SOCIAL_EVENT_REVISE_STATE",
-    "SOCIAL_EVENT_PLAY_RPS",
-  };
 
-  ASSERT_VALID_EVENT(event);
-
-  return strs[event];
-}
+/// X-macro list of social FSM states.
+#define SOCIAL_STATES(X)                        \
+  X(SOCIAL_STATE_NORMAL)                        \
+  X(SOCIAL_STATE_HAPPY)                         \
+  X(SOCIAL_STATE_DEPRESSED)
 
 
 /// Social FSM states.
 enum social_state_t {
-  SOCIAL_STATE_NORMAL,
-  SOCIAL_STATE_HAPPY,
-  SOCIAL_STATE_DEPRESSED,
+  SOCIAL_STATES(FSM_ENUM_ITEM)
   __SOCIAL_STATE_LAST
 };
 
@@ -53,35 +57,15 @@ enum social_state_t {
 #define SOCIAL_STATES_COUNT __SOCIAL_STATE_LAST
 
 
-/// Checks that state is valid.
-#define ASSERT_VALID_STATE(state) \
-  ASSERT_IN_RANGE(state, 0, SOCIAL_STATES_COUNT - 1)
-
-
-static inline const char *
-social_state_to_str(enum social_state_t state)
-{
-  static const char *strs[] = {
-    "SOCIAL_STATE_NORMAL",
-    "SOCIAL_STATE_HAPPY",
-    "SOCIAL_STATE_DEPRESSED",
-  };
-
-  ASSERT_VALID_STATE(state);
-
-  return strs[state];
-}
+FSM_DEFINE_TO_STR(social_state_to_str, enum social_state_t,
+                  SOCIAL_STATES, SOCIAL_STATES_COUNT)
 
 
-struct social_fsm_t {
-  int rps_count;
-
-  struct fsm_t fsm;
-};
-
-
-/// Social FSM.
-static struct social_fsm_t social_fsm;
+/// Exports FSM state via sysfs.
+static ssize_t
+social_fsm_state_attr_show(const char *name,
+                           const struct social_fsm_t *social_fsm,
+                           char *buffer);
 
 
 /// Exports rps_count via sysfs.
@@ -91,14 +75,21 @@ social_fsm_rps_count_attr_show(const char *name,
                                char *buffer);
 
 
-/// Sysfs attributes.
-static struct status_attr_t social_fsm_attrs[] = {
+const struct status_attr_t social_fsm_status_attrs[] = {
+  STATUS_ATTR(social_fsm_state,
+              (status_attr_show_t) social_fsm_state_attr_show,
+              BRAIN_STATUS_DATA(social)),
+  FSM_STATS_ATTR(social_fsm_stats, BRAIN_STATUS_DATA(social.fsm)),
   STATUS_ATTR(rps_count,
               (status_attr_show_t) social_fsm_rps_count_attr_show,
-              &social_fsm),
+              BRAIN_STATUS_DATA(social)),
 };
 
 
+const size_t social_fsm_status_attr_count =
+  ARRAY_SIZE(social_fsm_status_attrs);
+
+
 /// Handles #SOCIAL_EVENT_REVISE_STATE event.
 static int
 social_fsm_revise_state_handler(enum social_state_t state,
@@ -118,6 +109,22 @@ social_fsm_play_rps_handler(enum social_state_t state,
                             struct social_event_play_rps_data_t *play_rps_data);
 
 
+/// Data for #SOCIAL_EVENT_PLAY_RPS_BATCH event.
+struct social_event_rps_batch_data_t {
+  const u8   *signs;            /**< User's signs. */
+  u8         *results;          /**< Results of the games. */
+  size_t      count;            /**< Number of games. */
+  const char *state;            /**< State after the games. */
+};
+
+
+/// Handles #SOCIAL_EVENT_PLAY_RPS_BATCH event.
+static int
+social_fsm_play_rps_batch_handler(enum social_state_t state,
+                                  struct social_fsm_t *social_fsm,
+                                  struct social_event_rps_batch_data_t *data);
+
+
 struct fsm_event_handler_t social_fsm_handlers[SOCIAL_EVENTS_COUNT] = {
   EVENT_NO_DATA (
     SOCIAL_EVENT_REVISE_STATE,
@@ -127,131 +134,399 @@ struct fsm_event_handler_t social_fsm_handlers[SOCIAL_EVENTS_COUNT] = {
     SOCIAL_EVENT_PLAY_RPS,
     (fsm_event_handler_t)         social_fsm_play_rps_handler
   ),
+  EVENT         (
+    SOCIAL_EVENT_PLAY_RPS_BATCH,
+    (fsm_event_handler_t)         social_fsm_play_rps_batch_handler
+  ),
+};
+
+
+/// Returns time left till the eater dies of depression if nobody plays with
+/// it.
+static unsigned long
+social_fsm_demotion_timeout(enum social_state_t state,
+                            const struct social_fsm_t *social_fsm);
+
+
+/// Social FSM state timeouts. Initial state is not armed, so eater does not
+/// get less happy until the first game.
+static const struct fsm_state_timeout_t
+social_fsm_timeouts[SOCIAL_STATES_COUNT] = {
+  [SOCIAL_STATE_NORMAL]    = { .event = SOCIAL_EVENT_REVISE_STATE,
+                               .delay = (fsm_timeout_delay_fn_t)
+                                        social_fsm_demotion_timeout },
+  [SOCIAL_STATE_HAPPY]     = { .event = SOCIAL_EVENT_REVISE_STATE,
+                               .delay = (fsm_timeout_delay_fn_t)
+                                        social_fsm_demotion_timeout },
+  [SOCIAL_STATE_DEPRESSED] = { .event = SOCIAL_EVENT_REVISE_STATE,
+                               .delay = (fsm_timeout_delay_fn_t)
+                                        social_fsm_demotion_timeout },
 };
 
 
 /**
  * Performs actual play in RPS.
  *
- * @param user_sign user's choice
+ * @param social_fsm social FSM
+ * @param user_sign  user's choice
  */
 static void
-social_fsm_do_play_rps(enum rps_sign_t user_sign);
+social_fsm_do_play_rps(struct social_fsm_t *social_fsm,
+                       enum rps_sign_t user_sign);
 
 
-int
-social_fsm_init(void)
+/**
+ * Accounts one more game and makes the eater happier if it has played
+ * enough.
+ *
+ * @param state      current state
+ * @param social_fsm social FSM
+ * @param params     parameters
+ *
+ * @return new state
+ */
+static enum social_state_t
+social_fsm_promote(enum social_state_t state,
+                   struct social_fsm_t *social_fsm,
+                   const struct brain_params_t *params);
+
+
+/// Makes the next demotion happen a whole period after now. Called when
+/// user plays with the eater.
+static void
+social_fsm_postpone_demotion(struct social_fsm_t *social_fsm,
+                             const struct brain_params_t *params);
+
+
+/// Social FSM timer slacks.
+static const unsigned long
+social_fsm_slacks[SOCIAL_EVENTS_COUNT] = {
+  [SOCIAL_EVENT_REVISE_STATE] = EATER_TIMER_SLACK,
+};
+
+
+/// Social FSM data saved in snapshots.
+struct social_fsm_snapshot_t {
+  s32 rps_count;                /**< See #social_fsm_t. */
+  u32 last_revision;            /**< Time passed since the last revision
+                                 * (virtual ms). */
+  u32 demotion_period;          /**< See #social_fsm_t (virtual ms). */
+} __attribute__((packed));
+
+
+/// Saves social FSM data into snapshot.
+static void
+social_fsm_save(const struct social_fsm_t *social_fsm,
+                struct social_fsm_snapshot_t *snapshot)
 {
-  int ret;
+  snapshot->rps_count       = social_fsm->rps_count;
+  snapshot->last_revision   =
+    jiffies_to_msecs(fsm_clock_now() - social_fsm->last_revision);
+  snapshot->demotion_period = jiffies_to_msecs(social_fsm->demotion_period);
+}
 
-  social_fsm.rps_count = 0;
 
-  ret = fsm_init(&social_fsm.fsm, "social_fsm",
-                 SOCIAL_STATES_COUNT, SOCIAL_EVENTS_COUNT,
-                 (fsm_state_show_fn_t) social_state_to_str,
-                 (fsm_event_show_fn_t) social_event_to_str,
-                 &social_fsm, social_fsm_handlers);
-  if (ret != 0) {
-    return ret;
-  }
+/// Loads social FSM data from snapshot.
+static void
+social_fsm_load(struct social_fsm_t *social_fsm,
+                const struct social_fsm_snapshot_t *snapshot)
+{
+  social_fsm->rps_count       = snapshot->rps_count;
+  social_fsm->last_revision   =
+    fsm_clock_now() - msecs_to_jiffies(snapshot->last_revision);
+  social_fsm->demotion_period = msecs_to_jiffies(snapshot->demotion_period);
+}
 
-  ret = status_create_files(social_fsm_attrs, ARRAY_SIZE(social_fsm_attrs));
-  if (ret != 0) {
-    TRACE_ERR("Failed to create social FSM sysfs attributes: %d", ret);
-    goto error;
-  }
 
-  return 0;
+/// Returns identifier of the eater the FSM belongs to.
+static u32
+social_fsm_instance(const struct social_fsm_t *social_fsm)
+{
+  return brain_of(social_fsm, social)->id;
+}
+
 
-error:
-  fsm_cleanup(&social_fsm.fsm);
-  return ret;
+/// Social FSM statistics.
+FSM_DEFINE_STATS(social_fsm_stats);
+
+
+/// Social FSM class.
+static const struct fsm_class_t social_fsm_class = {
+  .name          = "social_fsm",
+  .state_count   = SOCIAL_STATES_COUNT,
+  .event_count   = SOCIAL_EVENTS_COUNT,
+  .show_state    = (fsm_state_show_fn_t) social_state_to_str,
+  .show_event    = (fsm_event_show_fn_t) social_event_to_str,
+  .data_offset   = offsetof(struct social_fsm_t, fsm),
+  .handlers      = social_fsm_handlers,
+  .transitions   = NULL,
+  .timeouts      = social_fsm_timeouts,
+  .guards        = NULL,
+  .slacks        = social_fsm_slacks,
+  .stats         = &social_fsm_stats,
+  .instance      = (u32 (*)(const void *)) social_fsm_instance,
+  .snapshot_size = sizeof(struct social_fsm_snapshot_t),
+  .save          = (void (*)(const void *, void *)) social_fsm_save,
+  .validate      = NULL,
+  .load          = (void (*)(void *, const void *)) social_fsm_load,
+};
+
+
+int
+social_fsm_class_init(void)
+{
+  return fsm_class_init(&social_fsm_class);
 }
 
 
 void
-social_fsm_cleanup(void)
+social_fsm_class_cleanup(void)
 {
-  status_remove_files(social_fsm_attrs, ARRAY_SIZE(social_fsm_attrs));
-  fsm_cleanup(&social_fsm.fsm);
+  fsm_class_cleanup(&social_fsm_class);
+}
+
+
+int
+social_fsm_init(struct brain_t *brain)
+{
+  struct social_fsm_t *social_fsm = &brain->social;
+
+  social_fsm->rps_count       = 0;
+  social_fsm->last_revision   = fsm_clock_now();
+  social_fsm->demotion_period = 0;
+  brain_random_init(brain, &social_fsm->random, BRAIN_STREAM_SOCIAL);
+
+  return fsm_init(&social_fsm->fsm, &social_fsm_class);
 }
 
 
 void
-social_fsm_play_rps(enum rps_sign_t user_sign)
+social_fsm_cleanup(struct brain_t *brain)
 {
-  int ret;
+  fsm_cleanup(&brain->social.fsm);
+}
+
 
+int
+social_fsm_play_rps(struct brain_t *brain, enum rps_sign_t user_sign)
+{
   struct social_event_play_rps_data_t data = {
     .user_sign = user_sign,
   };
 
-  ret = fsm_emit(&social_fsm.fsm, SOCIAL_EVENT_PLAY_RPS, &data);
-  ASSERT( ret == 0 );
+  return fsm_emit(&brain->social.fsm, SOCIAL_EVENT_PLAY_RPS, &data);
 }
 
 
-static int
-social_fsm_revise_state_handler(enum social_state_t state,
-                                struct social_fsm_t *social_fsm)
+const char *
+social_fsm_play_rps_batch(struct brain_t *brain,
+                          const u8 *signs, u8 *results, size_t count)
 {
   int ret;
-  enum social_state_t new_state;
 
+  struct social_event_rps_batch_data_t data = {
+    .signs   = signs,
+    .results = results,
+    .count   = count,
+  };
+
+  ret = fsm_emit(&brain->social.fsm, SOCIAL_EVENT_PLAY_RPS_BATCH, &data);
+  if (ret != 0) {
+    return ERR_PTR(ret);
+  }
+
+  return data.state;
+}
+
+
+/**
+ * Returns number of demotions after which the eater dies of depression.
+ *
+ * @param state current state
+ *
+ * @return number of demotions
+ */
+static unsigned long
+social_fsm_demotions_left(enum social_state_t state)
+{
   switch (state) {
   case SOCIAL_STATE_HAPPY:
-    new_state = SOCIAL_STATE_NORMAL;
-    break;
+    return 3;
   case SOCIAL_STATE_NORMAL:
-    new_state = SOCIAL_STATE_DEPRESSED;
-    break;
+    return 2;
   case SOCIAL_STATE_DEPRESSED:
-    brain_msg("Depression killed me.");
-    living_fsm_die();
-    break;
+    return 1;
   default:
     ASSERT( !"impossible happened" );
-    new_state = SOCIAL_STATE_DEPRESSED;
+    return 1;
   }
+}
 
 
-  ret = fsm_postpone_event(&social_fsm->fsm,
-                           SOCIAL_EVENT_REVISE_STATE,
-                           EATER_SOCIAL_STATE_DEMOTION_TIME);
-  if (ret != 0) {
-    return ret;
+/**
+ * Returns the state the eater gets into after a demotion.
+ *
+ * @param state current state
+ *
+ * @return new state
+ */
+static enum social_state_t
+social_state_demoted(enum social_state_t state)
+{
+  switch (state) {
+  case SOCIAL_STATE_HAPPY:
+    return SOCIAL_STATE_NORMAL;
+  case SOCIAL_STATE_NORMAL:
+  case SOCIAL_STATE_DEPRESSED:
+    return SOCIAL_STATE_DEPRESSED;
+  default:
+    ASSERT( !"impossible happened" );
+    return SOCIAL_STATE_DEPRESSED;
   }
+}
 
-  return new_state;
+
+/**
+ * Returns number of demotions elapsed since the last revision.
+ *
+ * @param last_revision   time of the last revision
+ * @param demotion_period period between demotions; 0 if disabled
+ * @param now             current virtual time
+ *
+ * @return number of demotions
+ */
+static unsigned long
+social_demotions_due(unsigned long last_revision,
+                     unsigned long demotion_period, unsigned long now)
+{
+  if (demotion_period == 0) {
+    return 0;
+  }
+
+  return (now - last_revision) / demotion_period;
 }
 
 
+/**
+ * Makes the eater less happy.
+ *
+ * @param state      current state
+ * @param social_fsm social FSM
+ *
+ * @return new state or error code
+ */
 static int
-social_fsm_play_rps_handler(enum social_state_t state,
-                            struct social_fsm_t *social_fsm,
-                            struct social_event_play_rps_data_t *play_rps_data)
+social_fsm_demote(enum social_state_t state,
+                  struct social_fsm_t *social_fsm)
 {
   int ret;
-  enum social_state_t new_state;
 
-  social_fsm_do_play_rps(play_rps_data->user_sign);
+  if (state == SOCIAL_STATE_DEPRESSED) {
+    ret = living_fsm_die(brain_of(social_fsm, social), &social_fsm->fsm);
+    if (ret != 0) {
+      return ret;
+    }
 
-  fsm_cancel_postponed_events_by_type(&social_fsm->fsm,
-                                      SOCIAL_EVENT_REVISE_STATE);
-  ret = fsm_postpone_event(&social_fsm->fsm,
-                           SOCIAL_EVENT_REVISE_STATE,
-                           EATER_SOCIAL_STATE_DEMOTION_TIME);
-  if (ret != 0) {
-    return ret;
+    brain_msg("Depression killed me.");
   }
 
+  return social_state_demoted(state);
+}
+
+
+/**
+ * Applies all the demotions elapsed since the last revision. Must be called
+ * by every handler before looking at the state. Nothing is changed on
+ * failure, so the demotions are applied again by the next event.
+ *
+ * @param state      current state
+ * @param social_fsm social FSM
+ *
+ * @return new state or error code
+ */
+static int
+social_fsm_catch_up(enum social_state_t state,
+                    struct social_fsm_t *social_fsm)
+{
+  int           ret = state;
+  unsigned long due;
+  unsigned long count;
+  unsigned long i;
+
+  due = social_demotions_due(social_fsm->last_revision,
+                             social_fsm->demotion_period, fsm_clock_now());
+
+  count = min(due, social_fsm_demotions_left(state));
+  for (i = 0; i < count; ++i) {
+    ret = social_fsm_demote(ret, social_fsm);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  social_fsm->last_revision += due * social_fsm->demotion_period;
+
+  return ret;
+}
+
+
+static unsigned long
+social_fsm_demotion_timeout(enum social_state_t state,
+                            const struct social_fsm_t *social_fsm)
+{
+  unsigned long now = fsm_clock_now();
+  unsigned long death;
+
+  if (social_fsm->demotion_period == 0) {
+    /* not reachable through the state machine since initial state is not
+     * armed and the period is drawn by the first game */
+    return MAX_JIFFY_OFFSET;
+  }
+
+  death = social_fsm->last_revision +
+    social_fsm_demotions_left(state) * social_fsm->demotion_period;
+
+  return time_after(death, now) ? death - now : 0;
+}
+
+
+static int
+social_fsm_revise_state_handler(enum social_state_t state,
+                                struct social_fsm_t *social_fsm)
+{
+  return social_fsm_catch_up(state, social_fsm);
+}
+
+
+static void
+social_fsm_postpone_demotion(struct social_fsm_t *social_fsm,
+                             const struct brain_params_t *params)
+{
+  social_fsm->last_revision   = fsm_clock_now();
+  social_fsm->demotion_period =
+    EATER_SOCIAL_STATE_DEMOTION_TIME(params, &social_fsm->random);
+  fsm_restart_state_timeout(&social_fsm->fsm);
+}
+
+
+static enum social_state_t
+social_fsm_promote(enum social_state_t state,
+                   struct social_fsm_t *social_fsm,
+                   const struct brain_params_t *params)
+{
+  enum social_state_t new_state;
+
+  int promote = EATER_RPS_COUNT_SOCIAL_STATE_PROMOTE(params);
+
   social_fsm->rps_count += 1;
-  if (social_fsm->rps_count == EATER_RPS_COUNT_SOCIAL_STATE_PROMOTE)
+
+  /* the limit may have been lowered at runtime */
+  if (social_fsm->rps_count >= promote)
   {
     switch (state) {
     case SOCIAL_STATE_HAPPY:
       new_state = SOCIAL_STATE_HAPPY;
-      social_fsm->rps_count = EATER_RPS_COUNT_SOCIAL_STATE_PROMOTE;
+      social_fsm->rps_count = promote;
       break;
     case SOCIAL_STATE_NORMAL:
       new_state = SOCIAL_STATE_HAPPY;
@@ -275,25 +550,142 @@ social_fsm_play_rps_handler(enum social_state_t state,
 }
 
 
+static int
+social_fsm_play_rps_handler(enum social_state_t state,
+                            struct social_fsm_t *social_fsm,
+                            struct social_event_play_rps_data_t *play_rps_data)
+{
+  int ret;
+
+  const struct brain_params_t *params;
+
+  ret = social_fsm_catch_up(state, social_fsm);
+  if (ret < 0) {
+    return ret;
+  }
+
+  state = ret;
+
+  social_fsm_do_play_rps(social_fsm, play_rps_data->user_sign);
+
+  params = brain_params_read_lock();
+
+  /* playing postpones demotion even if the state does not change */
+  social_fsm_postpone_demotion(social_fsm, params);
+  state = social_fsm_promote(state, social_fsm, params);
+
+  brain_params_read_unlock();
+
+  return state;
+}
+
+
+static int
+social_fsm_play_rps_batch_handler(enum social_state_t state,
+                                  struct social_fsm_t *social_fsm,
+                                  struct social_event_rps_batch_data_t *data)
+{
+  size_t          i;
+  size_t          won = 0;
+  size_t          lost = 0;
+  int             ret;
+  enum rps_sign_t eater_sign;
+
+  const struct brain_params_t *params;
+
+  ret = social_fsm_catch_up(state, social_fsm);
+  if (ret < 0) {
+    return ret;
+  }
+
+  state = ret;
+
+  params = brain_params_read_lock();
+
+  for (i = 0; i < data->count; ++i) {
+    eater_sign = random_stream_range(&social_fsm->random, RPS_SIGNS_COUNT);
+
+    data->results[i] = rps_get_winner(data->signs[i], eater_sign);
+    switch (data->results[i]) {
+    case RPS_WINNER_FIRST:
+      ++won;
+      break;
+    case RPS_WINNER_SECOND:
+      ++lost;
+      break;
+    }
+
+    state = social_fsm_promote(state, social_fsm, params);
+  }
+
+  brain_msg("we played %zu games: you won %zu, I won %zu, %zu draws",
+            data->count, won, lost, data->count - won - lost);
+
+  /* the timer is updated once for the whole batch */
+  social_fsm_postpone_demotion(social_fsm, params);
+
+  brain_params_read_unlock();
+
+  data->state = social_state_to_str(state);
+
+  return state;
+}
+
+
+static ssize_t
+social_fsm_state_attr_show(const char *name,
+                           const struct social_fsm_t *social_fsm,
+                           char *buffer)
+{
+  enum social_state_t state;
+  unsigned long       last_revision;
+  unsigned long       demotion_period;
+  unsigned long       count;
+  unsigned            seq;
+
+  do {
+    seq             = fsm_read_begin(&social_fsm->fsm);
+    state           = social_fsm->fsm.state;
+    last_revision   = social_fsm->last_revision;
+    demotion_period = social_fsm->demotion_period;
+  } while (fsm_read_retry(&social_fsm->fsm, seq));
+
+  /* show demotions elapsed so far without applying them: that's left to
+   * events and the state timeout */
+  count = min(social_demotions_due(last_revision, demotion_period,
+                                   fsm_clock_now()),
+              social_fsm_demotions_left(state));
+  while (count-- > 0) {
+    state = social_state_demoted(state);
+  }
+
+  return snprintf(buffer, PAGE_SIZE, "%s\n", social_state_to_str(state));
+}
+
+
 static ssize_t
 social_fsm_rps_count_attr_show(const char *name,
                                const struct social_fsm_t *social_fsm,
                                char *buffer)
 {
-  int rps_count;
+  int      rps_count;
+  unsigned seq;
 
-  fsm_read_lock(&social_fsm->fsm);
-  rps_count = social_fsm->rps_count;
-  fsm_read_unlock(&social_fsm->fsm);
+  do {
+    seq = fsm_read_begin(&social_fsm->fsm);
+    rps_count = social_fsm->rps_count;
+  } while (fsm_read_retry(&social_fsm->fsm, seq));
 
   return snprintf(buffer, PAGE_SIZE, "%d\n", rps_count);
 }
 
 
 static void
-social_fsm_do_play_rps(enum rps_sign_t user_sign)
+social_fsm_do_play_rps(struct social_fsm_t *social_fsm,
+                       enum rps_sign_t user_sign)
 {
-  enum rps_sign_t   eater_sign = get_random_u8() % RPS_SIGNS_COUNT;
+  enum rps_sign_t   eater_sign =
+    random_stream_range(&social_fsm->random, RPS_SIGNS_COUNT);
 
   brain_msg("your choice: %s", rps_sign_to_str(user_sign));
   brain_msg("my choice:   %s", rps_sign_to_str(eater_sign));
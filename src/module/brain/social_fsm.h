@@ -12,35 +12,112 @@
 #define _SOCIAL_FSM_H_
 
 
+#include <linux/types.h>
+
 #include "utils/rps.h"
+#include "utils/random.h"
+
+#include "status/status.h"
+
+#include "fsm/fsm.h"
+
+
+struct brain_t;
+
+
+/// Social FSM type. Demotions are not ticked by timers: the ones that have
+/// elapsed are applied in bulk by social_fsm_catch_up() whenever FSM gets an
+/// event. The only timer is armed for the time the eater would die of
+/// depression.
+struct social_fsm_t {
+  int rps_count;
+
+  unsigned long last_revision;   /**< Time demotions are counted from
+                                  * (virtual jiffies). */
+  unsigned long demotion_period; /**< Period between demotions; zero until
+                                  * the first game. */
+
+  struct random_stream_t random; /**< Random stream. */
+
+  struct fsm_t fsm;
+};
+
+
+/// Templates of social FSM status attributes (see brain_status_create()).
+extern const struct status_attr_t social_fsm_status_attrs[];
+
+
+/// Number of items in #social_fsm_status_attrs.
+extern const size_t social_fsm_status_attr_count;
+
+
+/**
+ * Initializes facilities shared by all the social FSMs. Must be called before
+ * any brain is built.
+ *
+ * @return execution status
+ */
+int
+social_fsm_class_init(void);
+
+
+/**
+ * Cleanups facilities shared by all the social FSMs. All the brains must be
+ * destroyed by now.
+ */
+void
+social_fsm_class_cleanup(void);
 
 
 /**
  * Initializes social FSM.
  *
+ * @param brain brain the FSM is part of
  *
  * @retval  0 FSM initialized successfully
  * @retval <0 error occurred
  */
 int
-social_fsm_init(void);
+social_fsm_init(struct brain_t *brain);
 
 
 /**
  * Cleanups the resources held by social FSM.
  *
+ * @param brain brain the FSM is part of
  */
 void
-social_fsm_cleanup(void);
+social_fsm_cleanup(struct brain_t *brain);
 
 
 /**
  * Models playing in rock-paper-scissors game.
  *
+ * @param brain     eater's brain
  * @param user_sign the sign chosen by user
+ *
+ * @return execution status
  */
-void
-social_fsm_play_rps(enum rps_sign_t user_sign);
+int
+social_fsm_play_rps(struct brain_t *brain, enum rps_sign_t user_sign);
+
+
+/**
+ * Plays several games of rock-paper-scissors in a single transaction.
+ * Demotion timer is updated only once for the whole batch.
+ *
+ * @param brain   eater's brain
+ * @param signs   signs chosen by user; must be valid #rps_sign_t values
+ * @param results buffer for #rps_result_t results of the games (user is
+ *                the first player)
+ * @param count   number of games
+ *
+ * @return name of social state after the games or ERR_PTR() if the games
+ *         could not be played
+ */
+const char *
+social_fsm_play_rps_batch(struct brain_t *brain,
+                          const u8 *signs, u8 *results, size_t count);
 
 
 #endif /* _SOCIAL_FSM_H_ */
@@ -13,6 +13,8 @@
 
 #include <linux/kernel.h>
 
+#include "utils/random.h"
+
 
 /**
  * Prints message from entropy eater's brain.
@@ -23,4 +25,35 @@
   printk(KERN_ALERT "Entropy eater: " format "\n", ##__VA_ARGS__)
 
 
+/// Identifiers of random streams of brain's FSMs. Every FSM draws from its
+/// own stream, so that the values it gets don't depend on the order other
+/// FSMs draw theirs in.
+enum brain_stream_t {
+  BRAIN_STREAM_LIVING,
+  BRAIN_STREAM_SANITATION,
+  BRAIN_STREAM_FEEDING,
+  BRAIN_STREAM_SOCIAL,
+  __BRAIN_STREAM_LAST
+};
+
+
+#define BRAIN_STREAMS_COUNT __BRAIN_STREAM_LAST
+
+
+struct brain_t;
+
+
+/**
+ * Initializes FSM's random stream. The stream is deterministic if 'seed'
+ * module parameter is set; streams of different eaters are independent.
+ *
+ * @param brain  brain the FSM is part of
+ * @param stream stream to initialize
+ * @param id     stream identifier
+ */
+void
+brain_random_init(const struct brain_t *brain,
+                  struct random_stream_t *stream, enum brain_stream_t id);
+
+
 #endif /* _BRAIN__UTILS_H_ */
@@ -28,6 +28,15 @@ enum eater_attr_t {
   EATER_ATTR_NONE,              /**< For calls with no arguments. */
   EATER_ATTR_FOOD,              /**< "Food" for entropy eater. */
   EATER_ATTR_RPS_SIGN,          /**< Rock-paper-scissors sign. */
+  EATER_ATTR_SNAPSHOT,          /**< Opaque snapshot of eater's brain. */
+  EATER_ATTR_RPS_SIGNS,         /**< Array of rock-paper-scissors signs, one
+                                 * byte per game. */
+  EATER_ATTR_RPS_RESULTS,       /**< Array of #rps_result_t results, one byte
+                                 * per game; user is the first player. */
+  EATER_ATTR_SOCIAL_STATE,      /**< Name of eater's social state. */
+  EATER_ATTR_ID,                /**< Identifier of the eater the command is
+                                 * addressed to; commands without it are
+                                 * addressed to #EATER_ID_DEFAULT. */
   __EATER_ATTR_MAX,
 };
 
@@ -36,15 +45,70 @@ enum eater_attr_t {
 #define EATER_ATTR_MAX (__EATER_ATTR_MAX - 1)
 
 
+/// Identifier of the eater that exists from the module load till unload.
+#define EATER_ID_DEFAULT 0
+
+
+/// Maximum number of #EATER_ATTR_FOOD attributes in a single
+/// #EATER_CMD_FEED message.
+#define EATER_FEED_PORTIONS_MAX 32
+
+
+/// Maximum size of #EATER_ATTR_SNAPSHOT attribute. Snapshot is sent in a
+/// single message that must fit into a page-sized receive buffer. Pending
+/// events are stored as one record per event type, so snapshots stay well
+/// below the limit however many of them are pending.
+#define EATER_SNAPSHOT_SIZE_MAX 3072
+
+
+/// Maximum number of games in a single #EATER_CMD_PLAY_RPS_BATCH
+/// message. Results are sent in a single message that must fit into a
+/// page-sized receive buffer.
+#define EATER_RPS_BATCH_MAX 2048
+
+
+/// Maximum size of #EATER_ATTR_SOCIAL_STATE attribute including
+/// terminating null character.
+#define EATER_SOCIAL_STATE_SIZE_MAX 32
+
+
 /// Commands that are supported by entropy eater.
 enum eater_cmd_t {
   EATER_CMD_HELLO,                /**< Says hello to entropy eater. */
-  EATER_CMD_FEED,                 /**< Feeds entropy eater with data. */
+  EATER_CMD_FEED,                 /**< Feeds entropy eater with data. One
+                                   * or more #EATER_ATTR_FOOD attributes
+                                   * are accepted. */
   EATER_CMD_SWEEP,                /**< Sweeps entropy eater's room. */
   EATER_CMD_DISINFECT,            /**< Disinfects entropy eater's room. */
   EATER_CMD_CURE,                 /**< Cure entropy eater. */
   EATER_CMD_PLAY_RPS,             /**< Play in rock-paper-scissors with
                                    * eater. */
+  EATER_CMD_SNAPSHOT,             /**< Saves the state of eater's brain.
+                                   * The reply carries #EATER_ATTR_SNAPSHOT
+                                   * attribute that can be passed back
+                                   * with #EATER_CMD_RESTORE after the
+                                   * module has been reloaded. */
+  EATER_CMD_RESTORE,              /**< Restores the state of eater's brain
+                                   * from #EATER_ATTR_SNAPSHOT
+                                   * attribute. */
+  EATER_CMD_PLAY_RPS_BATCH,       /**< Plays several games of
+                                   * rock-paper-scissors at once. Signs
+                                   * are passed in #EATER_ATTR_RPS_SIGNS
+                                   * attribute. The reply carries
+                                   * #EATER_ATTR_RPS_RESULTS and
+                                   * #EATER_ATTR_SOCIAL_STATE attributes
+                                   * describing the games and the state
+                                   * after them. */
+  EATER_CMD_CREATE,               /**< Creates the eater the command is
+                                   * addressed to. Fails with EEXIST if
+                                   * it exists already. */
+  EATER_CMD_DESTROY,              /**< Destroys the eater the command is
+                                   * addressed to. The default eater
+                                   * can't be destroyed. */
+  EATER_CMD_EXPORT_STATUS,        /**< Exports status of the eater the
+                                   * command is addressed to via sysfs
+                                   * instead of the one exported so
+                                   * far. */
   __EATER_CMD_MAX
 };
 
@@ -3,8 +3,10 @@
 
 #include "utils/trace.h"
 #include "status/status.h"
+#include "fsm/timer.h"
+#include "fsm/journal.h"
 #include "brain/brain.h"
-#include "brain/living_fsm.h"
+#include "brain/herd.h"
 
 #include "eater_server.h"
 
@@ -13,35 +15,55 @@ int __init eater_init(void)
 {
   int ret;
 
-  ret = eater_server_register();
+  ret = status_create();
   if (ret != 0) {
-    TRACE_ERR("Cannot register entropy eater server");
     return ret;
   }
 
-  ret = status_create();
+  ret = fsm_timers_init();
   if (ret != 0) {
-    goto error_server_unregister;
+    goto error_status_remove;
+  }
+
+  ret = fsm_journal_init();
+  if (ret != 0) {
+    goto error_timers_cleanup;
   }
 
   ret = brain_init();
   if (ret != 0) {
     TRACE_ERR("Cannot initialize entropy eater's brain. "
               "It's a pain to live without a brain.");
-    goto error_status_remove;
+    goto error_journal_cleanup;
+  }
+
+  ret = herd_init();
+  if (ret != 0) {
+    TRACE_ERR("Cannot create the default entropy eater");
+    goto error_brain_cleanup;
+  }
+
+  /* commands may come as soon as the family is registered, so everything
+   * they use must be ready by now */
+  ret = eater_server_register();
+  if (ret != 0) {
+    TRACE_ERR("Cannot register entropy eater server");
+    goto error_herd_cleanup;
   }
 
   return 0;
 
+error_herd_cleanup:
+  herd_cleanup();
+error_brain_cleanup:
+  brain_cleanup();
+error_journal_cleanup:
+  fsm_journal_cleanup();
+error_timers_cleanup:
+  fsm_timers_cleanup();
 error_status_remove:
   status_remove_all_files();
   status_remove();
-error_server_unregister:
-  ret = eater_server_unregister();
-  if (ret != 0) {
-    TRACE_CRIT("Entropy eater left in inconsistent state because of "
-               "unrecoverable errors");
-  }
 
   return ret;
 }
@@ -56,8 +78,10 @@ void __exit eater_exit(void)
     TRACE_ERR("Cannot unregister entropy eater server");
   }
 
-  living_fsm_die_nobly();
+  herd_cleanup();
   brain_cleanup();
+  fsm_timers_cleanup();
+  fsm_journal_cleanup();
 
   /* removing all the exported files to make life easier for other modules */
   status_remove_all_files();
@@ -1,3 +1,6 @@
+#include <linux/slab.h>
+#include <linux/err.h>
+
 #include "eater_server.h"
 
 #include "utils/trace.h"
@@ -6,13 +9,20 @@
 #include "brain/feeding_fsm.h"
 #include "brain/living_fsm.h"
 #include "brain/social_fsm.h"
+#include "brain/brain.h"
+#include "brain/herd.h"
 
 
 /// Attributes' policies.
 static struct nla_policy eater_attr_policy[] = {
-  [EATER_ATTR_NONE]     = { .type = NLA_UNSPEC, .len = 0 },
-  [EATER_ATTR_FOOD]     = { .type = NLA_BINARY },
-  [EATER_ATTR_RPS_SIGN] = { .type = NLA_U8 }
+  [EATER_ATTR_NONE]      = { .type = NLA_UNSPEC, .len = 0 },
+  [EATER_ATTR_FOOD]      = { .type = NLA_BINARY },
+  [EATER_ATTR_RPS_SIGN]  = { .type = NLA_U8 },
+  [EATER_ATTR_SNAPSHOT]  = { .type = NLA_BINARY,
+                             .len  = EATER_SNAPSHOT_SIZE_MAX },
+  [EATER_ATTR_RPS_SIGNS] = { .type = NLA_BINARY,
+                             .len  = EATER_RPS_BATCH_MAX },
+  [EATER_ATTR_ID]        = { .type = NLA_U32 },
 };
 
 
@@ -75,6 +85,54 @@ static int
 eater_play_rps(struct sk_buff *skb, struct genl_info *info);
 
 
+/**
+ * Implementation for eater_cmd_t::EATER_CMD_SNAPSHOT
+ *
+ */
+static int
+eater_snapshot(struct sk_buff *skb, struct genl_info *info);
+
+
+/**
+ * Implementation for eater_cmd_t::EATER_CMD_RESTORE
+ *
+ */
+static int
+eater_restore(struct sk_buff *skb, struct genl_info *info);
+
+
+/**
+ * Implementation for eater_cmd_t::EATER_CMD_PLAY_RPS_BATCH
+ *
+ */
+static int
+eater_play_rps_batch(struct sk_buff *skb, struct genl_info *info);
+
+
+/**
+ * Implementation for eater_cmd_t::EATER_CMD_CREATE
+ *
+ */
+static int
+eater_create(struct sk_buff *skb, struct genl_info *info);
+
+
+/**
+ * Implementation for eater_cmd_t::EATER_CMD_DESTROY
+ *
+ */
+static int
+eater_destroy(struct sk_buff *skb, struct genl_info *info);
+
+
+/**
+ * Implementation for eater_cmd_t::EATER_CMD_EXPORT_STATUS
+ *
+ */
+static int
+eater_export_status(struct sk_buff *skb, struct genl_info *info);
+
+
 /// Entropy eater commands.
 static struct genl_ops eater_cmds[] = {
   {
@@ -107,6 +165,36 @@ static struct genl_ops eater_cmds[] = {
     .policy = eater_attr_policy,
     .doit   = eater_play_rps,
   },
+  {
+    .cmd    = EATER_CMD_SNAPSHOT,
+    .policy = eater_attr_policy,
+    .doit   = eater_snapshot,
+  },
+  {
+    .cmd    = EATER_CMD_RESTORE,
+    .policy = eater_attr_policy,
+    .doit   = eater_restore,
+  },
+  {
+    .cmd    = EATER_CMD_PLAY_RPS_BATCH,
+    .policy = eater_attr_policy,
+    .doit   = eater_play_rps_batch,
+  },
+  {
+    .cmd    = EATER_CMD_CREATE,
+    .policy = eater_attr_policy,
+    .doit   = eater_create,
+  },
+  {
+    .cmd    = EATER_CMD_DESTROY,
+    .policy = eater_attr_policy,
+    .doit   = eater_destroy,
+  },
+  {
+    .cmd    = EATER_CMD_EXPORT_STATUS,
+    .policy = eater_attr_policy,
+    .doit   = eater_export_status,
+  },
 };
 
 
@@ -141,6 +229,47 @@ eater_server_unregister(void)
 }
 
 
+/**
+ * Returns identifier of the eater the command is addressed to (see
+ * #EATER_ATTR_ID).
+ *
+ * @param info request info
+ *
+ * @return eater identifier
+ */
+static u32
+eater_id(struct genl_info *info)
+{
+  if (!info->attrs[EATER_ATTR_ID]) {
+    return EATER_ID_DEFAULT;
+  }
+
+  return nla_get_u32(info->attrs[EATER_ATTR_ID]);
+}
+
+
+/**
+ * Looks up the eater the command is addressed to.
+ *
+ * @param info request info
+ *
+ * @return brain to be released by herd_put() or ERR_PTR() of error code
+ */
+static struct brain_t *
+eater_brain_get(struct genl_info *info)
+{
+  u32             id = eater_id(info);
+  struct brain_t *brain;
+
+  brain = herd_get(id);
+  if (IS_ERR(brain)) {
+    TRACE_ERR("Failed to get eater %u: %ld", id, PTR_ERR(brain));
+  }
+
+  return brain;
+}
+
+
 static int
 eater_hello(struct sk_buff *skb, struct genl_info *info)
 {
@@ -153,18 +282,42 @@ eater_hello(struct sk_buff *skb, struct genl_info *info)
 static int
 eater_feed(struct sk_buff *skb, struct genl_info *info)
 {
-  u8    *data;
-  size_t data_length;
+  int             rem;
+  struct nlattr  *attr;
+  struct brain_t *brain;
+
+  size_t                    count = 0;
+  struct feeding_fsm_food_t food[EATER_FEED_PORTIONS_MAX];
+
+  nlmsg_for_each_attr(attr, info->nlhdr,
+                      GENL_HDRLEN + eater_genl_family.hdrsize, rem) {
+    if (nla_type(attr) != EATER_ATTR_FOOD || nla_len(attr) == 0) {
+      continue;
+    }
+
+    if (count == EATER_FEED_PORTIONS_MAX) {
+      TRACE_ERR("Too many EATER_ATTR_FOOD attributes (max %d)",
+                EATER_FEED_PORTIONS_MAX);
+      return -EINVAL;
+    }
+
+    food[count].food  = nla_data(attr);
+    food[count].count = nla_len(attr);
+    ++count;
+  }
 
-  if (!info->attrs[EATER_ATTR_FOOD]) {
+  if (count == 0) {
     TRACE_ERR("EATER_ATTR_FOOD attribute not found");
     return -EINVAL;
   }
 
-  data        = nla_data(info->attrs[EATER_ATTR_FOOD]);
-  data_length = nla_len(info->attrs[EATER_ATTR_FOOD]);
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
 
-  feeding_fsm_feed(data, data_length);
+  feeding_fsm_feed_batch(brain, food, count);
+  herd_put(brain);
 
   return 0;
 }
@@ -173,27 +326,62 @@ eater_feed(struct sk_buff *skb, struct genl_info *info)
 static int
 eater_sweep(struct sk_buff *skb, struct genl_info *info)
 {
-  return sanitation_fsm_sweep();
+  int             ret;
+  struct brain_t *brain;
+
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  ret = sanitation_fsm_sweep(brain);
+  herd_put(brain);
+
+  return ret;
 }
 
 
 static int
 eater_disinfect(struct sk_buff *skb, struct genl_info *info)
 {
-  return sanitation_fsm_disinfect();
+  int             ret;
+  struct brain_t *brain;
+
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  ret = sanitation_fsm_disinfect(brain);
+  herd_put(brain);
+
+  return ret;
 }
 
 
 static int
 eater_cure(struct sk_buff *skb, struct genl_info *info)
 {
-  return living_fsm_cure_illness();
+  int             ret;
+  struct brain_t *brain;
+
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  ret = living_fsm_cure_illness(brain);
+  herd_put(brain);
+
+  return ret;
 }
 
 static int
 eater_play_rps(struct sk_buff *skb, struct genl_info *info)
 {
-  u8 sign;
+  int             ret;
+  u8              sign;
+  struct brain_t *brain;
 
   if (!info->attrs[EATER_ATTR_RPS_SIGN]) {
     TRACE_ERR("EATER_ATTR_RPS_SIGN attribute not found");
@@ -206,7 +394,206 @@ eater_play_rps(struct sk_buff *skb, struct genl_info *info)
     return -EINVAL;
   }
 
-  social_fsm_play_rps(sign);
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
 
-  return 0;
+  ret = social_fsm_play_rps(brain, sign);
+  herd_put(brain);
+
+  return ret;
+}
+
+
+static int
+eater_snapshot(struct sk_buff *skb, struct genl_info *info)
+{
+  int             ret;
+  size_t          size;
+  size_t          required = 0;
+  void           *snapshot = NULL;
+  void           *header;
+  struct sk_buff *reply;
+  struct brain_t *brain;
+
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  /* brain may change between the calls, so the size is checked again */
+  do {
+    kfree(snapshot);
+
+    size     = required;
+    snapshot = size != 0 ? kmalloc(size, GFP_KERNEL) : NULL;
+    if (size != 0 && snapshot == NULL) {
+      herd_put(brain);
+      return -ENOMEM;
+    }
+
+    required = brain_snapshot(brain, snapshot, size);
+  } while (required > size);
+
+  herd_put(brain);
+
+  if (required > EATER_SNAPSHOT_SIZE_MAX) {
+    TRACE_ERR("Brain snapshot is too large: %zu bytes", required);
+    ret = -E2BIG;
+    goto out;
+  }
+
+  reply = genlmsg_new(nla_total_size(required), GFP_KERNEL);
+  if (reply == NULL) {
+    ret = -ENOMEM;
+    goto out;
+  }
+
+  header = genlmsg_put_reply(reply, info, &eater_genl_family,
+                             0, EATER_CMD_SNAPSHOT);
+  if (header == NULL) {
+    ret = -EMSGSIZE;
+    goto error_free_reply;
+  }
+
+  ret = nla_put(reply, EATER_ATTR_SNAPSHOT, required, snapshot);
+  if (ret != 0) {
+    goto error_free_reply;
+  }
+
+  genlmsg_end(reply, header);
+  ret = genlmsg_reply(reply, info);
+  goto out;
+
+error_free_reply:
+  nlmsg_free(reply);
+out:
+  kfree(snapshot);
+  return ret;
+}
+
+
+static int
+eater_restore(struct sk_buff *skb, struct genl_info *info)
+{
+  int             ret;
+  struct brain_t *brain;
+
+  struct nlattr *attr = info->attrs[EATER_ATTR_SNAPSHOT];
+
+  if (!attr) {
+    TRACE_ERR("EATER_ATTR_SNAPSHOT attribute not found");
+    return -EINVAL;
+  }
+
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  ret = brain_restore(brain, nla_data(attr), nla_len(attr));
+  herd_put(brain);
+
+  return ret;
+}
+
+
+static int
+eater_play_rps_batch(struct sk_buff *skb, struct genl_info *info)
+{
+  int             ret;
+  size_t          i;
+  size_t          count;
+  const u8       *signs;
+  const char     *state;
+  void           *header;
+  struct nlattr  *results;
+  struct sk_buff *reply;
+  struct brain_t *brain;
+
+  struct nlattr *attr = info->attrs[EATER_ATTR_RPS_SIGNS];
+
+  if (!attr || nla_len(attr) == 0) {
+    TRACE_ERR("EATER_ATTR_RPS_SIGNS attribute not found");
+    return -EINVAL;
+  }
+
+  signs = nla_data(attr);
+  count = nla_len(attr);
+
+  for (i = 0; i < count; ++i) {
+    if (signs[i] >= RPS_SIGNS_COUNT) {
+      TRACE_ERR("Too big value %u for the RPS sign", signs[i]);
+      return -EINVAL;
+    }
+  }
+
+  brain = eater_brain_get(info);
+  if (IS_ERR(brain)) {
+    return PTR_ERR(brain);
+  }
+
+  reply = genlmsg_new(nla_total_size(count) +
+                      nla_total_size(EATER_SOCIAL_STATE_SIZE_MAX), GFP_KERNEL);
+  if (reply == NULL) {
+    ret = -ENOMEM;
+    goto out;
+  }
+
+  header = genlmsg_put_reply(reply, info, &eater_genl_family,
+                             0, EATER_CMD_PLAY_RPS_BATCH);
+  if (header == NULL) {
+    ret = -EMSGSIZE;
+    goto error_free_reply;
+  }
+
+  /* results are written right into the reply */
+  results = nla_reserve(reply, EATER_ATTR_RPS_RESULTS, count);
+  if (results == NULL) {
+    ret = -EMSGSIZE;
+    goto error_free_reply;
+  }
+
+  state = social_fsm_play_rps_batch(brain, signs, nla_data(results), count);
+  if (IS_ERR(state)) {
+    ret = PTR_ERR(state);
+    goto error_free_reply;
+  }
+
+  ret = nla_put_string(reply, EATER_ATTR_SOCIAL_STATE, state);
+  if (ret != 0) {
+    goto error_free_reply;
+  }
+
+  genlmsg_end(reply, header);
+  ret = genlmsg_reply(reply, info);
+  goto out;
+
+error_free_reply:
+  nlmsg_free(reply);
+out:
+  herd_put(brain);
+  return ret;
+}
+
+
+static int
+eater_create(struct sk_buff *skb, struct genl_info *info)
+{
+  return herd_create(eater_id(info));
+}
+
+
+static int
+eater_destroy(struct sk_buff *skb, struct genl_info *info)
+{
+  return herd_destroy(eater_id(info));
+}
+
+
+static int
+eater_export_status(struct sk_buff *skb, struct genl_info *info)
+{
+  return herd_export(eater_id(info));
 }
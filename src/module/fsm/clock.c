@@ -0,0 +1,227 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/jiffies.h>
+#include <linux/seqlock.h>
+
+#include "utils/trace.h"
+
+#include "fsm/clock.h"
+#include "fsm/timer.h"
+
+
+/// Maximum allowed time scale. Keeps virtual time from wrapping around too
+/// fast.
+#define FSM_CLOCK_TIME_SCALE_MAX 100000
+
+
+/// Virtual clock. Virtual time is computed as
+/// virt_base + (jiffies - real_base) * scale.
+struct fsm_clock_t {
+  unsigned long real_base;      /**< Real time of the last rebase. */
+  unsigned long virt_base;      /**< Virtual time of the last rebase. */
+  unsigned int  scale;          /**< How many times virtual time runs faster
+                                 * than the real one; 0 if clock is
+                                 * stopped. */
+
+  unsigned long virt_start;     /**< Virtual time the clock started at. */
+  bool          started;        /**< Whether clock has been started. */
+};
+
+
+/// Protects #fsm_clock.
+static DEFINE_SEQLOCK(fsm_clock_lock);
+
+
+/// The only virtual clock.
+static struct fsm_clock_t fsm_clock = {
+  .scale = 1,
+};
+
+
+/**
+ * Computes current virtual time. Clock lock must be held by the caller
+ * (either for reading or for writing).
+ *
+ * @return virtual time
+ */
+static inline unsigned long
+__fsm_clock_now(void)
+{
+  return fsm_clock.virt_base +
+    (jiffies - fsm_clock.real_base) * fsm_clock.scale;
+}
+
+
+void
+fsm_clock_start(void)
+{
+  write_seqlock(&fsm_clock_lock);
+
+  fsm_clock.real_base  = jiffies;
+  fsm_clock.virt_base  = jiffies;
+  fsm_clock.virt_start = jiffies;
+  fsm_clock.started    = true;
+
+  write_sequnlock(&fsm_clock_lock);
+
+  if (fsm_clock.scale != 1) {
+    TRACE_INFO("Virtual time runs %u time(s) faster than real time",
+               fsm_clock.scale);
+  }
+}
+
+
+unsigned long
+fsm_clock_now(void)
+{
+  unsigned long now;
+  unsigned      seq;
+
+  do {
+    seq = read_seqbegin(&fsm_clock_lock);
+    now = __fsm_clock_now();
+  } while (read_seqretry(&fsm_clock_lock, seq));
+
+  return now;
+}
+
+
+unsigned long
+fsm_clock_to_real(unsigned long delay)
+{
+  unsigned int scale = ACCESS_ONCE(fsm_clock.scale);
+
+  if (scale == 0) {
+    return MAX_JIFFY_OFFSET;
+  }
+
+  return DIV_ROUND_UP(delay, scale);
+}
+
+
+/**
+ * Sets time scale.
+ *
+ * @param val new value
+ * @param kp  corresponding parameter
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+static int
+fsm_clock_time_scale_set(const char *val, const struct kernel_param *kp)
+{
+  int           ret;
+  unsigned long scale;
+  bool          started;
+
+  ret = strict_strtoul(val, 0, &scale);
+  if (ret != 0 || scale > FSM_CLOCK_TIME_SCALE_MAX) {
+    return -EINVAL;
+  }
+
+  write_seqlock(&fsm_clock_lock);
+
+  /* time elapsed so far has been measured using an old scale */
+  fsm_clock.virt_base = __fsm_clock_now();
+  fsm_clock.real_base = jiffies;
+  fsm_clock.scale     = scale;
+
+  started = fsm_clock.started;
+
+  write_sequnlock(&fsm_clock_lock);
+
+  if (started) {
+    TRACE_INFO("Virtual time scale changed to %lu", scale);
+    fsm_timers_kick();
+  }
+
+  return 0;
+}
+
+
+/**
+ * Advances virtual clock.
+ *
+ * @param val number of seconds to advance clock by
+ * @param kp  corresponding parameter
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+static int
+fsm_clock_advance_set(const char *val, const struct kernel_param *kp)
+{
+  int           ret;
+  unsigned long seconds;
+  bool          started;
+
+  ret = strict_strtoul(val, 0, &seconds);
+  if (ret != 0 || seconds > MAX_JIFFY_OFFSET / HZ) {
+    return -EINVAL;
+  }
+
+  write_seqlock(&fsm_clock_lock);
+  fsm_clock.virt_base += seconds * HZ;
+  started              = fsm_clock.started;
+  write_sequnlock(&fsm_clock_lock);
+
+  if (started) {
+    TRACE_DEBUG("Virtual clock advanced by %lus", seconds);
+    fsm_timers_kick();
+  }
+
+  return 0;
+}
+
+
+/**
+ * Shows virtual time elapsed since the clock has been started.
+ *
+ * @param buffer buffer to write to
+ * @param kp     corresponding parameter
+ *
+ * @return number of bytes written
+ */
+static int
+fsm_clock_advance_get(char *buffer, const struct kernel_param *kp)
+{
+  unsigned long elapsed;
+  unsigned      seq;
+
+  do {
+    seq     = read_seqbegin(&fsm_clock_lock);
+    elapsed = fsm_clock.started ?
+      __fsm_clock_now() - fsm_clock.virt_start : 0;
+  } while (read_seqretry(&fsm_clock_lock, seq));
+
+  return sprintf(buffer, "%lu", elapsed / HZ);
+}
+
+
+/// Operations of 'time_scale' parameter.
+static struct kernel_param_ops fsm_clock_time_scale_ops = {
+  .set = fsm_clock_time_scale_set,
+  .get = param_get_uint,
+};
+
+
+/// Operations of 'clock_advance' parameter.
+static struct kernel_param_ops fsm_clock_advance_ops = {
+  .set = fsm_clock_advance_set,
+  .get = fsm_clock_advance_get,
+};
+
+
+module_param_cb(time_scale, &fsm_clock_time_scale_ops, &fsm_clock.scale,
+                S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(time_scale,
+                 "How many times faster than real time the eater lives; "
+                 "0 stops the time (see clock_advance)");
+
+module_param_cb(clock_advance, &fsm_clock_advance_ops, NULL,
+                S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(clock_advance,
+                 "Writing N advances the eater's clock by N seconds; "
+                 "reading shows the eater's age in seconds");
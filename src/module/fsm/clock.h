@@ -0,0 +1,43 @@
+/**
+ * @file   clock.h
+ *
+ * @brief Virtual clock driving all the FSM timers. Virtual time can run
+ * faster than the real one (see 'time_scale' module parameter) or be stopped
+ * and advanced manually (see 'clock_advance' module parameter). All the
+ * times and delays passed to FSM timers are in virtual jiffies.
+ *
+ *
+ */
+
+#ifndef _FSM__CLOCK_H_
+#define _FSM__CLOCK_H_
+
+
+/**
+ * Starts virtual clock. Called by fsm_timers_init().
+ */
+void
+fsm_clock_start(void);
+
+
+/**
+ * Returns current virtual time.
+ *
+ * @return virtual time in jiffies
+ */
+unsigned long
+fsm_clock_now(void);
+
+
+/**
+ * Converts virtual delay to the real one.
+ *
+ * @param delay virtual delay in jiffies
+ *
+ * @return real delay in jiffies or MAX_JIFFY_OFFSET if the clock is stopped
+ */
+unsigned long
+fsm_clock_to_real(unsigned long delay);
+
+
+#endif /* _FSM__CLOCK_H_ */
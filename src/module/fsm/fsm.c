@@ -1,13 +1,22 @@
 #include <linux/string.h>
 #include <linux/slab.h>
-#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
 
 #include "utils/trace.h"
 #include "utils/assert.h"
 
 #include "status/status.h"
 
+#include "fsm/clock.h"
 #include "fsm/fsm.h"
+#include "fsm/journal.h"
+#include "fsm/stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "fsm/fsm_trace.h"
 
 
 /**
@@ -16,8 +25,8 @@
  * @param _fsm   FSM
  * @param _event event to check
  */
-#define ASSERT_VALID_EVENT(_fsm, _event)                   \
-  ASSERT( (_event) >= 0 && (_event) < (_fsm)->event_count )
+#define ASSERT_VALID_EVENT(_fsm, _event)                              \
+  ASSERT( (_event) >= 0 && (_event) < (_fsm)->class->event_count )
 
 
 /**
@@ -26,8 +35,8 @@
  * @param _fsm   FSM
  * @param _state state to check
  */
-#define ASSERT_VALID_STATE(_fsm, _state)                   \
-  ASSERT( (_state) >= 0 && (_state) < (_fsm)->state_count )
+#define ASSERT_VALID_STATE(_fsm, _state)                              \
+  ASSERT( (_state) >= 0 && (_state) < (_fsm)->class->state_count )
 
 
 /**
@@ -37,12 +46,39 @@
  * @param _event event type to check
  */
 #define ASSERT_NO_DATA_EVENT(_fsm, _event)                              \
-  ASSERT( (_fsm)->handlers[(_event)].type == FSM_EVENT_HANDLER_NO_DATA )
+  ASSERT( (_fsm)->class->handlers == NULL ||                            \
+          (_fsm)->class->handlers[(_event)].type !=                     \
+          FSM_EVENT_HANDLER_WITH_DATA )
 
 
-/// Shows current state of finite state machine.
-static ssize_t
-fsm_state_attr_show(const char *name, const struct fsm_t *fsm, char *buffer);
+/// Single postponed event.
+struct fsm_postponed_event_t {
+  struct fsm_timer_t timer;      /**< Timer emitting the event. */
+  struct fsm_t      *fsm;        /**< FSM to emit the event to. */
+  int                event;      /**< Event type. */
+  u32                generation; /**< Generation of event type the event has
+                                  * been postponed in. */
+  bool               canceled;   /**< Event is being canceled by
+                                  * fsm_cancel_postponed_events(). */
+
+  struct list_head   list;       /**< Forms a list of FSM's postponed
+                                  * events. */
+};
+
+
+/**
+ * Returns slack of timers emitting the event.
+ *
+ * @param fsm   FSM
+ * @param event event type
+ *
+ * @return slack in virtual jiffies
+ */
+static inline unsigned long
+fsm_event_slack(const struct fsm_t *fsm, int event)
+{
+  return fsm->class->slacks != NULL ? fsm->class->slacks[event] : 0;
+}
 
 
 /**
@@ -60,140 +96,442 @@ __fsm_event_dispatch(struct fsm_t *fsm, int event, void *data);
 
 
 /**
- * Handles postponed events.
+ * Emits postponed event.
  *
- * @param work corresponding work
+ * @param timer timer of the event
  */
 static void
-fsm_postponed_events_work_fn(struct work_struct *work);
+fsm_postponed_event_fire(struct fsm_timer_t *timer);
 
 
 /**
- * Initializes postponed events structure.
+ * Emits state timeout event.
  *
- * @param postponed_events structure to initialize
+ * @param timer state timeout timer
  */
 static void
-fsm_postponed_events_init(struct fsm_postponed_events_t *postponed_events);
+fsm_timeout_fire(struct fsm_timer_t *timer);
 
 
-int
-fsm_init(struct fsm_t *fsm,
-         const char *name,
-         int state_count,
-         int event_count,
-         fsm_state_show_fn_t show_state,
-         fsm_event_show_fn_t show_event,
-         void *data,
-         const struct fsm_event_handler_t handlers[])
-{
-  int ret;
+/**
+ * Arms (or disarms) state timeout timer for the current state of FSM. Lock
+ * should be acquired by the caller.
+ *
+ * @param fsm FSM
+ */
+static void
+__fsm_timeout_update(struct fsm_t *fsm);
 
-  char   *state_attr_name;
-  size_t  state_attr_name_length;
 
-  ASSERT( state_count >= 1 );
-  ASSERT( event_count >= 1 );
+/// Notification posted to another FSM by an event handler.
+struct fsm_notification_t {
+  struct fsm_t *fsm;            /**< FSM to emit the event to. */
+  int           event;          /**< Event type. */
+};
 
-  rwlock_init(&fsm->lock);
 
-  fsm->name        = name;
-  fsm->state_count = state_count;
-  fsm->event_count = event_count;
-  fsm->show_state  = show_state;
-  fsm->show_event  = show_event;
-  fsm->data        = data;
-  fsm->handlers    = handlers;
+/// Notifications waiting for FSM's lock to be released. Lives on the stack
+/// of the function holding the lock and is reached by fsm_notify() through
+/// #fsm_outbox.
+struct fsm_outbox_t {
+  const struct fsm_t  *fsm;     /**< FSM whose lock is held. */
+  struct fsm_outbox_t *prev;    /**< Outbox of the FSM locked further up
+                                 * the stack on this CPU (if any). */
+
+  unsigned int              count;                  /**< Number of
+                                                     * notifications. */
+  struct fsm_notification_t items[FSM_OUTBOX_SIZE]; /**< Notifications in
+                                                     * order of posting. */
+};
+
+
+/// Outbox of the innermost FSM locked on the CPU. Holding an
+/// rwlock keeps us on the CPU, so the pointer stays valid till the unlock.
+static DEFINE_PER_CPU(struct fsm_outbox_t *, fsm_outbox);
+
+
+/**
+ * Acquires FSM lock for writing and opens the outbox for notifications
+ * posted by the handlers. Time spent waiting for the lock is accounted in
+ * FSM statistics.
+ *
+ * @param fsm    FSM
+ * @param outbox outbox; must stay alive till fsm_write_unlock()
+ */
+static void
+fsm_write_lock(struct fsm_t *fsm, struct fsm_outbox_t *outbox);
+
+
+/**
+ * Releases FSM lock acquired by fsm_write_lock() and delivers notifications
+ * posted by the handlers that have run under it.
+ *
+ * @param fsm    FSM
+ * @param outbox outbox passed to fsm_write_lock()
+ */
+static void
+fsm_write_unlock(struct fsm_t *fsm, struct fsm_outbox_t *outbox);
 
-  fsm->state = 0;
-  fsm_postponed_events_init(&fsm->postponed_events);
 
-  state_attr_name_length = strlen(name) + strlen("_state") + 1;
+int
+fsm_class_init(const struct fsm_class_t *class)
+{
+  if (class->stats == NULL) {
+    return 0;
+  }
 
-  state_attr_name = kmalloc(state_attr_name_length, GFP_KERNEL);
-  if (state_attr_name == NULL) {
-    TRACE_ERR("Not enough memory");
+  *class->stats = alloc_percpu(struct fsm_stats_t);
+  if (*class->stats == NULL) {
+    TRACE_ERR("FSM %s: unable to allocate statistics", class->name);
     return -ENOMEM;
   }
-  snprintf(state_attr_name, state_attr_name_length, "%s_state", name);
 
-  status_attr_init(&fsm->state_attr, state_attr_name,
-                   (status_attr_show_t) fsm_state_attr_show, fsm);
+  return 0;
+}
 
-  ret = status_create_file(&fsm->state_attr);
-  if (ret != 0) {
-    goto error;
+
+void
+fsm_class_cleanup(const struct fsm_class_t *class)
+{
+  if (class->stats != NULL) {
+    free_percpu(*class->stats);
+    *class->stats = NULL;
   }
+}
 
-  return 0;
 
-error:
-  kfree(state_attr_name);
-  return ret;
+int
+fsm_init(struct fsm_t *fsm, const struct fsm_class_t *class)
+{
+  int state;
+
+  ASSERT( class->state_count >= 1 );
+  ASSERT( class->event_count >= 1 );
+  ASSERT( class->event_count <= FSM_EVENTS_MAX );
+  ASSERT( class->handlers != NULL || class->transitions != NULL );
+  ASSERT( class->stats == NULL || class->state_count <= FSM_STATES_MAX );
+  ASSERT( class->stats == NULL || *class->stats != NULL );
+
+  rwlock_init(&fsm->lock);
+  seqcount_init(&fsm->seq);
+
+  fsm->class       = class;
+  fsm->state       = 0;
+  fsm->state_since = ktime_to_ns(ktime_get());
+
+  fsm->timeout_armed   = false;
+  fsm->timeout_restart = false;
+  fsm->timeout_state   = 0;
+  fsm_timer_init(&fsm->timeout, fsm_timeout_fire);
+
+  INIT_LIST_HEAD(&fsm->postponed_events);
+  memset(fsm->generations, 0, sizeof(fsm->generations));
+
+  if (class->timeouts != NULL) {
+    for (state = 0; state < class->state_count; ++state) {
+      if (class->timeouts[state].delay != NULL) {
+        ASSERT_VALID_EVENT( fsm, class->timeouts[state].event );
+        ASSERT_NO_DATA_EVENT( fsm, class->timeouts[state].event );
+      }
+    }
+  }
+
+  return 0;
 }
 
 
 void
 fsm_cleanup(struct fsm_t *fsm)
 {
+  struct fsm_outbox_t outbox;
+
+  fsm_write_lock(fsm, &outbox);
+  fsm->timeout_armed = false;
+  fsm_write_unlock(fsm, &outbox);
+
+  fsm_timer_cancel_sync(&fsm->timeout);
+
   fsm_cancel_postponed_events(fsm);
-  status_remove_file(&fsm->state_attr);
-  kfree(fsm->state_attr.attr.name);
 }
 
 
-static ssize_t
+ssize_t
 fsm_state_attr_show(const char *name, const struct fsm_t *fsm, char *buffer)
 {
-  int state;
+  int      state;
+  unsigned seq;
 
-  read_lock(&fsm->lock);
-  state = fsm->state;
-  read_unlock(&fsm->lock);
+  do {
+    seq   = fsm_read_begin(fsm);
+    state = fsm->state;
+  } while (fsm_read_retry(fsm, seq));
 
-  return snprintf(buffer, PAGE_SIZE, "%s\n", fsm->show_state(state));
+  return snprintf(buffer, PAGE_SIZE, "%s\n", fsm->class->show_state(state));
 }
 
 
-int
-__fsm_emit(struct fsm_t *fsm, int event, void *data)
+/**
+ * Dispatches event and moves FSM to the new state. Must be called with lock
+ * held and inside the write section of FSM's sequence counter.
+ *
+ * @param fsm   FSM
+ * @param event event type
+ * @param data  data for event handler
+ *
+ * @retval  0 success
+ * @retval <0 error returned by event handler
+ */
+static int
+__fsm_apply(struct fsm_t *fsm, int event, void *data)
 {
   int ret;
+  u64 start;
+  u64 duration;
 
   ASSERT_VALID_EVENT( fsm, event );
 
-  TRACE_DEBUG("FSM %s: state: %s, incoming event: %s",
-              fsm->name,
-              fsm->show_state(fsm->state),
-              fsm->show_event(event));
+  fsm->timeout_restart = false;
 
+  trace_fsm_emit(fsm, event);
+
+  start    = ktime_to_ns(ktime_get());
+  ret      = __fsm_event_dispatch(fsm, event, data);
+  duration = ktime_to_ns(ktime_get()) - start;
+
+  fsm_journal_record(fsm->class->name,
+                     fsm->class->instance != NULL ?
+                     fsm->class->instance(fsm_data(fsm)) : 0, start,
+                     min_t(u64, duration, UINT_MAX),
+                     event, fsm->state, ret < 0 ? fsm->state : ret, ret);
+  trace_fsm_transition(fsm, event,
+                       fsm->state, ret < 0 ? fsm->state : ret, ret);
+
+  if (fsm->class->stats != NULL) {
+    fsm_stats_event(*fsm->class->stats, event, duration);
+  }
 
-  ret = __fsm_event_dispatch(fsm, event, data);
   if (ret < 0) {
-    TRACE_DEBUG("FSM %s: event handler reports an error: %d",
-                fsm->name, ret);
     return ret;
   }
 
-  fsm->state = ret;
+  ASSERT_VALID_STATE( fsm, ret );
 
-  ASSERT_VALID_STATE( fsm, fsm->state );
+  if (ret != fsm->state) {
+    if (fsm->class->stats != NULL) {
+      fsm_stats_leave_state(*fsm->class->stats, fsm->state,
+                            start + duration - fsm->state_since);
+    }
+
+    fsm->state_since = start + duration;
+  }
 
-  TRACE_DEBUG("FSM %s: new state: %s",
-              fsm->name, fsm->show_state(fsm->state));
+  if (ret != fsm->state || fsm->timeout_restart) {
+    fsm->state = ret;
+    __fsm_timeout_update(fsm);
+  }
 
   return 0;
 }
 
 
+static void
+fsm_write_lock(struct fsm_t *fsm, struct fsm_outbox_t *outbox)
+{
+  u64 start;
+
+  if (fsm->class->stats == NULL) {
+    write_lock(&fsm->lock);
+  } else {
+    start = ktime_to_ns(ktime_get());
+    write_lock(&fsm->lock);
+    fsm_stats_lock_wait(*fsm->class->stats,
+                        ktime_to_ns(ktime_get()) - start);
+  }
+
+  outbox->fsm   = fsm;
+  outbox->prev  = __this_cpu_read(fsm_outbox);
+  outbox->count = 0;
+
+  __this_cpu_write(fsm_outbox, outbox);
+}
+
+
+/**
+ * Emits notifications posted to the outbox. Must be called without any
+ * FSM locks held.
+ *
+ * @param outbox notifications
+ */
+static void
+fsm_outbox_deliver(const struct fsm_outbox_t *outbox)
+{
+  int          ret;
+  unsigned int i;
+
+  const struct fsm_notification_t *notification;
+
+  for (i = 0; i < outbox->count; ++i) {
+    notification = &outbox->items[i];
+
+    ret = fsm_emit_simple(notification->fsm, notification->event);
+    if (ret != 0) {
+      TRACE_ERR("FSM %s: notification %s handled with error %d",
+                notification->fsm->class->name,
+                notification->fsm->class->show_event(notification->event),
+                ret);
+    }
+  }
+}
+
+
+static void
+fsm_write_unlock(struct fsm_t *fsm, struct fsm_outbox_t *outbox)
+{
+  ASSERT( __this_cpu_read(fsm_outbox) == outbox );
+  __this_cpu_write(fsm_outbox, outbox->prev);
+
+  write_unlock(&fsm->lock);
+
+  if (unlikely(outbox->count != 0)) {
+    fsm_outbox_deliver(outbox);
+  }
+}
+
+
+static int
+__fsm_emit(struct fsm_t *fsm, int event, void *data)
+{
+  int ret;
+
+  ASSERT_VALID_EVENT( fsm, event );
+
+  write_seqcount_begin(&fsm->seq);
+  ret = __fsm_apply(fsm, event, data);
+  write_seqcount_end(&fsm->seq);
+
+  return ret;
+}
+
+
+/**
+ * Returns guard of the event.
+ *
+ * @param fsm   FSM
+ * @param event event type
+ *
+ * @return guard or NULL if the event is not guarded
+ */
+static inline const struct fsm_guard_t *
+fsm_event_guard(const struct fsm_t *fsm, int event)
+{
+  const struct fsm_guard_t *guard;
+
+  if (fsm->class->guards == NULL) {
+    return NULL;
+  }
+
+  guard = &fsm->class->guards[event];
+
+  return guard->check != NULL ? guard : NULL;
+}
+
+
+/**
+ * Reports event rejected by its guard.
+ *
+ * @param fsm   FSM
+ * @param guard guard of the event
+ * @param event event type
+ * @param state state the event has been rejected in
+ */
+static void
+fsm_guard_reject(struct fsm_t *fsm,
+                 const struct fsm_guard_t *guard, int event, int state)
+{
+  trace_fsm_reject(fsm, event, state);
+
+  if (guard->reject != NULL) {
+    guard->reject(state, fsm_data(fsm));
+  }
+}
+
+
+/**
+ * Checks event against its guard without taking FSM's lock.
+ *
+ * @param fsm   FSM
+ * @param event event type
+ *
+ * @retval true  event should be dispatched
+ * @retval false event has been rejected by the guard
+ */
+static bool
+fsm_guard_passes(struct fsm_t *fsm, int event)
+{
+  const struct fsm_guard_t *guard = fsm_event_guard(fsm, event);
+
+  bool     pass;
+  int      state;
+  unsigned seq;
+
+  if (guard == NULL) {
+    return true;
+  }
+
+  do {
+    seq   = fsm_read_begin(fsm);
+    state = fsm->state;
+    pass  = guard->check(state, fsm_data(fsm));
+  } while (fsm_read_retry(fsm, seq));
+
+  if (!pass) {
+    fsm_guard_reject(fsm, guard, event, state);
+  }
+
+  return pass;
+}
+
+
+/**
+ * Checks event against its guard. Lock should be acquired by the caller.
+ *
+ * @param fsm   FSM
+ * @param event event type
+ *
+ * @retval true  event should be dispatched
+ * @retval false event has been rejected by the guard
+ */
+static bool
+__fsm_guard_passes(struct fsm_t *fsm, int event)
+{
+  const struct fsm_guard_t *guard = fsm_event_guard(fsm, event);
+
+  if (guard == NULL || guard->check(fsm->state, fsm_data(fsm))) {
+    return true;
+  }
+
+  fsm_guard_reject(fsm, guard, event, fsm->state);
+
+  return false;
+}
+
+
 int
 fsm_emit(struct fsm_t *fsm, int event, void *data)
 {
   int ret;
 
-  write_lock(&fsm->lock);
+  struct fsm_outbox_t outbox;
+
+  ASSERT_VALID_EVENT( fsm, event );
+
+  if (!fsm_guard_passes(fsm, event)) {
+    return 0;
+  }
+
+  fsm_write_lock(fsm, &outbox);
   ret = __fsm_emit(fsm, event, data);
-  write_unlock(&fsm->lock);
+  fsm_write_unlock(fsm, &outbox);
 
   return ret;
 }
@@ -204,223 +542,730 @@ fsm_emit_simple(struct fsm_t *fsm, int event)
 {
   int ret;
 
+  struct fsm_outbox_t outbox;
+
   ASSERT_VALID_EVENT( fsm, event );
   ASSERT_NO_DATA_EVENT( fsm, event );
 
-  write_lock(&fsm->lock);
+  if (!fsm_guard_passes(fsm, event)) {
+    return 0;
+  }
+
+  fsm_write_lock(fsm, &outbox);
   ret = __fsm_emit(fsm, event, NULL);
-  write_unlock(&fsm->lock);
+  fsm_write_unlock(fsm, &outbox);
 
   return ret;
 }
 
 
+int
+fsm_emit_batch(struct fsm_t *fsm,
+               const int events[], void *data[], int results[], size_t count)
+{
+  int    ret;
+  int    first_error = 0;
+  size_t i;
+
+  struct fsm_outbox_t outbox;
+
+  fsm_write_lock(fsm, &outbox);
+  write_seqcount_begin(&fsm->seq);
+
+  for (i = 0; i < count; ++i) {
+    ASSERT_VALID_EVENT( fsm, events[i] );
+    if (data == NULL) {
+      ASSERT_NO_DATA_EVENT( fsm, events[i] );
+    }
+
+    /* guards see the state left by the preceding events of the batch */
+    ret = 0;
+    if (__fsm_guard_passes(fsm, events[i])) {
+      ret = __fsm_apply(fsm, events[i], data != NULL ? data[i] : NULL);
+    }
+
+    if (ret < 0 && first_error == 0) {
+      first_error = ret;
+    }
+
+    if (results != NULL) {
+      results[i] = ret;
+    }
+  }
+
+  write_seqcount_end(&fsm->seq);
+  fsm_write_unlock(fsm, &outbox);
+
+  return first_error;
+}
+
+
+/**
+ * Calls event handler. Lock should be acquired by the caller.
+ *
+ * @param fsm     FSM
+ * @param handler handler to call
+ * @param data    data to be fed to handler
+ *
+ * @retval >=0 new state of FSM
+ * @retval  <0 error code
+ */
+static inline int
+__fsm_call_handler(struct fsm_t *fsm,
+                   const struct fsm_event_handler_t *handler, void *data)
+{
+  ASSERT( handler->type != FSM_EVENT_HANDLER_INVALID );
+
+  if (handler->type == FSM_EVENT_HANDLER_NO_DATA) {
+    return handler->h.no_data.fn(fsm->state, fsm_data(fsm));
+  } else {                      /* FSM_EVENT_HANDLER_WITH_DATA */
+    return handler->h.with_data.fn(fsm->state, fsm_data(fsm), data);
+  }
+}
+
+
 static int
 __fsm_event_dispatch(struct fsm_t *fsm, int event, void *data)
 {
-  const struct fsm_event_handler_t *handler;
+  const struct fsm_transition_t *transition;
 
   ASSERT_VALID_EVENT( fsm, event );
 
-  handler = &fsm->handlers[event];
+  if (fsm->class->transitions != NULL) {
+    transition = &fsm->class->transitions[fsm->state *
+                                          fsm->class->event_count + event];
 
-  if (handler->type == FSM_EVENT_HANDLER_NO_DATA) {
-    return handler->h.no_data.fn(fsm->state, fsm->data);
-  } else {                      /* FSM_EVENT_HANDLER_WITH_DATA */
-    return handler->h.with_data.fn(fsm->state, fsm->data, data);
+    if (likely(transition->type == FSM_TRANSITION_PURE)) {
+      return transition->next_state;
+    } else if (transition->type == FSM_TRANSITION_ACTION) {
+      return __fsm_call_handler(fsm, &transition->action, data);
+    }
+
+    /* FSM_TRANSITION_NONE: falling back to the table of handlers */
+    ASSERT( fsm->class->handlers != NULL );
+  }
+
+  return __fsm_call_handler(fsm, &fsm->class->handlers[event], data);
+}
+
+
+/**
+ * Checks whether postponed event has been canceled. FSM lock must be held by
+ * the caller.
+ *
+ * @param postponed_event event to check
+ */
+static inline bool
+__fsm_postponed_event_is_stale(
+  const struct fsm_postponed_event_t *postponed_event)
+{
+  return postponed_event->canceled ||
+    postponed_event->generation !=
+    postponed_event->fsm->generations[postponed_event->event];
+}
+
+
+/**
+ * Allocates postponed event.
+ *
+ * @param fsm   FSM
+ * @param event event type
+ * @param gfp   allocation flags
+ *
+ * @return event or NULL if there's no memory
+ */
+static struct fsm_postponed_event_t *
+fsm_postponed_event_alloc(struct fsm_t *fsm, int event, gfp_t gfp)
+{
+  struct fsm_postponed_event_t *postponed_event;
+
+  postponed_event = kmalloc(sizeof(*postponed_event), gfp);
+  if (postponed_event == NULL) {
+    TRACE_ERR("FSM %s: unable to allocate memory for a postponed event",
+              fsm->class->name);
+    return NULL;
   }
+
+  fsm_timer_init(&postponed_event->timer, fsm_postponed_event_fire);
+  postponed_event->fsm      = fsm;
+  postponed_event->event    = event;
+  postponed_event->canceled = false;
+
+  return postponed_event;
+}
+
+
+/**
+ * Queues allocated postponed event. Must be called with lock held.
+ *
+ * @param postponed_event event allocated by fsm_postponed_event_alloc()
+ * @param delay           delay in virtual jiffies
+ */
+static void
+__fsm_postponed_event_arm(struct fsm_postponed_event_t *postponed_event,
+                          unsigned long delay)
+{
+  struct fsm_t *fsm   = postponed_event->fsm;
+  int           event = postponed_event->event;
+
+  trace_fsm_postpone(fsm, event, delay, false);
+
+  postponed_event->generation = fsm->generations[event];
+
+  list_add_tail(&postponed_event->list, &fsm->postponed_events);
+
+  fsm_timer_arm(&postponed_event->timer,
+                fsm_clock_now() + delay, fsm_event_slack(fsm, event));
 }
 
 
 int
 fsm_postpone_event(struct fsm_t *fsm, int event, unsigned long delay)
 {
-  bool schedule;
   struct fsm_postponed_event_t *postponed_event;
 
   ASSERT_VALID_EVENT( fsm, event );
   ASSERT_NO_DATA_EVENT( fsm, event );
 
-  postponed_event = kmalloc(sizeof(*postponed_event), GFP_KERNEL);
+  /* handlers run under spinning lock */
+  postponed_event = fsm_postponed_event_alloc(fsm, event, GFP_ATOMIC);
   if (postponed_event == NULL) {
-    TRACE_ERR("FSM %s: unable to allocate memory for a postponed event",
-              fsm->name);
     return -ENOMEM;
   }
 
-  postponed_event->event = event;
-  postponed_event->time  = jiffies + delay;
+  __fsm_postponed_event_arm(postponed_event, delay);
 
-  TRACE_DEBUG("FSM %s: postponing event %s to the future (%us)",
-              fsm->name, fsm->show_event(event),
-              jiffies_to_msecs(delay) / 1000);
+  return 0;
+}
 
 
-  spin_lock(&fsm->postponed_events.lock);
+int
+fsm_notify(struct fsm_t *fsm, struct fsm_t *target, int event)
+{
+  struct fsm_notification_t *notification;
+  struct fsm_outbox_t       *outbox;
 
-  schedule = list_empty(&fsm->postponed_events.events);
-  list_add_tail(&postponed_event->list, &fsm->postponed_events.events);
+  ASSERT_VALID_EVENT( target, event );
+  ASSERT_NO_DATA_EVENT( target, event );
 
-  if (schedule) {
-    schedule_delayed_work(&fsm->postponed_events.work, delay);
+  outbox = __this_cpu_read(fsm_outbox);
+  ASSERT( outbox != NULL && outbox->fsm == fsm );
+
+  if (outbox->count == FSM_OUTBOX_SIZE) {
+    TRACE_ERR("FSM %s: too many pending notifications; %s to %s dropped",
+              fsm->class->name, target->class->show_event(event),
+              target->class->name);
+    return -ENOSPC;
   }
 
-  spin_unlock(&fsm->postponed_events.lock);
+  trace_fsm_notify(fsm, target, event);
 
+  notification        = &outbox->items[outbox->count++];
+  notification->fsm   = target;
+  notification->event = event;
 
   return 0;
 }
 
 
-void
-fsm_cancel_postponed_events(struct fsm_t *fsm)
+/**
+ * Detaches all the postponed events from FSM. The events that are being
+ * emitted right now will find out that they have been canceled and leave
+ * freeing to the caller. FSM lock must be held by the caller.
+ *
+ * @param fsm    FSM
+ * @param events list to move the events to
+ */
+static void
+__fsm_detach_postponed_events(struct fsm_t *fsm, struct list_head *events)
 {
-  int ret;
   struct fsm_postponed_event_t *event;
-  struct fsm_postponed_event_t *tmp;
-
-  size_t events_count = 0;
 
-  TRACE_DEBUG("FSM %s: canceling all the postponed events", fsm->name);
+  trace_fsm_cancel(fsm, -1);
 
-  atomic_set(&fsm->postponed_events.cancel, 1);
-  ret = cancel_delayed_work(&fsm->postponed_events.work);
-  if (!ret) {
-    flush_delayed_work(&fsm->postponed_events.work);
+  list_for_each_entry(event, &fsm->postponed_events, list) {
+    event->canceled = true;
   }
 
-  spin_lock(&fsm->postponed_events.lock);
+  list_splice_init(&fsm->postponed_events, events);
+}
+
+
+/**
+ * Cancels timers of detached postponed events and frees them. Must be called
+ * without FSM lock held.
+ *
+ * @param events events detached by __fsm_detach_postponed_events()
+ */
+static void
+fsm_free_postponed_events(struct list_head *events)
+{
+  struct fsm_postponed_event_t *event;
+  struct fsm_postponed_event_t *tmp;
+
+  list_for_each_entry_safe(event, tmp, events, list) {
+    fsm_timer_cancel_sync(&event->timer);
 
-  list_for_each_entry_safe(event, tmp, &fsm->postponed_events.events, list) {
     list_del(&event->list);
     kfree(event);
-    ++events_count;
   }
+}
+
+
+void
+fsm_cancel_postponed_events(struct fsm_t *fsm)
+{
+  struct fsm_outbox_t outbox;
 
-  spin_unlock(&fsm->postponed_events.lock);
+  LIST_HEAD(events);
 
-  atomic_set(&fsm->postponed_events.cancel, 0);
+  fsm_write_lock(fsm, &outbox);
+  __fsm_detach_postponed_events(fsm, &events);
+  fsm_write_unlock(fsm, &outbox);
 
-  TRACE_DEBUG("FSM %s: %zu event(s) canceled", fsm->name, events_count);
+  fsm_free_postponed_events(&events);
 }
 
 
 void
 fsm_cancel_postponed_events_by_type(struct fsm_t *fsm, int event_type)
 {
-  int ret;
   struct fsm_postponed_event_t *event;
   struct fsm_postponed_event_t *tmp;
 
-  size_t events_count = 0;
-
   ASSERT_VALID_EVENT( fsm, event_type );
 
-  TRACE_DEBUG("FSM %s: canceling all the events of type '%s'",
-              fsm->name, fsm->show_event(event_type));
-
-  atomic_set(&fsm->postponed_events.cancel, 1);
+  /* events that are being emitted right now are waiting for our lock; they
+   * will find out that they are stale and free themselves */
+  ++fsm->generations[event_type];
 
-  ret = cancel_delayed_work(&fsm->postponed_events.work);
-  if (!ret) {
-    flush_delayed_work(&fsm->postponed_events.work);
+  list_for_each_entry_safe(event, tmp, &fsm->postponed_events, list) {
+    if (event->event == event_type && fsm_timer_cancel(&event->timer)) {
+      list_del(&event->list);
+      kfree(event);
+    }
   }
 
-  spin_lock(&fsm->postponed_events.lock);
+  trace_fsm_cancel(fsm, event_type);
+}
 
-  list_for_each_entry_safe(event, tmp, &fsm->postponed_events.events, list) {
-    if (event->event == event_type) {
-      list_del(&event->list);
-      kfree(event);
 
-      ++events_count;
-    }
+static void
+fsm_postponed_event_fire(struct fsm_timer_t *timer)
+{
+  int  ret = 0;
+  bool stale;
+
+  struct fsm_postponed_event_t *postponed_event =
+    container_of(timer, struct fsm_postponed_event_t, timer);
+  struct fsm_t *fsm = postponed_event->fsm;
+  struct fsm_outbox_t outbox;
+
+  fsm_write_lock(fsm, &outbox);
+
+  if (postponed_event->canceled) {
+    /* fsm_cancel_postponed_events() is waiting for us to free the event */
+    fsm_write_unlock(fsm, &outbox);
+    return;
   }
 
-  if (!list_empty(&fsm->postponed_events.events)) {
-    struct fsm_postponed_event_t *head;
+  list_del(&postponed_event->list);
 
-    head = list_first_entry(&fsm->postponed_events.events,
-                            struct fsm_postponed_event_t, list);
+  stale = __fsm_postponed_event_is_stale(postponed_event);
+  trace_fsm_timer_fire(fsm, postponed_event->event, false, stale);
 
-    schedule_delayed_work(&fsm->postponed_events.work, head->time - jiffies);
+  if (!stale) {
+    ret = __fsm_emit(fsm, postponed_event->event, NULL);
   }
 
-  spin_unlock(&fsm->postponed_events.lock);
+  fsm_write_unlock(fsm, &outbox);
 
-  atomic_set(&fsm->postponed_events.cancel, 0);
+  if (ret != 0) {
+    TRACE_ERR("FSM %s: postponed event %s handled with error %d",
+              fsm->class->name,
+              fsm->class->show_event(postponed_event->event), ret);
+  }
 
-  TRACE_DEBUG("FSM %s: %zu event(s) of type '%s' canceled",
-              fsm->name, events_count, fsm->show_event(event_type));
+  kfree(postponed_event);
 }
 
 
 static void
-fsm_postponed_events_work_fn(struct work_struct *work)
+__fsm_timeout_update(struct fsm_t *fsm)
 {
-  int ret;
+  unsigned long delay;
 
-  struct fsm_t                  *fsm;
-  struct fsm_postponed_events_t *postponed_events;
-  struct fsm_postponed_event_t  *postponed_event;
-  struct fsm_postponed_event_t  *next_event = NULL;
+  const struct fsm_state_timeout_t *timeout = NULL;
 
-  postponed_events = container_of(to_delayed_work(work),
-                                  struct fsm_postponed_events_t, work);
+  if (fsm->class->timeouts != NULL) {
+    timeout = &fsm->class->timeouts[fsm->state];
+  }
 
-  spin_lock(&postponed_events->lock);
+  if (timeout == NULL || timeout->delay == NULL) {
+    if (fsm->timeout_armed) {
+      fsm->timeout_armed = false;
+      fsm_timer_cancel(&fsm->timeout);
+    }
 
-  ASSERT( !list_empty(&postponed_events->events) );
+    return;
+  }
 
-  postponed_event = list_first_entry(&postponed_events->events,
-                                     struct fsm_postponed_event_t, list);
-  list_del(&postponed_event->list);
+  delay = timeout->delay(fsm->state, fsm_data(fsm));
 
-  if (!list_empty(&postponed_events->events)) {
-    next_event = list_first_entry(&postponed_events->events,
-                                  struct fsm_postponed_event_t, list);
+  trace_fsm_postpone(fsm, timeout->event, delay, true);
+
+  fsm->timeout_armed = true;
+  fsm->timeout_state = fsm->state;
+
+  /* if the timer is firing right now it will find out that it has been
+   * re-armed and will do nothing */
+  fsm_timer_arm(&fsm->timeout,
+                fsm_clock_now() + delay, fsm_event_slack(fsm, timeout->event));
+}
+
+
+static void
+fsm_timeout_fire(struct fsm_timer_t *timer)
+{
+  int ret;
+  int event;
+
+  struct fsm_t *fsm = container_of(timer, struct fsm_t, timeout);
+
+  struct fsm_outbox_t outbox;
+
+  fsm_write_lock(fsm, &outbox);
+
+  if (!fsm->timeout_armed ||
+      fsm->timeout_state != fsm->state ||
+      time_after(fsm->timeout.time, fsm_clock_now())) {
+    /* disarmed or re-armed concurrently */
+    trace_fsm_timer_fire(fsm, fsm->class->timeouts[fsm->timeout_state].event,
+                         true, true);
+    fsm_write_unlock(fsm, &outbox);
+    return;
   }
 
-  spin_unlock(&postponed_events->lock);
+  fsm->timeout_armed = false;
+  event              = fsm->class->timeouts[fsm->state].event;
+
+  trace_fsm_timer_fire(fsm, event, true, false);
 
-  fsm = container_of(postponed_events, struct fsm_t, postponed_events);
+  ret = __fsm_emit(fsm, event, NULL);
 
-  TRACE_DEBUG("FSM %s: emitting postponed event %s",
-              fsm->name, fsm->show_event(postponed_event->event));
+  fsm_write_unlock(fsm, &outbox);
 
-  ret = fsm_emit_simple(fsm, postponed_event->event);
   if (ret != 0) {
-    TRACE_ERR("FSM %s: postponed event %s handled with error %d",
-              fsm->name, fsm->show_event(postponed_event->event), ret);
+    TRACE_ERR("FSM %s: timeout event %s handled with error %d",
+              fsm->class->name, fsm->class->show_event(event), ret);
   }
+}
 
-  if ((next_event != NULL) && !atomic_read(&postponed_events->cancel)) {
-    unsigned long now;
-    unsigned long delay;
 
-    now = jiffies;
+/**
+ * Converts expiration time of a timer to the time left till it in
+ * snapshot units.
+ *
+ * @param time expiration time (virtual jiffies)
+ * @param now  current virtual time
+ *
+ * @return time left (virtual ms)
+ */
+static inline u32
+fsm_snapshot_delay(unsigned long time, unsigned long now)
+{
+  return time_after(time, now) ? jiffies_to_msecs(time - now) : 0;
+}
+
+
+size_t
+fsm_snapshot(struct fsm_t *fsm, void *buffer, size_t size)
+{
+  int           i;
+  size_t        required;
+  unsigned int  count = 0;
+  unsigned long now;
+  u32           delay;
+
+  struct fsm_snapshot_t        *snapshot = buffer;
+  struct fsm_snapshot_group_t   groups[FSM_EVENTS_MAX];
+  struct fsm_snapshot_group_t  *group;
+  struct fsm_postponed_event_t *event;
+  struct fsm_outbox_t           outbox;
+
+  memset(groups, 0, sizeof(groups));
 
-    if (next_event->time < now) {
-      delay = 0;
+  fsm_write_lock(fsm, &outbox);
+
+  now = fsm_clock_now();
+
+  list_for_each_entry(event, &fsm->postponed_events, list) {
+    if (__fsm_postponed_event_is_stale(event)) {
+      continue;
+    }
+
+    delay = fsm_snapshot_delay(event->timer.time, now);
+    group = &groups[event->event];
+
+    if (group->count == 0) {
+      group->first = delay;
+      group->last  = delay;
+      ++count;
     } else {
-      delay = next_event->time - now;
+      group->first = min(group->first, delay);
+      group->last  = max(group->last, delay);
     }
 
-    TRACE_DEBUG("Rescheduling postponed events work to %us in future",
-                jiffies_to_msecs(delay) / 1000);
+    ++group->count;
+  }
 
-    schedule_delayed_work(&postponed_events->work, delay);
+  required = sizeof(*snapshot) +
+    count * sizeof(struct fsm_snapshot_group_t) +
+    fsm->class->snapshot_size;
+  if (required > size) {
+    goto out;
   }
 
-  kfree(postponed_event);
+  snapshot->state         = fsm->state;
+  snapshot->timeout_armed = fsm->timeout_armed;
+  snapshot->timeout       = fsm->timeout_armed ?
+    fsm_snapshot_delay(fsm->timeout.time, now) : 0;
+  snapshot->group_count   = count;
+  snapshot->data_size     = fsm->class->snapshot_size;
+
+  count = 0;
+  for (i = 0; i < fsm->class->event_count; ++i) {
+    if (groups[i].count != 0) {
+      snapshot->groups[count]       = groups[i];
+      snapshot->groups[count].event = i;
+      snapshot->groups[count].count =
+        min_t(u32, groups[i].count, FSM_SNAPSHOT_GROUP_MAX);
+      ++count;
+    }
+  }
+
+  if (fsm->class->save != NULL) {
+    fsm->class->save(fsm_data(fsm), &snapshot->groups[count]);
+  }
+
+out:
+  fsm_write_unlock(fsm, &outbox);
+
+  return required;
 }
 
 
-static void
-fsm_postponed_events_init(struct fsm_postponed_events_t *postponed_events)
+/**
+ * Returns delay of an event restored from the group.
+ *
+ * @param group group of postponed events
+ * @param i     index of the event in the group
+ *
+ * @return delay in virtual ms
+ */
+static u32
+fsm_snapshot_group_delay(const struct fsm_snapshot_group_t *group, u32 i)
+{
+  if (group->count == 1) {
+    return group->first;
+  }
+
+  return group->first +
+    div_u64((u64) (group->last - group->first) * i, group->count - 1);
+}
+
+
+/**
+ * Checks that snapshot can be restored into FSM.
+ *
+ * @param fsm      FSM
+ * @param snapshot snapshot
+ * @param size     size of the buffer containing the snapshot
+ *
+ * @return size of the snapshot or -EINVAL
+ */
+static ssize_t
+fsm_snapshot_check(const struct fsm_t *fsm,
+                   const struct fsm_snapshot_t *snapshot, size_t size)
+{
+  int    i;
+  size_t required;
+  u32    seen = 0;
+
+  const struct fsm_class_t          *class = fsm->class;
+  const struct fsm_snapshot_group_t *group;
+
+  BUILD_BUG_ON( FSM_EVENTS_MAX > 32 );
+
+  if (size < sizeof(*snapshot)) {
+    return -EINVAL;
+  }
+
+  /* at most one group per event type */
+  if (snapshot->group_count > class->event_count) {
+    return -EINVAL;
+  }
+
+  required = sizeof(*snapshot) +
+    snapshot->group_count * sizeof(struct fsm_snapshot_group_t) +
+    snapshot->data_size;
+  if (required > size || snapshot->data_size != class->snapshot_size) {
+    return -EINVAL;
+  }
+
+  if (snapshot->state >= class->state_count) {
+    return -EINVAL;
+  }
+
+  if (snapshot->timeout_armed &&
+      (class->timeouts == NULL ||
+       class->timeouts[snapshot->state].delay == NULL)) {
+    return -EINVAL;
+  }
+
+  for (i = 0; i < snapshot->group_count; ++i) {
+    group = &snapshot->groups[i];
+
+    if (group->event >= class->event_count ||
+        (class->handlers != NULL &&
+         class->handlers[group->event].type ==
+         FSM_EVENT_HANDLER_WITH_DATA)) {
+      return -EINVAL;
+    }
+
+    if (seen & (1U << group->event)) {
+      return -EINVAL;
+    }
+
+    seen |= 1U << group->event;
+
+    if (group->count == 0 || group->count > FSM_SNAPSHOT_GROUP_MAX ||
+        group->first > group->last) {
+      return -EINVAL;
+    }
+  }
+
+  if (class->validate != NULL &&
+      !class->validate(&snapshot->groups[snapshot->group_count])) {
+    return -EINVAL;
+  }
+
+  return required;
+}
+
+
+ssize_t
+fsm_restore_prepare(struct fsm_t *fsm, struct fsm_restore_t *restore,
+                    const void *buffer, size_t size)
+{
+  int     i;
+  u32     j;
+  ssize_t required;
+
+  const struct fsm_snapshot_t  *snapshot = buffer;
+  struct fsm_postponed_event_t *event;
+
+  required = fsm_snapshot_check(fsm, snapshot, size);
+  if (required < 0) {
+    TRACE_ERR("FSM %s: malformed snapshot", fsm->class->name);
+    return required;
+  }
+
+  restore->snapshot = snapshot;
+  INIT_LIST_HEAD(&restore->events);
+
+  for (i = 0; i < snapshot->group_count; ++i) {
+    for (j = 0; j < snapshot->groups[i].count; ++j) {
+      event = fsm_postponed_event_alloc(fsm, snapshot->groups[i].event,
+                                        GFP_KERNEL);
+      if (event == NULL) {
+        fsm_restore_abort(restore);
+        return -ENOMEM;
+      }
+
+      list_add_tail(&event->list, &restore->events);
+    }
+  }
+
+  return required;
+}
+
+
+void
+fsm_restore_commit(struct fsm_t *fsm, struct fsm_restore_t *restore)
 {
-  spin_lock_init(&postponed_events->lock);
-  INIT_DELAYED_WORK(&postponed_events->work, fsm_postponed_events_work_fn);
-  INIT_LIST_HEAD(&postponed_events->events);
-  atomic_set(&postponed_events->cancel, 0);
+  int i;
+  u32 j;
+  u64 now;
+
+  const struct fsm_snapshot_t       *snapshot = restore->snapshot;
+  const struct fsm_snapshot_group_t *group;
+
+  struct fsm_postponed_event_t *event;
+  struct fsm_outbox_t           outbox;
+
+  LIST_HEAD(events);
+
+  fsm_write_lock(fsm, &outbox);
+  write_seqcount_begin(&fsm->seq);
+
+  if (fsm->class->load != NULL) {
+    fsm->class->load(fsm_data(fsm),
+                     &snapshot->groups[snapshot->group_count]);
+  }
+
+  __fsm_detach_postponed_events(fsm, &events);
+
+  now = ktime_to_ns(ktime_get());
+  if (fsm->class->stats != NULL) {
+    fsm_stats_leave_state(*fsm->class->stats,
+                          fsm->state, now - fsm->state_since);
+  }
+
+  fsm->state       = snapshot->state;
+  fsm->state_since = now;
+
+  /* if the old timeout is firing right now it will find out that it has
+   * been re-armed or disarmed and will do nothing */
+  fsm->timeout_armed = snapshot->timeout_armed;
+  fsm->timeout_state = snapshot->state;
+  if (fsm->timeout_armed) {
+    fsm_timer_arm(&fsm->timeout,
+                  fsm_clock_now() + msecs_to_jiffies(snapshot->timeout),
+                  fsm_event_slack(fsm,
+                                  fsm->class->timeouts[fsm->state].event));
+  }
+
+  for (i = 0; i < snapshot->group_count; ++i) {
+    group = &snapshot->groups[i];
+
+    for (j = 0; j < group->count; ++j) {
+      event = list_first_entry(&restore->events,
+                               struct fsm_postponed_event_t, list);
+      list_del(&event->list);
+
+      __fsm_postponed_event_arm(event,
+                                msecs_to_jiffies(
+                                  fsm_snapshot_group_delay(group, j)));
+    }
+  }
+
+  write_seqcount_end(&fsm->seq);
+  fsm_write_unlock(fsm, &outbox);
+
+  fsm_free_postponed_events(&events);
+}
+
+
+void
+fsm_restore_abort(struct fsm_restore_t *restore)
+{
+  struct fsm_postponed_event_t *event;
+  struct fsm_postponed_event_t *tmp;
+
+  /* timers have never been armed */
+  list_for_each_entry_safe(event, tmp, &restore->events, list) {
+    list_del(&event->list);
+    kfree(event);
+  }
 }
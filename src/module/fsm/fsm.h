@@ -12,12 +12,18 @@
 #define _FSM_H_
 
 
+#include <linux/kernel.h>
 #include <linux/types.h>
 #include <linux/workqueue.h>
 #include <linux/list.h>
+#include <linux/seqlock.h>
+
+#include "utils/assert.h"
 
 #include "status/status.h"
 
+#include "fsm/timer.h"
+
 
 /// Event handler taking event-specific data.
 typedef int (*fsm_event_handler_t)(int, void *, void *);
@@ -90,23 +96,212 @@ struct fsm_event_handler_t {
               .h    = _EVENT_HANDLER_NO_DATA(_handler) }
 
 
-/// Handles postponed events.
-struct fsm_postponed_events_t {
-  spinlock_t          lock;      /**< Mutual exclusion lock. */
+/* Event and state enumerations together with their string presentations are
+ * generated from X-macro lists of the form:
+ *
+ *   #define FOO_STATES(X) X(FOO_STATE_A) X(FOO_STATE_B)
+ *
+ *   enum foo_state_t { FOO_STATES(FSM_ENUM_ITEM) __FOO_STATE_LAST };
+ *   FSM_DEFINE_TO_STR(foo_state_to_str, enum foo_state_t, FOO_STATES,
+ *                     __FOO_STATE_LAST)
+ */
+
 
-  atomic_t            cancel;    /**< Flags when no rescheduling should be
-                                  * performed. */
-  struct delayed_work work;      /**< Work doing the main job. */
-  struct list_head    events;    /**< Queue of the postponed events. */
+/// Expands an item of X-macro list into enumeration constant.
+#define FSM_ENUM_ITEM(_item) _item,
+
+
+/// Expands an item of X-macro list into its string presentation.
+#define FSM_STR_ITEM(_item) [_item] = #_item,
+
+
+/**
+ * Defines a function transforming values of enumeration generated from
+ * X-macro list to strings.
+ *
+ * @param _fn    name of the function
+ * @param _type  enumeration type
+ * @param _list  X-macro list the enumeration has been generated from
+ * @param _count number of items in the list
+ */
+#define FSM_DEFINE_TO_STR(_fn, _type, _list, _count)                    \
+  static inline const char *                                            \
+  _fn(_type value)                                                      \
+  {                                                                     \
+    static const char *strs[] = { _list(FSM_STR_ITEM) };                \
+                                                                        \
+    BUILD_BUG_ON( ARRAY_SIZE(strs) != (_count) );                       \
+    ASSERT_IN_RANGE(value, 0, (_count) - 1);                            \
+                                                                        \
+    return strs[value];                                                 \
+  }
+
+
+/// Types of transition table entries.
+enum fsm_transition_type_t {
+  FSM_TRANSITION_NONE,          /**< No entry; event is dispatched to the
+                                 * handler from the table of event
+                                 * handlers. */
+  FSM_TRANSITION_PURE,          /**< FSM just moves to the fixed state. No
+                                 * code is called. */
+  FSM_TRANSITION_ACTION,        /**< Action is called; it returns new
+                                 * state. */
+};
+
+
+/// Entry of state x event transition table.
+struct fsm_transition_t {
+  enum fsm_transition_type_t type;       /**< Entry type. */
+  int                        next_state; /**< State to move to for
+                                          * #FSM_TRANSITION_PURE entries. */
+  struct fsm_event_handler_t action;     /**< Action for
+                                          * #FSM_TRANSITION_ACTION
+                                          * entries. */
 };
 
 
-/// Single postponed event.
-struct fsm_postponed_event_t {
-  int           event;          /**< Event type. */
-  unsigned long time;           /**< Time when it should be emitted. */
+/* Transition tables are two-dimensional [state][event] arrays generated from
+ * X-macro lists of the form:
+ *
+ *   #define FOO_TRANSITIONS(PURE, ACTION)                       \
+ *     PURE  (FOO_STATE_A, FOO_EVENT_X, FOO_STATE_B)             \
+ *     ACTION(FOO_STATE_B, FOO_EVENT_X, foo_fsm_x_handler)
+ *
+ *   static const struct fsm_transition_t
+ *   foo_fsm_transitions[FOO_STATES_COUNT][FOO_EVENTS_COUNT] = {
+ *     FOO_TRANSITIONS(FSM_PURE, FSM_ACTION)
+ *   };
+ *
+ * Pairs missing from the list are dispatched to the event handlers. The list
+ * must also be checked with FSM_CHECK_TRANSITIONS().
+ */
+
+
+/**
+ * Transition table entry moving FSM to the fixed state.
+ *
+ * @param _state      current state
+ * @param _event      incoming event
+ * @param _next_state state to move to
+ */
+#define FSM_PURE(_state, _event, _next_state)                           \
+  [_state][_event] = { .type       = FSM_TRANSITION_PURE,               \
+                       .next_state = _next_state },
+
+
+/**
+ * Transition table entry calling an action that does not take event data.
+ *
+ * @param _state  current state
+ * @param _event  incoming event
+ * @param _action function to be called; returns new state
+ */
+#define FSM_ACTION(_state, _event, _action)                             \
+  [_state][_event] = {                                                  \
+    .type   = FSM_TRANSITION_ACTION,                                    \
+    .action = {                                                         \
+      .type = FSM_EVENT_HANDLER_NO_DATA,                                \
+      .h    = _EVENT_HANDLER_NO_DATA(                                   \
+                (fsm_event_handler_no_data_t) _action)                  \
+    }                                                                   \
+  },
+
+
+/**
+ * Transition table entry calling an action that takes event data.
+ *
+ * @param _state  current state
+ * @param _event  incoming event
+ * @param _action function to be called; returns new state
+ */
+#define FSM_ACTION_WITH_DATA(_state, _event, _action)                   \
+  [_state][_event] = {                                                  \
+    .type   = FSM_TRANSITION_ACTION,                                    \
+    .action = {                                                         \
+      .type = FSM_EVENT_HANDLER_WITH_DATA,                              \
+      .h    = _EVENT_HANDLER((fsm_event_handler_t) _action)             \
+    }                                                                   \
+  },
+
+
+/// Not supposed to be used directly.
+#define __FSM_CELL(_state, _event, _unused) __fsm_cell_##_state##__##_event,
+
+
+/// Not supposed to be used directly.
+#define __FSM_CHECK_PURE(_state, _event, _next_state)                   \
+  BUILD_BUG_ON( (int) (_next_state) < 0 ||                              \
+                (int) (_next_state) >= (int) __fsm_state_count );
+
+
+/// Not supposed to be used directly.
+#define __FSM_CHECK_ACTION(_state, _event, _action)                     \
+  BUILD_BUG_ON( sizeof((_action)(_state, NULL)) != sizeof(int) );
+
+
+/**
+ * Checks X-macro list of transitions at build time: every (state, event)
+ * pair must be described at most once, fixed target states must be valid and
+ * actions must be callable with state and FSM data. Must be used in function
+ * context.
+ *
+ * @param _list        X-macro list of transitions
+ * @param _state_count number of states in FSM
+ */
+#define FSM_CHECK_TRANSITIONS(_list, _state_count)                      \
+  do {                                                                  \
+    enum { _list(__FSM_CELL, __FSM_CELL) };                             \
+    enum { __fsm_state_count = (_state_count) };                        \
+                                                                        \
+    _list(__FSM_CHECK_PURE, __FSM_CHECK_ACTION)                         \
+  } while (0)
+
+
+/// Maximum number of events single FSM can have.
+#define FSM_EVENTS_MAX 8
+
 
-  struct list_head list;        /**< Forms a list of events. */
+/// Maximum number of states FSM with statistics (see fsm/stats.h) can have.
+#define FSM_STATES_MAX 8
+
+
+/// Maximum number of notifications (see fsm_notify()) that can be pending
+/// delivery from a single FSM.
+#define FSM_OUTBOX_SIZE 8
+
+
+struct fsm_stats_t;
+
+
+/// Function returning timeout of a state in virtual jiffies (see
+/// fsm/clock.h). Called with FSM's lock held every time the timer is armed,
+/// so the timeout may depend on (and update) the data handlers work on.
+typedef unsigned long (*fsm_timeout_delay_fn_t)(int state, void *data);
+
+
+/// Timeout of a state: FSM staying in the state for too long gets an event.
+struct fsm_state_timeout_t {
+  int                    event; /**< Event to emit on timeout; must not
+                                 * take data. */
+  fsm_timeout_delay_fn_t delay; /**< Returns timeout. NULL if state does not
+                                 * time out. */
+};
+
+
+/// Guard of an event: cheap precondition evaluated before taking FSM's lock.
+struct fsm_guard_t {
+  bool (*check)(int state, const void *data);  /**< Returns false if event
+                                                * can not change anything
+                                                * in the given state. Called
+                                                * on lock-free snapshot, so
+                                                * may be called several
+                                                * times and must not have
+                                                * side effects. NULL if event
+                                                * is not guarded. */
+  void (*reject)(int state, const void *data); /**< Called once (without
+                                                * locks) when event has been
+                                                * rejected by the guard; may
+                                                * be NULL. */
 };
 
 
@@ -118,57 +313,202 @@ typedef const char *(*fsm_state_show_fn_t)(int state);
 typedef const char *(*fsm_event_show_fn_t)(int event);
 
 
-/// FSM type.
-struct fsm_t {
-  rwlock_t lock;                /**< Mutual exclusion lock. */
-
-  /* read only */
-  const char *name;       /**< FSM name */
-  int   state_count;      /**< Number of states. */
-  int   event_count;      /**< Number of events. */
+/// Maximum number of postponed events of one type kept in a snapshot. FSMs
+/// with more pending events are saved with this many events spread over the
+/// same range of delays; snapshots claiming more are rejected, so that a
+/// single restore can't make the kernel allocate without bound.
+#define FSM_SNAPSHOT_GROUP_MAX 256
+
+
+/// Postponed events of the same type in FSM snapshot. Only the number of
+/// events and the range of their delays are kept, so that the size of
+/// snapshot does not depend on the number of pending events; restored events
+/// are spread evenly over the range.
+struct fsm_snapshot_group_t {
+  u32 first;                    /**< Time left till the earliest event
+                                 * (virtual ms). */
+  u32 last;                     /**< Time left till the latest event
+                                 * (virtual ms). */
+  u32 count;                    /**< Number of events; at most
+                                 * #FSM_SNAPSHOT_GROUP_MAX. */
+  u8  event;                    /**< Event type. */
+} __attribute__((packed));
+
+
+/// FSM snapshot. Followed by groups of postponed events and then by data
+/// saved by #fsm_class_t::save. Layout is a part of netlink interface (see
+/// #EATER_CMD_SNAPSHOT), so changing it requires bumping snapshot version.
+struct fsm_snapshot_t {
+  u8  state;                    /**< Current state. */
+  u8  timeout_armed;            /**< Whether state timeout is armed. */
+  u16 group_count;              /**< Number of groups of postponed events;
+                                 * at most one per event type. */
+  u32 timeout;                  /**< Time left till state timeout (virtual
+                                 * ms). */
+  u16 data_size;                /**< Size of class data. */
+
+  struct fsm_snapshot_group_t groups[]; /**< Postponed events. */
+} __attribute__((packed));
+
+
+/// FSM class: everything that is shared by all the instances of FSM. Classes
+/// are immutable and normally defined statically.
+struct fsm_class_t {
+  const char *name;             /**< FSM name. */
+  int         state_count;      /**< Number of states. */
+  int         event_count;      /**< Number of events. */
 
   fsm_state_show_fn_t show_state; /**< Showing function for states. */
   fsm_event_show_fn_t show_event; /**< Showing function for events. */
 
-  void *data;                   /**< Arbitrary data supplied by user. */
+  size_t data_offset;           /**< Offset of #fsm_t in the containing
+                                 * structure that is passed to event
+                                 * handlers. */
+
+  const struct fsm_event_handler_t *handlers;    /**< Event handlers; may be
+                                                  * NULL if transition table
+                                                  * describes all the
+                                                  * transitions. */
+  const struct fsm_transition_t    *transitions; /**< Flattened state x event
+                                                  * transition table; may be
+                                                  * NULL. */
+  const struct fsm_state_timeout_t *timeouts;    /**< State timeouts indexed
+                                                  * by state; may be
+                                                  * NULL. */
+  const struct fsm_guard_t         *guards;      /**< Event guards indexed
+                                                  * by event; may be
+                                                  * NULL. */
+  const unsigned long              *slacks;      /**< Slacks (in virtual
+                                                  * jiffies) of postponed
+                                                  * events and timeouts
+                                                  * indexed by event (see
+                                                  * fsm_timer_arm()); may
+                                                  * be NULL if all the
+                                                  * timers are exact. */
+
+  struct fsm_stats_t __percpu **stats; /**< Statistics shared by all the
+                                        * instances (see #FSM_DEFINE_STATS);
+                                        * allocated by fsm_class_init();
+                                        * may be NULL. */
+  u32 (*instance)(const void *data);   /**< Returns identifier telling
+                                        * instances apart in the journal
+                                        * (see fsm/journal.h); may be NULL
+                                        * if there's a single instance. */
+
+  size_t snapshot_size;         /**< Size of data saved in snapshots. */
+  void (*save)(const void *data, void *buffer); /**< Saves the data
+                                                 * handlers work on into
+                                                 * snapshot; may be NULL if
+                                                 * there is nothing to
+                                                 * save. */
+  bool (*validate)(const void *buffer);         /**< Checks the data saved
+                                                 * in snapshot before
+                                                 * anything is restored;
+                                                 * may be NULL if any data
+                                                 * are valid. */
+  void (*load)(void *data, const void *buffer); /**< Loads the data from
+                                                 * validated snapshot. */
+};
+
 
-  const struct fsm_event_handler_t *handlers; /**< Event handlers. */
+struct fsm_t;
 
-  /* read/write */
-  int                  state;           /**< Current state. */
-  struct status_attr_t state_attr;      /**< State sysfs attribute. */
 
-  struct fsm_postponed_events_t postponed_events; /**< Postponed events. */
+/// FSM instance. Only the mutable state lives here. Fields touched by every
+/// emitted event go first so that they share a cache line; timers are only
+/// touched on transitions and expirations.
+struct fsm_t {
+  /* hot */
+  const struct fsm_class_t *class; /**< FSM class. */
+  rwlock_t   lock;                 /**< Mutual exclusion lock. */
+  seqcount_t seq;                  /**< Publishes state and user data to
+                                    * lock-free readers. */
+  int        state;                /**< Current state. */
+  u64        state_since;          /**< When current state has been entered
+                                    * (monotonic ns). */
+
+  bool timeout_armed;           /**< Whether state timeout is armed. */
+  bool timeout_restart;         /**< State timeout should be re-armed even
+                                 * if current transition does not change
+                                 * state. */
+  int  timeout_state;           /**< State timeout is armed for. */
+
+  /* cold */
+  struct fsm_timer_t timeout;   /**< State timeout timer. */
+
+  struct list_head postponed_events; /**< Pending postponed events. */
+  u32 generations[FSM_EVENTS_MAX];   /**< Current generation of each event
+                                      * type. Events postponed in the older
+                                      * generations are canceled. */
 };
 
 
 /**
- * Initialized FSM.
+ * Allocates everything shared by the instances of the class (i.e.
+ * statistics). Must be called before the first instance is initialized.
+ *
+ * @param class FSM class
+ *
+ * @retval  0 success
+ * @retval <0 error occurred
+ */
+int
+fsm_class_init(const struct fsm_class_t *class);
+
+
+/**
+ * Frees everything allocated by fsm_class_init(). All the instances must be
+ * cleaned up by now.
  *
- * @param fsm         FSM to initialize.
- * @param name        Name of FSM.
- * @param state_count Number of states in FSM.
- * @param event_count Number of events in FSM
- * @param show_state  Showing function for states.
- * @param show_event  Showing function for events.
- * @param handlers    Table of event handlers.
+ * @param class FSM class
+ */
+void
+fsm_class_cleanup(const struct fsm_class_t *class);
+
+
+/**
+ * Initializes FSM instance. FSM is put into the state 0.
+ *
+ * @param fsm   FSM to initialize.
+ * @param class FSM class; must outlive the instance.
  *
  * @retval  0 FSM initialized successfully
  * @retval <0 error occurred
  */
 int
-fsm_init(struct fsm_t *fsm,
-         const char *name,
-         int state_count,
-         int event_count,
-         fsm_state_show_fn_t show_state,
-         fsm_event_show_fn_t show_event,
-         void *data,
-         const struct fsm_event_handler_t handlers[]);
+fsm_init(struct fsm_t *fsm, const struct fsm_class_t *class);
 
 
 /**
- * Frees the memory hold by FSM and removes FSM's attributes from sysfs.
+ * Returns the structure FSM is embedded into.
+ *
+ * @param fsm FSM
+ *
+ * @return data passed to event handlers
+ */
+static inline void *
+fsm_data(const struct fsm_t *fsm)
+{
+  return (char *) fsm - fsm->class->data_offset;
+}
+
+
+/**
+ * Makes timeout of the state FSM will be in after the current transition to
+ * be re-armed even if the state is not changed. Can be called only from
+ * event handlers.
+ *
+ * @param fsm FSM
+ */
+static inline void
+fsm_restart_state_timeout(struct fsm_t *fsm)
+{
+  fsm->timeout_restart = true;
+}
+
+
+/**
+ * Cancels all the pending timers of FSM and frees the memory hold by it.
  *
  * @param fsm FSM
  */
@@ -206,13 +546,36 @@ int
 fsm_emit_simple(struct fsm_t *fsm, int event);
 
 
+/**
+ * Feeds a vector of events to FSM under a single lock acquisition. Events are
+ * dispatched in order; failure of one event does not prevent the following
+ * ones from being dispatched. Guards are checked under the lock against the
+ * state left by the preceding events.
+ *
+ * @param fsm     FSM
+ * @param events  event types
+ * @param data    data for event handlers; may be NULL if none of the events
+ *                takes data
+ * @param results per-event results (0 or error returned by event handler;
+ *                0 for events rejected by guards); may be NULL
+ * @param count   number of events
+ *
+ * @retval  0 all the events have been handled successfully
+ * @retval <0 error returned by the handler of the first failed event
+ */
+int
+fsm_emit_batch(struct fsm_t *fsm,
+               const int events[], void *data[], int results[], size_t count);
+
+
 /**
  * Postpones event to the future. Handler for the event must not take
- * arguments.
+ * arguments. Can be called only from event handlers. Memory for the event is
+ * allocated atomically.
  *
  * @param fsm    FSM
  * @param event  event type
- * @param delay  delay in jiffies
+ * @param delay  delay in virtual jiffies (see fsm/clock.h)
  *
  * @return execution status
  */
@@ -222,7 +585,30 @@ fsm_postpone_event(struct fsm_t *fsm,
 
 
 /**
- * Cancels postponed events.
+ * Posts event to another FSM. The event is emitted only after the lock of
+ * posting FSM has been released, so handlers never hold locks of two FSMs at
+ * once and no lock ordering between FSMs is needed. Notifications are
+ * delivered in the order they have been posted, before the call that has
+ * dispatched the posting handler (e.g. fsm_emit()) returns; those posted by
+ * the delivered events are delivered right after them. Can be called only
+ * from event handlers.
+ *
+ * Callers must handle failure: a dropped notification is not retried.
+ *
+ * @param fsm    FSM whose handler posts the notification
+ * @param target FSM to notify
+ * @param event  event type; its handler must not take data
+ *
+ * @retval       0 success
+ * @retval -ENOSPC too many notifications are pending (see #FSM_OUTBOX_SIZE)
+ */
+int
+fsm_notify(struct fsm_t *fsm, struct fsm_t *target, int event);
+
+
+/**
+ * Cancels all the postponed events. Waits for the events being emitted at the
+ * moment. Must not be called from event handlers.
  *
  * @param fsm FSM
  */
@@ -231,7 +617,10 @@ fsm_cancel_postponed_events(struct fsm_t *fsm);
 
 
 /**
- * Cancels all the events of specific types.
+ * Cancels all the events of specific types. Pending events are unlinked and
+ * freed right away; the ones that are being emitted at the moment are
+ * skipped. Does not wait for anything, so can be called from event handlers
+ * (and only from them).
  *
  * @param fsm   FSM
  * @param event event
@@ -240,34 +629,137 @@ void
 fsm_cancel_postponed_events_by_type(struct fsm_t *fsm, int event);
 
 
+/**
+ * Saves FSM state, pending postponed events grouped by type (see
+ * #fsm_snapshot_group_t) and state timeout (as the time left till them) and
+ * the data handlers work on into the buffer. Must not be
+ * called from event handlers.
+ *
+ * @param fsm    FSM
+ * @param buffer buffer to write #fsm_snapshot_t to
+ * @param size   size of the buffer
+ *
+ * @return size of the snapshot; if it's larger than the size of the buffer
+ *         nothing is written
+ */
+size_t
+fsm_snapshot(struct fsm_t *fsm, void *buffer, size_t size);
+
+
+/// Snapshot prepared to be restored into FSM (see fsm_restore_prepare()).
+struct fsm_restore_t {
+  const struct fsm_snapshot_t *snapshot; /**< Validated snapshot. */
+  struct list_head             events;   /**< Postponed events allocated
+                                          * in advance. */
+};
+
+
+/**
+ * Prepares restoring FSM from the snapshot made by fsm_snapshot(): checks
+ * the snapshot and allocates everything restoring it requires, so that
+ * fsm_restore_commit() can't fail. Several FSMs may be prepared before any
+ * of them is committed to restore them all or none. May sleep.
+ *
+ * @param fsm     FSM
+ * @param restore restore to prepare; must be passed either to
+ *                fsm_restore_commit() or to fsm_restore_abort()
+ * @param buffer  buffer containing #fsm_snapshot_t; must not change till
+ *                the restore is committed
+ * @param size    size of the buffer
+ *
+ * @retval >0 size of the snapshot read from the buffer
+ * @retval <0 error code; -EINVAL if snapshot is malformed; nothing needs to
+ *            be aborted then
+ */
+ssize_t
+fsm_restore_prepare(struct fsm_t *fsm, struct fsm_restore_t *restore,
+                    const void *buffer, size_t size);
+
+
+/**
+ * Restores FSM from prepared snapshot. Pending postponed events are replaced
+ * by the ones from the snapshot. Must not be called from event handlers.
+ *
+ * @param fsm     FSM passed to fsm_restore_prepare()
+ * @param restore prepared restore
+ */
+void
+fsm_restore_commit(struct fsm_t *fsm, struct fsm_restore_t *restore);
+
+
+/**
+ * Frees everything allocated by fsm_restore_prepare() leaving FSM intact.
+ *
+ * @param restore prepared restore
+ */
+void
+fsm_restore_abort(struct fsm_restore_t *restore);
+
+
 /* It's guaranteed that event handlers are executed with exclusive access to
  * the fsm. And it's encouraged to structure the code in the way this is also
- * ensures exclusive access to the containing structure. In this case the
- * following operations can be used to lock fsm (and containing structure)
- * for read-only accesses.  */
+ * ensures exclusive access to the containing structure. Every dispatch is
+ * wrapped into a write section of FSM's sequence counter. So the containing
+ * structure can be read without taking any locks:
+ *
+ *   do {
+ *     seq   = fsm_read_begin(fsm);
+ *     value = container->value;
+ *   } while (fsm_read_retry(fsm, seq));
+ */
 
 
 /**
- * Locks FSM for read-only accesses.
+ * Shows current state of FSM. Supposed to be used as a #status_attr_t show
+ * function with FSM as private data (see #FSM_STATE_ATTR).
+ *
+ * @param name   attribute name
+ * @param fsm    FSM
+ * @param buffer buffer to write the state to
  *
- * @param fsm FSM to lock
+ * @return number of bytes written
  */
-static inline void
-fsm_read_lock(const struct fsm_t *fsm)
+ssize_t
+fsm_state_attr_show(const char *name, const struct fsm_t *fsm, char *buffer);
+
+
+/**
+ * Initializer of status attribute exporting FSM's state.
+ *
+ * @param _name attribute name
+ * @param _fsm  FSM
+ */
+#define FSM_STATE_ATTR(_name, _fsm)                                     \
+  STATUS_ATTR(_name, (status_attr_show_t) fsm_state_attr_show, _fsm)
+
+
+/**
+ * Starts lock-free read-only access to FSM (and containing structure).
+ *
+ * @param fsm FSM to read
+ *
+ * @return sequence number to be passed to fsm_read_retry()
+ */
+static inline unsigned
+fsm_read_begin(const struct fsm_t *fsm)
 {
-  read_lock(&fsm->lock);
+  return read_seqcount_begin(&fsm->seq);
 }
 
 
 /**
- * Unlocks FSM previously locked by fsm_read_lock() function.
+ * Checks whether data read after fsm_read_begin() call is consistent.
  *
- * @param fsm FSM to unlock
+ * @param fsm FSM
+ * @param seq sequence number returned by fsm_read_begin()
+ *
+ * @retval true  FSM has been modified concurrently; read must be retried
+ * @retval false read data is consistent
  */
-static inline void
-fsm_read_unlock(const struct fsm_t *fsm)
+static inline bool
+fsm_read_retry(const struct fsm_t *fsm, unsigned seq)
 {
-  read_unlock(&fsm->lock);
+  return read_seqcount_retry(&fsm->seq, seq);
 }
 
 
@@ -0,0 +1,211 @@
+/**
+ * @file   fsm_trace.h
+ *
+ * @brief Tracepoints of FSM framework. Available under 'eater_fsm' system in
+ * ftrace and perf. States and events are recorded by their names, so the
+ * records stay readable after the module has been unloaded.
+ *
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM eater_fsm
+
+#if !defined(_FSM__FSM_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _FSM__FSM_TRACE_H_
+
+
+#include <linux/tracepoint.h>
+
+#include "fsm/fsm.h"
+
+
+/// Event is about to be dispatched.
+TRACE_EVENT(fsm_emit,
+
+  TP_PROTO(const struct fsm_t *fsm, int event),
+
+  TP_ARGS(fsm, event),
+
+  TP_STRUCT__entry(
+    __string(fsm,   fsm->class->name)
+    __string(state, fsm->class->show_state(fsm->state))
+    __string(event, fsm->class->show_event(event))
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,   fsm->class->name);
+    __assign_str(state, fsm->class->show_state(fsm->state));
+    __assign_str(event, fsm->class->show_event(event));
+  ),
+
+  TP_printk("%s: state %s, event %s",
+            __get_str(fsm), __get_str(state), __get_str(event))
+);
+
+
+/// Event has been dispatched.
+TRACE_EVENT(fsm_transition,
+
+  TP_PROTO(const struct fsm_t *fsm,
+           int event, int old_state, int new_state, int result),
+
+  TP_ARGS(fsm, event, old_state, new_state, result),
+
+  TP_STRUCT__entry(
+    __string(fsm,       fsm->class->name)
+    __string(event,     fsm->class->show_event(event))
+    __string(old_state, fsm->class->show_state(old_state))
+    __string(new_state, fsm->class->show_state(new_state))
+    __field(int,        result)
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,       fsm->class->name);
+    __assign_str(event,     fsm->class->show_event(event));
+    __assign_str(old_state, fsm->class->show_state(old_state));
+    __assign_str(new_state, fsm->class->show_state(new_state));
+    __entry->result = result;
+  ),
+
+  TP_printk("%s: %s --%s--> %s (result %d)",
+            __get_str(fsm), __get_str(old_state), __get_str(event),
+            __get_str(new_state), __entry->result)
+);
+
+
+/// Event has been rejected by its guard without taking FSM's lock.
+TRACE_EVENT(fsm_reject,
+
+  TP_PROTO(const struct fsm_t *fsm, int event, int state),
+
+  TP_ARGS(fsm, event, state),
+
+  TP_STRUCT__entry(
+    __string(fsm,   fsm->class->name)
+    __string(state, fsm->class->show_state(state))
+    __string(event, fsm->class->show_event(event))
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,   fsm->class->name);
+    __assign_str(state, fsm->class->show_state(state));
+    __assign_str(event, fsm->class->show_event(event));
+  ),
+
+  TP_printk("%s: state %s, event %s rejected by guard",
+            __get_str(fsm), __get_str(state), __get_str(event))
+);
+
+
+/// Event has been postponed or state timeout has been armed.
+TRACE_EVENT(fsm_postpone,
+
+  TP_PROTO(const struct fsm_t *fsm,
+           int event, unsigned long delay, bool timeout),
+
+  TP_ARGS(fsm, event, delay, timeout),
+
+  TP_STRUCT__entry(
+    __string(fsm,   fsm->class->name)
+    __string(event, fsm->class->show_event(event))
+    __field(unsigned long, delay)
+    __field(bool,          timeout)
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,   fsm->class->name);
+    __assign_str(event, fsm->class->show_event(event));
+    __entry->delay   = delay;
+    __entry->timeout = timeout;
+  ),
+
+  TP_printk("%s: %s %s in %lu jiffies",
+            __get_str(fsm), __entry->timeout ? "timeout" : "postponed",
+            __get_str(event), __entry->delay)
+);
+
+
+/// Postponed events have been canceled.
+TRACE_EVENT(fsm_cancel,
+
+  TP_PROTO(const struct fsm_t *fsm, int event),
+
+  TP_ARGS(fsm, event),
+
+  TP_STRUCT__entry(
+    __string(fsm,   fsm->class->name)
+    __string(event, event < 0 ? "*" : fsm->class->show_event(event))
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,   fsm->class->name);
+    __assign_str(event, event < 0 ? "*" : fsm->class->show_event(event));
+  ),
+
+  TP_printk("%s: canceled %s", __get_str(fsm), __get_str(event))
+);
+
+
+/// Notification of another FSM has been posted by an event handler.
+TRACE_EVENT(fsm_notify,
+
+  TP_PROTO(const struct fsm_t *fsm, const struct fsm_t *target, int event),
+
+  TP_ARGS(fsm, target, event),
+
+  TP_STRUCT__entry(
+    __string(fsm,    fsm->class->name)
+    __string(target, target->class->name)
+    __string(event,  target->class->show_event(event))
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,    fsm->class->name);
+    __assign_str(target, target->class->name);
+    __assign_str(event,  target->class->show_event(event));
+  ),
+
+  TP_printk("%s: notified %s of %s",
+            __get_str(fsm), __get_str(target), __get_str(event))
+);
+
+
+/// Timer of postponed event or state timeout has fired.
+TRACE_EVENT(fsm_timer_fire,
+
+  TP_PROTO(const struct fsm_t *fsm, int event, bool timeout, bool stale),
+
+  TP_ARGS(fsm, event, timeout, stale),
+
+  TP_STRUCT__entry(
+    __string(fsm,   fsm->class->name)
+    __string(event, fsm->class->show_event(event))
+    __field(bool,   timeout)
+    __field(bool,   stale)
+  ),
+
+  TP_fast_assign(
+    __assign_str(fsm,   fsm->class->name);
+    __assign_str(event, fsm->class->show_event(event));
+    __entry->timeout = timeout;
+    __entry->stale   = stale;
+  ),
+
+  TP_printk("%s: %s %s%s",
+            __get_str(fsm), __entry->timeout ? "timeout" : "postponed",
+            __get_str(event), __entry->stale ? " (stale)" : "")
+);
+
+
+#endif /* _FSM__FSM_TRACE_H_ */
+
+
+/* module's build directory is in include path, so the path is relative to
+ * it */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH fsm
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fsm_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,265 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+
+#include "utils/trace.h"
+#include "utils/assert.h"
+
+#include "fsm/journal.h"
+
+
+/// Ring buffer of journal records.
+struct fsm_journal_ring_t {
+  unsigned long head;           /**< Number of records ever written; the
+                                 * next record goes to head % size. */
+  struct fsm_journal_record_t records[FSM_JOURNAL_SIZE]; /**< Records. */
+};
+
+
+/// Journal snapshot taken when journal file is opened.
+struct fsm_journal_snapshot_t {
+  size_t                      count;     /**< Number of records. */
+  struct fsm_journal_record_t records[]; /**< Records. */
+};
+
+
+/// Per-CPU rings. Allocated dynamically since they are too large for the
+/// per-CPU area reserved for modules.
+static struct fsm_journal_ring_t __percpu *fsm_journal_rings;
+
+
+/// Module's debugfs directory.
+static struct dentry *fsm_journal_dir;
+
+
+/**
+ * Takes a snapshot of all the rings.
+ *
+ * @param inode journal file inode
+ * @param file  opened file
+ *
+ * @retval  0 success
+ * @retval <0 error code
+ */
+static int
+fsm_journal_open(struct inode *inode, struct file *file);
+
+
+/**
+ * Reads the snapshot taken on open.
+ *
+ * @param file   opened file
+ * @param buffer user buffer
+ * @param count  size of user buffer
+ * @param ppos   file position
+ *
+ * @return number of bytes read or error code
+ */
+static ssize_t
+fsm_journal_read(struct file *file,
+                 char __user *buffer, size_t count, loff_t *ppos);
+
+
+/**
+ * Frees the snapshot.
+ *
+ * @param inode journal file inode
+ * @param file  opened file
+ *
+ * @return 0
+ */
+static int
+fsm_journal_release(struct inode *inode, struct file *file);
+
+
+/// Journal file operations.
+static const struct file_operations fsm_journal_fops = {
+  .owner   = THIS_MODULE,
+  .open    = fsm_journal_open,
+  .read    = fsm_journal_read,
+  .release = fsm_journal_release,
+  .llseek  = default_llseek,
+};
+
+
+int
+fsm_journal_init(void)
+{
+  struct dentry *file;
+
+  BUILD_BUG_ON( FSM_JOURNAL_SIZE & (FSM_JOURNAL_SIZE - 1) );
+
+  fsm_journal_rings = alloc_percpu(struct fsm_journal_ring_t);
+  if (fsm_journal_rings == NULL) {
+    TRACE_ERR("Failed to allocate FSM journal");
+    return -ENOMEM;
+  }
+
+  fsm_journal_dir = debugfs_create_dir("eater", NULL);
+  if (IS_ERR_OR_NULL(fsm_journal_dir)) {
+    /* journal is still recorded; it just can't be read */
+    TRACE_WARNING("debugfs is not available; FSM journal is not exported");
+    fsm_journal_dir = NULL;
+    return 0;
+  }
+
+  file = debugfs_create_file("journal", S_IRUSR, fsm_journal_dir,
+                             NULL, &fsm_journal_fops);
+  if (IS_ERR_OR_NULL(file)) {
+    TRACE_ERR("Failed to create FSM journal file in debugfs");
+    debugfs_remove_recursive(fsm_journal_dir);
+    fsm_journal_dir = NULL;
+    free_percpu(fsm_journal_rings);
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
+
+void
+fsm_journal_cleanup(void)
+{
+  debugfs_remove_recursive(fsm_journal_dir);
+  fsm_journal_dir = NULL;
+
+  free_percpu(fsm_journal_rings);
+  fsm_journal_rings = NULL;
+}
+
+
+void
+fsm_journal_record(const char *fsm, u32 instance, u64 time, u32 duration,
+                   int event, int old_state, int new_state, int result)
+{
+  unsigned long                head;
+  struct fsm_journal_ring_t   *ring;
+  struct fsm_journal_record_t *record;
+
+  ring   = get_cpu_ptr(fsm_journal_rings);
+  head   = ring->head;
+  record = &ring->records[head & (FSM_JOURNAL_SIZE - 1)];
+
+  /* readers must not see the record being overwritten before they see the
+   * head of the previous one */
+  smp_wmb();
+
+  record->time      = time;
+  record->duration  = duration;
+  record->result    = result;
+  record->instance  = instance;
+  record->event     = event;
+  record->old_state = old_state;
+  record->new_state = new_state;
+  record->cpu       = smp_processor_id();
+  strncpy(record->fsm, fsm, FSM_JOURNAL_NAME_SIZE - 1);
+  record->fsm[FSM_JOURNAL_NAME_SIZE - 1] = '\0';
+
+  smp_wmb();
+  ring->head = head + 1;
+
+  put_cpu_ptr(fsm_journal_rings);
+}
+
+
+/**
+ * Copies records of one ring to the buffer. Records that might have been
+ * overwritten while copying are dropped.
+ *
+ * @param ring    ring to copy
+ * @param records buffer of at least #FSM_JOURNAL_SIZE records
+ *
+ * @return number of records copied
+ */
+static size_t
+fsm_journal_copy_ring(const struct fsm_journal_ring_t *ring,
+                      struct fsm_journal_record_t *records)
+{
+  unsigned long head;
+  unsigned long new_head;
+  unsigned long first;
+  unsigned long valid;
+  unsigned long i;
+
+  head = ACCESS_ONCE(ring->head);
+  smp_rmb();
+
+  first = head - min_t(unsigned long, head, FSM_JOURNAL_SIZE);
+
+  for (i = first; i != head; ++i) {
+    records[i - first] = ring->records[i & (FSM_JOURNAL_SIZE - 1)];
+  }
+
+  smp_rmb();
+  new_head = ACCESS_ONCE(ring->head);
+
+  /* the writer may be overwriting the record with index new_head -
+   * FSM_JOURNAL_SIZE right now; everything before it has already been
+   * overwritten */
+  if (new_head - first >= FSM_JOURNAL_SIZE) {
+    valid = new_head - FSM_JOURNAL_SIZE + 1;
+    if (valid - first >= head - first) {
+      return 0;
+    }
+
+    memmove(records, records + (valid - first),
+            (head - valid) * sizeof(*records));
+    first = valid;
+  }
+
+  return head - first;
+}
+
+
+static int
+fsm_journal_open(struct inode *inode, struct file *file)
+{
+  int cpu;
+
+  struct fsm_journal_snapshot_t *snapshot;
+
+  snapshot = vmalloc(sizeof(*snapshot) +
+                     nr_cpu_ids * FSM_JOURNAL_SIZE *
+                     sizeof(struct fsm_journal_record_t));
+  if (snapshot == NULL) {
+    return -ENOMEM;
+  }
+
+  snapshot->count = 0;
+
+  for_each_possible_cpu(cpu) {
+    snapshot->count +=
+      fsm_journal_copy_ring(per_cpu_ptr(fsm_journal_rings, cpu),
+                            &snapshot->records[snapshot->count]);
+  }
+
+  file->private_data = snapshot;
+
+  return 0;
+}
+
+
+static ssize_t
+fsm_journal_read(struct file *file,
+                 char __user *buffer, size_t count, loff_t *ppos)
+{
+  struct fsm_journal_snapshot_t *snapshot = file->private_data;
+
+  return simple_read_from_buffer(buffer, count, ppos, snapshot->records,
+                                 snapshot->count *
+                                 sizeof(struct fsm_journal_record_t));
+}
+
+
+static int
+fsm_journal_release(struct inode *inode, struct file *file)
+{
+  vfree(file->private_data);
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file   journal.h
+ *
+ * @brief Journal of FSM transitions. Every dispatched event is recorded into
+ * a per-CPU ring buffer without taking any locks. The most recent records
+ * from all the CPUs can be read as a binary stream of #fsm_journal_record_t
+ * structures from 'eater/journal' file in debugfs. Records from different
+ * CPUs are not merged, so the stream should be sorted by time by the reader.
+ * Records of different instances of the same FSM class are told apart by
+ * the instance identifier (e.g. eater identifier for brain FSMs).
+ *
+ *
+ */
+
+#ifndef _FSM__JOURNAL_H_
+#define _FSM__JOURNAL_H_
+
+
+#include <linux/types.h>
+
+
+/// Number of records kept per CPU. Must be a power of two.
+#define FSM_JOURNAL_SIZE 512
+
+
+/// Maximum length of FSM name stored in the journal (including terminating
+/// zero; longer names are truncated).
+#define FSM_JOURNAL_NAME_SIZE 16
+
+
+/// Single journal record. Layout is a part of debugfs interface.
+struct fsm_journal_record_t {
+  u64  time;                    /**< Monotonic time when the event has been
+                                 * dispatched (ns). */
+  u32  duration;                /**< Time spent in the handler (ns). */
+  s32  result;                  /**< New state or error returned by the
+                                 * handler. */
+  u32  instance;                /**< Identifier of FSM instance (see
+                                 * #fsm_class_t::instance). */
+  u8   event;                   /**< Event type. */
+  u8   old_state;               /**< State before the event. */
+  u8   new_state;               /**< State after the event. */
+  u8   cpu;                     /**< CPU event has been dispatched on. */
+  char fsm[FSM_JOURNAL_NAME_SIZE]; /**< FSM name. */
+} __attribute__((packed));
+
+
+/**
+ * Allocates per-CPU rings and creates journal file in debugfs.
+ *
+ * @retval  0 success
+ * @retval <0 error occurred
+ */
+int
+fsm_journal_init(void);
+
+
+/**
+ * Removes journal file from debugfs and frees the rings.
+ */
+void
+fsm_journal_cleanup(void);
+
+
+/**
+ * Records dispatched event. Called with FSM lock held.
+ *
+ * @param fsm       FSM name
+ * @param instance  identifier of FSM instance
+ * @param time      time event has been dispatched at (ns)
+ * @param duration  time spent in the handler (ns)
+ * @param event     event type
+ * @param old_state state before the event
+ * @param new_state state after the event
+ * @param result    value returned by the handler
+ */
+void
+fsm_journal_record(const char *fsm, u32 instance, u64 time, u32 duration,
+                   int event, int old_state, int new_state, int result);
+
+
+#endif /* _FSM__JOURNAL_H_ */
@@ -0,0 +1,126 @@
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/time.h>
+#include <linux/math64.h>
+
+#include "fsm/fsm.h"
+#include "fsm/stats.h"
+
+
+/**
+ * Folds per-CPU statistics.
+ *
+ * @param stats class statistics
+ * @param total folded statistics
+ */
+static void
+fsm_stats_fold(struct fsm_stats_t __percpu *stats, struct fsm_stats_t *total)
+{
+  int i;
+  int cpu;
+
+  const struct fsm_stats_t *local;
+
+  memset(total, 0, sizeof(*total));
+
+  for_each_possible_cpu(cpu) {
+    local = per_cpu_ptr(stats, cpu);
+
+    for (i = 0; i < FSM_EVENTS_MAX; ++i) {
+      total->events[i] += local->events[i];
+    }
+
+    for (i = 0; i < FSM_STATES_MAX; ++i) {
+      total->residency[i] += local->residency[i];
+    }
+
+    for (i = 0; i < FSM_STATS_HIST_BUCKETS; ++i) {
+      total->handler_hist[i]   += local->handler_hist[i];
+      total->lock_wait_hist[i] += local->lock_wait_hist[i];
+    }
+  }
+}
+
+
+/**
+ * Shows non-empty buckets of latency histogram.
+ *
+ * @param title  histogram title
+ * @param hist   histogram
+ * @param buffer buffer to write to
+ * @param size   size of the buffer
+ *
+ * @return number of bytes written
+ */
+static ssize_t
+fsm_stats_show_hist(const char *title, const u64 hist[],
+                    char *buffer, size_t size)
+{
+  int     i;
+  ssize_t count;
+
+  count = scnprintf(buffer, size, "%s (ns):\n", title);
+
+  for (i = 0; i < FSM_STATS_HIST_BUCKETS; ++i) {
+    if (hist[i] == 0) {
+      continue;
+    }
+
+    if (i == 0) {
+      count += scnprintf(buffer + count, size - count,
+                         "  0: %llu\n", hist[i]);
+    } else if (i == FSM_STATS_HIST_BUCKETS - 1) {
+      count += scnprintf(buffer + count, size - count,
+                         "  %llu+: %llu\n", 1ULL << (i - 1), hist[i]);
+    } else {
+      count += scnprintf(buffer + count, size - count,
+                         "  %llu-%llu: %llu\n",
+                         1ULL << (i - 1), (1ULL << i) - 1, hist[i]);
+    }
+  }
+
+  return count;
+}
+
+
+ssize_t
+fsm_stats_attr_show(const char *name, const struct fsm_t *fsm, char *buffer)
+{
+  int     i;
+  ssize_t count;
+
+  const struct fsm_class_t *class = fsm->class;
+  struct fsm_stats_t        total;
+
+  if (class->stats == NULL) {
+    return -ENOENT;
+  }
+
+  fsm_stats_fold(*class->stats, &total);
+
+  /* the file is exported along with a single instance, so it's made clear
+   * that the numbers are not about that instance alone */
+  count = scnprintf(buffer, PAGE_SIZE, "class %s (all instances)\n",
+                    class->name);
+
+  count += scnprintf(buffer + count, PAGE_SIZE - count, "events:\n");
+  for (i = 0; i < class->event_count; ++i) {
+    count += scnprintf(buffer + count, PAGE_SIZE - count, "  %s: %llu\n",
+                       class->show_event(i), total.events[i]);
+  }
+
+  count += scnprintf(buffer + count, PAGE_SIZE - count,
+                     "residency in left states (ms):\n");
+  for (i = 0; i < class->state_count; ++i) {
+    count += scnprintf(buffer + count, PAGE_SIZE - count, "  %s: %llu\n",
+                       class->show_state(i),
+                       div_u64(total.residency[i], NSEC_PER_MSEC));
+  }
+
+  count += fsm_stats_show_hist("handler time", total.handler_hist,
+                               buffer + count, PAGE_SIZE - count);
+  count += fsm_stats_show_hist("lock wait time", total.lock_wait_hist,
+                               buffer + count, PAGE_SIZE - count);
+
+  return count;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file   stats.h
+ *
+ * @brief Statistics of FSM classes: per-event counters, per-state residency
+ * time and log2 histograms of handler execution and lock wait times. The
+ * counters are per-CPU and are updated with FSM lock held; they are folded
+ * only when statistics are read.
+ *
+ *
+ */
+
+#ifndef _FSM__STATS_H_
+#define _FSM__STATS_H_
+
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+
+#include "status/status.h"
+
+#include "fsm/fsm.h"
+
+
+/// Number of buckets in latency histograms. Bucket 0 counts zero latencies;
+/// bucket i counts latencies from [2^(i - 1), 2^i) ns; the last bucket also
+/// counts everything above.
+#define FSM_STATS_HIST_BUCKETS 32
+
+
+/// Statistics of one CPU, shared by all the instances of a class.
+struct fsm_stats_t {
+  u64 events[FSM_EVENTS_MAX];    /**< Number of dispatched events. */
+  u64 residency[FSM_STATES_MAX]; /**< Time spent in states (ns); updated
+                                  * when state is left. */
+
+  u64 handler_hist[FSM_STATS_HIST_BUCKETS];   /**< Handler execution
+                                               * times. */
+  u64 lock_wait_hist[FSM_STATS_HIST_BUCKETS]; /**< Times spent waiting for
+                                               * FSM lock. */
+};
+
+
+/**
+ * Defines statistics of FSM class. Statistics are allocated dynamically by
+ * fsm_class_init(), since static per-CPU data of modules is scarce.
+ *
+ * @param _name name of the variable to be referred from the class (as
+ *              &_name)
+ */
+#define FSM_DEFINE_STATS(_name) \
+  static struct fsm_stats_t __percpu *_name
+
+
+/**
+ * Returns histogram bucket for the latency.
+ *
+ * @param ns latency in nanoseconds
+ *
+ * @return bucket index
+ */
+static inline int
+fsm_stats_bucket(u64 ns)
+{
+  return min(fls64(ns), FSM_STATS_HIST_BUCKETS - 1);
+}
+
+
+/**
+ * Accounts dispatched event. FSM lock must be held by the caller.
+ *
+ * @param stats   class statistics
+ * @param event   event type
+ * @param handler handler execution time (ns)
+ */
+static inline void
+fsm_stats_event(struct fsm_stats_t __percpu *stats, int event, u64 handler)
+{
+  struct fsm_stats_t *local = this_cpu_ptr(stats);
+
+  ++local->events[event];
+  ++local->handler_hist[fsm_stats_bucket(handler)];
+}
+
+
+/**
+ * Accounts time spent waiting for FSM lock. FSM lock must be held by the
+ * caller.
+ *
+ * @param stats class statistics
+ * @param wait  wait time (ns)
+ */
+static inline void
+fsm_stats_lock_wait(struct fsm_stats_t __percpu *stats, u64 wait)
+{
+  ++this_cpu_ptr(stats)->lock_wait_hist[fsm_stats_bucket(wait)];
+}
+
+
+/**
+ * Accounts time spent in the state that is being left. FSM lock must be held
+ * by the caller.
+ *
+ * @param stats class statistics
+ * @param state state that is left
+ * @param time  time spent in the state (ns)
+ */
+static inline void
+fsm_stats_leave_state(struct fsm_stats_t __percpu *stats, int state, u64 time)
+{
+  this_cpu_ptr(stats)->residency[state] += time;
+}
+
+
+/**
+ * Shows statistics of FSM's class, i.e. summed over all the instances; the
+ * output says so in the first line. Residency counts only the states that
+ * have been left, since time spent in the current states of other instances
+ * is not known. Supposed to be used as a #status_attr_t show function with
+ * any instance of the class as private data (see #FSM_STATS_ATTR).
+ *
+ * @param name   attribute name
+ * @param fsm    FSM
+ * @param buffer buffer to write statistics to
+ *
+ * @return number of bytes written
+ */
+ssize_t
+fsm_stats_attr_show(const char *name, const struct fsm_t *fsm, char *buffer);
+
+
+/**
+ * Initializer of status attribute exporting statistics of FSM's class.
+ *
+ * @param _name attribute name
+ * @param _fsm  FSM whose class statistics are shown
+ */
+#define FSM_STATS_ATTR(_name, _fsm)                                     \
+  STATUS_ATTR(_name, (status_attr_show_t) fsm_stats_attr_show, _fsm)
+
+
+#endif /* _FSM__STATS_H_ */
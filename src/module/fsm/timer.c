@@ -0,0 +1,533 @@
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+
+#include "utils/trace.h"
+#include "utils/assert.h"
+#include "status/status.h"
+
+#include "fsm/clock.h"
+#include "fsm/timer.h"
+
+
+/// Lateness statistics of fired timers.
+struct fsm_timer_lateness_t {
+  u64 fired;                    /**< Number of fired timers. */
+  u64 late;                     /**< Number of timers fired later than
+                                 * #FSM_TIMER_LATE_MSECS. */
+  u64 starved;                  /**< Number of timers that had been due
+                                 * before function of another timer was
+                                 * called and had to wait for it. */
+  u64 hist[FSM_TIMER_LATENESS_BUCKETS]; /**< Lateness histogram. */
+};
+
+
+/// Timer base. There is one base per possible CPU.
+struct fsm_timer_base_t {
+  int                 cpu;      /**< CPU the base belongs to; its work is
+                                 * queued there while it's online. */
+  spinlock_t          lock;     /**< Protects the tree and 'running'. */
+  struct rb_root      timers;   /**< Pending timers sorted by time. */
+
+  struct fsm_timer_t *running;  /**< Timer whose function is being called
+                                 * right now. */
+  wait_queue_head_t   wait;     /**< Waiters for running timer function to
+                                 * return. */
+
+  struct mutex        run_lock; /**< Serializes concurrent instances of the
+                                 * work. */
+  unsigned int        exact;    /**< Number of pending timers without
+                                 * slack. */
+
+  struct delayed_work work;     /**< Fires expired timers. */
+  struct delayed_work deferrable_work; /**< Fires expired timers while all
+                                        * the pending ones have slack. */
+  unsigned long       deadline; /**< Virtual time 'work' is scheduled for:
+                                 * expiration time of the first timer or,
+                                 * if all the timers have slack, the time
+                                 * by which the deferral must end. */
+
+  struct fsm_timer_lateness_t lateness; /**< Lateness statistics; protected
+                                         * by 'lock'. */
+};
+
+
+/// Per-CPU timer bases.
+static DEFINE_PER_CPU(struct fsm_timer_base_t, fsm_timer_bases);
+
+
+/**
+ * Fires expired timers of the base.
+ *
+ * @param work 'work' of the base
+ */
+static void
+fsm_timers_work_fn(struct work_struct *work);
+
+
+/**
+ * Fires expired timers of the base.
+ *
+ * @param work 'deferrable_work' of the base
+ */
+static void
+fsm_timers_deferrable_work_fn(struct work_struct *work);
+
+
+/**
+ * Shows lateness statistics.
+ *
+ * @param name   attribute name
+ * @param data   private data (not used)
+ * @param buffer buffer to write statistics to
+ *
+ * @return number of bytes written
+ */
+static ssize_t
+fsm_timers_lateness_show(const char *name, void *data, char *buffer);
+
+
+/// Status attribute exporting lateness statistics.
+STATUS_ATTR_DECLARE(timer_lateness, fsm_timers_lateness_show, NULL);
+
+
+int
+fsm_timers_init(void)
+{
+  int cpu;
+
+  struct fsm_timer_base_t *base;
+
+  for_each_possible_cpu(cpu) {
+    base = &per_cpu(fsm_timer_bases, cpu);
+
+    base->cpu      = cpu;
+    spin_lock_init(&base->lock);
+    base->timers   = RB_ROOT;
+    base->running  = NULL;
+    init_waitqueue_head(&base->wait);
+    mutex_init(&base->run_lock);
+    base->exact    = 0;
+    base->deadline = 0;
+    INIT_DELAYED_WORK(&base->work, fsm_timers_work_fn);
+    INIT_DELAYED_WORK_DEFERRABLE(&base->deferrable_work,
+                                 fsm_timers_deferrable_work_fn);
+    memset(&base->lateness, 0, sizeof(base->lateness));
+  }
+
+  fsm_clock_start();
+
+  return status_create_file(&status_attr_timer_lateness);
+}
+
+
+void
+fsm_timers_cleanup(void)
+{
+  int cpu;
+
+  struct fsm_timer_base_t *base;
+
+  for_each_possible_cpu(cpu) {
+    base = &per_cpu(fsm_timer_bases, cpu);
+
+    ASSERT( RB_EMPTY_ROOT(&base->timers) );
+
+    cancel_delayed_work_sync(&base->work);
+    cancel_delayed_work_sync(&base->deferrable_work);
+  }
+
+  status_remove_file(&status_attr_timer_lateness);
+}
+
+
+struct fsm_timer_base_t *
+fsm_timer_local_base(void)
+{
+  return &per_cpu(fsm_timer_bases, raw_smp_processor_id());
+}
+
+
+/**
+ * Returns the timer that expires first. Base lock must be held by the caller.
+ *
+ * @param base timer base
+ *
+ * @return first timer or NULL if there are no pending timers
+ */
+static inline struct fsm_timer_t *
+__fsm_timers_first(struct fsm_timer_base_t *base)
+{
+  struct rb_node *node = rb_first(&base->timers);
+
+  return node != NULL ? rb_entry(node, struct fsm_timer_t, node) : NULL;
+}
+
+
+/**
+ * Queues the work of the base. The work is bound to base's CPU unless the
+ * CPU is offline.
+ *
+ * @param base  timer base
+ * @param work  work to queue
+ * @param delay delay in real jiffies
+ */
+static inline void
+fsm_timers_schedule(struct fsm_timer_base_t *base,
+                    struct delayed_work *work, unsigned long delay)
+{
+  if (cpu_online(base->cpu)) {
+    schedule_delayed_work_on(base->cpu, work, delay);
+  } else {
+    schedule_delayed_work(work, delay);
+  }
+}
+
+
+/**
+ * Converts virtual time to the real delay till it.
+ *
+ * @param time virtual time
+ * @param now  current virtual time
+ *
+ * @return delay in real jiffies; MAX_JIFFY_OFFSET if the clock is stopped
+ */
+static inline unsigned long
+fsm_timers_delay(unsigned long time, unsigned long now)
+{
+  return time_after(time, now) ? fsm_clock_to_real(time - now) : 0;
+}
+
+
+/**
+ * Schedules the work to the time of the first timer. While all the timers
+ * have slack, the work is deferrable, and the normal work is scheduled as a
+ * backstop to the time the first timer's slack runs out: an idle CPU may
+ * put deferrable work off indefinitely. Base lock must be held by the
+ * caller.
+ *
+ * @param base timer base
+ */
+static void
+__fsm_timers_reschedule(struct fsm_timer_base_t *base)
+{
+  unsigned long       now;
+  unsigned long       delay;
+  struct fsm_timer_t *first = __fsm_timers_first(base);
+
+  if (first == NULL) {
+    return;
+  }
+
+  now   = fsm_clock_now();
+  delay = fsm_timers_delay(first->time, now);
+  if (delay == MAX_JIFFY_OFFSET) {
+    /* the clock is stopped; we'll be kicked when it's advanced */
+    return;
+  }
+
+  if (base->exact != 0) {
+    base->deadline = first->time;
+    fsm_timers_schedule(base, &base->work, delay);
+    return;
+  }
+
+  base->deadline = first->time + first->slack;
+  fsm_timers_schedule(base, &base->deferrable_work, delay);
+  fsm_timers_schedule(base, &base->work,
+                      fsm_timers_delay(base->deadline, now));
+}
+
+
+/**
+ * Cancels scheduled work. Base lock must be held by the caller.
+ *
+ * @param base timer base
+ */
+static inline void
+__fsm_timers_unschedule(struct fsm_timer_base_t *base)
+{
+  cancel_delayed_work(&base->work);
+  cancel_delayed_work(&base->deferrable_work);
+}
+
+
+/**
+ * Removes timer from the tree if it's pending. Lock of timer's base must be
+ * held by the caller.
+ *
+ * @param timer timer
+ */
+static inline void
+__fsm_timer_dequeue(struct fsm_timer_t *timer)
+{
+  if (!RB_EMPTY_NODE(&timer->node)) {
+    rb_erase(&timer->node, &timer->base->timers);
+    RB_CLEAR_NODE(&timer->node);
+
+    if (timer->slack == 0) {
+      --timer->base->exact;
+    }
+  }
+}
+
+
+void
+fsm_timer_arm(struct fsm_timer_t *timer,
+              unsigned long time, unsigned long slack)
+{
+  struct rb_node  *parent = NULL;
+  struct rb_node **link;
+  bool             first  = true;
+  bool             resched;
+  unsigned long    delay;
+
+  struct fsm_timer_base_t *base = timer->base;
+
+  if (slack != 0) {
+    /* timers with the same slack expiring close to each other end up with
+     * the same time and are fired together */
+    time = roundup(time, slack);
+  }
+
+  spin_lock(&base->lock);
+
+  __fsm_timer_dequeue(timer);
+  timer->time  = time;
+  timer->slack = slack;
+
+  /* the first exact timer requires the work to stop being deferrable */
+  resched = slack == 0 && base->exact++ == 0;
+
+  /* timers with equal times are fired in the order they have been armed */
+  link = &base->timers.rb_node;
+  while (*link != NULL) {
+    parent = *link;
+
+    if (time_before(time, rb_entry(parent, struct fsm_timer_t, node)->time)) {
+      link = &parent->rb_left;
+    } else {
+      link  = &parent->rb_right;
+      first = false;
+    }
+  }
+
+  rb_link_node(&timer->node, parent, link);
+  rb_insert_color(&timer->node, &base->timers);
+
+  if (first || resched) {
+    /* the work might have been scheduled for a later time */
+    __fsm_timers_unschedule(base);
+    __fsm_timers_reschedule(base);
+  } else if (time_before(time + slack, base->deadline)) {
+    /* the backstop would let the timer be late by more than its slack */
+    delay = fsm_timers_delay(time + slack, fsm_clock_now());
+    if (delay != MAX_JIFFY_OFFSET) {
+      base->deadline = time + slack;
+      cancel_delayed_work(&base->work);
+      fsm_timers_schedule(base, &base->work, delay);
+    }
+  }
+
+  spin_unlock(&base->lock);
+}
+
+
+void
+fsm_timers_kick(void)
+{
+  int cpu;
+
+  struct fsm_timer_base_t *base;
+
+  for_each_possible_cpu(cpu) {
+    base = &per_cpu(fsm_timer_bases, cpu);
+
+    spin_lock(&base->lock);
+    __fsm_timers_unschedule(base);
+    __fsm_timers_reschedule(base);
+    spin_unlock(&base->lock);
+  }
+}
+
+
+bool
+fsm_timer_cancel(struct fsm_timer_t *timer)
+{
+  bool pending;
+
+  /* the work is not rescheduled: if it fires too early it will just find
+   * nothing to do */
+  spin_lock(&timer->base->lock);
+  pending = !RB_EMPTY_NODE(&timer->node);
+  __fsm_timer_dequeue(timer);
+  spin_unlock(&timer->base->lock);
+
+  return pending;
+}
+
+
+void
+fsm_timer_cancel_sync(struct fsm_timer_t *timer)
+{
+  struct fsm_timer_base_t *base = timer->base;
+
+  spin_lock(&base->lock);
+  __fsm_timer_dequeue(timer);
+  spin_unlock(&base->lock);
+
+  wait_event(base->wait, ACCESS_ONCE(base->running) != timer);
+}
+
+
+/**
+ * Accounts timer that is about to be fired. Base lock must be held by the
+ * caller.
+ *
+ * @param base    timer base
+ * @param timer   timer
+ * @param now     current virtual time
+ * @param starved whether the timer has been waiting for another timer
+ */
+static void
+__fsm_timers_account(struct fsm_timer_base_t *base,
+                     const struct fsm_timer_t *timer,
+                     unsigned long now, bool starved)
+{
+  unsigned int lateness = jiffies_to_msecs(now - timer->time);
+
+  ++base->lateness.fired;
+  ++base->lateness.hist[min(fls(lateness), FSM_TIMER_LATENESS_BUCKETS - 1)];
+
+  if (lateness > FSM_TIMER_LATE_MSECS) {
+    ++base->lateness.late;
+  }
+
+  if (starved) {
+    ++base->lateness.starved;
+  }
+}
+
+
+/**
+ * Fires expired timers.
+ *
+ * @param base timer base
+ */
+static void
+fsm_timers_run(struct fsm_timer_base_t *base)
+{
+  unsigned long       now;
+  unsigned long       last_fired = 0;
+  bool                fired = false;
+  struct fsm_timer_t *timer;
+
+  mutex_lock(&base->run_lock);
+  spin_lock(&base->lock);
+
+  while ((timer = __fsm_timers_first(base)) != NULL) {
+    now = fsm_clock_now();
+    if (time_after(timer->time, now)) {
+      __fsm_timers_reschedule(base);
+      break;
+    }
+
+    /* the timer had already expired when the previous one was fired, so it
+     * waited for the previous function to return */
+    __fsm_timers_account(base, timer, now,
+                         fired && !time_after(timer->time, last_fired));
+    fired      = true;
+    last_fired = now;
+
+    __fsm_timer_dequeue(timer);
+    base->running = timer;
+
+    spin_unlock(&base->lock);
+    timer->fn(timer);
+    spin_lock(&base->lock);
+
+    base->running = NULL;
+    wake_up_all(&base->wait);
+  }
+
+  spin_unlock(&base->lock);
+  mutex_unlock(&base->run_lock);
+}
+
+
+static void
+fsm_timers_work_fn(struct work_struct *work)
+{
+  fsm_timers_run(container_of(to_delayed_work(work),
+                              struct fsm_timer_base_t, work));
+}
+
+
+static void
+fsm_timers_deferrable_work_fn(struct work_struct *work)
+{
+  fsm_timers_run(container_of(to_delayed_work(work),
+                              struct fsm_timer_base_t, deferrable_work));
+}
+
+
+static ssize_t
+fsm_timers_lateness_show(const char *name, void *data, char *buffer)
+{
+  int     i;
+  int     cpu;
+  ssize_t count;
+
+  struct fsm_timer_base_t    *base;
+  struct fsm_timer_lateness_t lateness;
+
+  memset(&lateness, 0, sizeof(lateness));
+
+  for_each_possible_cpu(cpu) {
+    base = &per_cpu(fsm_timer_bases, cpu);
+
+    spin_lock(&base->lock);
+
+    lateness.fired   += base->lateness.fired;
+    lateness.late    += base->lateness.late;
+    lateness.starved += base->lateness.starved;
+
+    for (i = 0; i < FSM_TIMER_LATENESS_BUCKETS; ++i) {
+      lateness.hist[i] += base->lateness.hist[i];
+    }
+
+    spin_unlock(&base->lock);
+  }
+
+  count = scnprintf(buffer, PAGE_SIZE,
+                    "fired: %llu\nlate: %llu\nstarved: %llu\n"
+                    "lateness (ms):\n",
+                    lateness.fired, lateness.late, lateness.starved);
+
+  for (i = 0; i < FSM_TIMER_LATENESS_BUCKETS; ++i) {
+    if (lateness.hist[i] == 0) {
+      continue;
+    }
+
+    if (i == 0) {
+      count += scnprintf(buffer + count, PAGE_SIZE - count,
+                         "  0: %llu\n", lateness.hist[i]);
+    } else if (i == FSM_TIMER_LATENESS_BUCKETS - 1) {
+      count += scnprintf(buffer + count, PAGE_SIZE - count,
+                         "  %u+: %llu\n", 1U << (i - 1), lateness.hist[i]);
+    } else {
+      count += scnprintf(buffer + count, PAGE_SIZE - count,
+                         "  %u-%u: %llu\n",
+                         1U << (i - 1), (1U << i) - 1, lateness.hist[i]);
+    }
+  }
+
+  return count;
+}
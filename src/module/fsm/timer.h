@@ -0,0 +1,156 @@
+/**
+ * @file   timer.h
+ *
+ * @brief Timers shared by all FSM instances. Instead of a delayed work per
+ * FSM, pending timers are kept in per-CPU bases: every base has a tree sorted
+ * by expiration time and a work that fires the ones that are due. A timer
+ * stays in the base of the CPU it has been initialized on, so FSMs created on
+ * different CPUs don't contend for the same base. Timers run on virtual time
+ * (see fsm/clock.h).
+ *
+ * Timers may be armed with a slack. Expiration time of such timers is aligned
+ * up to a multiple of the slack, so that timers of all the FSMs expiring
+ * around the same time are fired by a single wakeup. While there are no
+ * pending timers without slack, the work firing timers is deferrable and
+ * does not wake idle CPUs, though only till the slack of the first timer
+ * runs out: a non-deferrable backstop fires it by then at the latest.
+ *
+ * Lateness of fired timers is monitored and exported as 'timer_lateness' file
+ * in status directory: a histogram of delays between expiration and firing,
+ * number of late timers and number of timers that had to wait for functions
+ * of other timers of the same base. Statistics of all the bases are summed
+ * up.
+ *
+ *
+ */
+
+#ifndef _FSM__TIMER_H_
+#define _FSM__TIMER_H_
+
+
+#include <linux/types.h>
+#include <linux/rbtree.h>
+
+
+struct fsm_timer_t;
+struct fsm_timer_base_t;
+
+
+/// Function called when timer fires. Called from process context without
+/// any locks held.
+typedef void (*fsm_timer_fn_t)(struct fsm_timer_t *timer);
+
+
+/// Timer managed by shared timer base.
+struct fsm_timer_t {
+  struct rb_node           node;  /**< Node in the tree of pending
+                                   * timers. */
+  unsigned long            time;  /**< Expiration time (virtual). */
+  unsigned long            slack; /**< Slack the timer has been armed
+                                   * with. */
+  fsm_timer_fn_t           fn;    /**< Function to call on expiration. */
+  struct fsm_timer_base_t *base;  /**< Base the timer is queued to. */
+};
+
+
+/// Timers fired more than this number of (virtual) milliseconds after
+/// expiration are considered late.
+#define FSM_TIMER_LATE_MSECS 100
+
+
+/// Number of buckets in lateness histogram. Bucket 0 counts timers fired in
+/// time; bucket i counts timers late by [2^(i - 1), 2^i) ms; the last bucket
+/// also counts everything above.
+#define FSM_TIMER_LATENESS_BUCKETS 16
+
+
+/**
+ * Initializes timer bases and exports their lateness statistics. Must be
+ * called before any timer is armed.
+ *
+ * @retval  0 success
+ * @retval <0 error occurred
+ */
+int
+fsm_timers_init(void);
+
+
+/**
+ * Cleans up timer bases. All the timers must be canceled by now.
+ */
+void
+fsm_timers_cleanup(void);
+
+
+/**
+ * Re-evaluates expiration of the pending timers after virtual clock has been
+ * changed.
+ */
+void
+fsm_timers_kick(void);
+
+
+/**
+ * Returns timer base of the current CPU.
+ *
+ * @return timer base
+ */
+struct fsm_timer_base_t *
+fsm_timer_local_base(void);
+
+
+/**
+ * Initializes timer. The timer is queued to the base of the current CPU.
+ *
+ * @param timer timer
+ * @param fn    function to call on expiration
+ */
+static inline void
+fsm_timer_init(struct fsm_timer_t *timer, fsm_timer_fn_t fn)
+{
+  RB_CLEAR_NODE(&timer->node);
+  timer->time  = 0;
+  timer->slack = 0;
+  timer->fn    = fn;
+  timer->base  = fsm_timer_local_base();
+}
+
+
+/**
+ * Arms timer. If timer is already pending it is re-armed.
+ *
+ * @param timer timer
+ * @param time  expiration time in virtual jiffies
+ * @param slack how late (in virtual jiffies) the timer may fire; 0 if it
+ *              must fire exactly in time
+ */
+void
+fsm_timer_arm(struct fsm_timer_t *timer,
+              unsigned long time, unsigned long slack);
+
+
+/**
+ * Cancels pending timer. Does not wait for the timer function if it's
+ * running at the moment.
+ *
+ * @param timer timer
+ *
+ * @retval true  timer has been pending; its function won't be called
+ * @retval false timer has not been pending or is being fired right now
+ */
+bool
+fsm_timer_cancel(struct fsm_timer_t *timer);
+
+
+/**
+ * Cancels pending timer and waits for the timer function to return if it's
+ * running at the moment. Must not be called with locks timer function may
+ * take.
+ *
+ * @param timer timer
+ */
+void
+fsm_timer_cancel_sync(struct fsm_timer_t *timer);
+
+
+#endif /* _FSM__TIMER_H_ */
@@ -51,9 +51,27 @@ static ssize_t
 status_sysfs_show(struct kobject *object, struct attribute *attr, char *buffer);
 
 
+/**
+ * Function that is called when 'attr' is written. Dispatches the work to the
+ * attribute-specific 'store' function specified in #status_attr_t.
+ *
+ * @param object containing kobject; must be context.object here;
+ * @param attr   attribute that is written
+ * @param buffer data written
+ * @param count  size of the data
+ *
+ * @retval >=0 number of bytes consumed
+ * @retval  <0 error code
+ */
+static ssize_t
+status_sysfs_store(struct kobject *object, struct attribute *attr,
+                   const char *buffer, size_t count);
+
+
 /// Sysfs operations for status directory.
 static struct sysfs_ops status_sysfs_ops = {
   .show  = status_sysfs_show,
+  .store = status_sysfs_store,
 };
 
 
@@ -138,6 +156,23 @@ status_sysfs_show(struct kobject *object, struct attribute *attr, char *buffer)
 }
 
 
+static ssize_t
+status_sysfs_store(struct kobject *object, struct attribute *attr,
+                   const char *buffer, size_t count)
+{
+  struct status_attr_t *status_attr = TO_STATUS_ATTR(attr);
+
+  ASSERT( TO_STATUS(object) == &context );
+
+  if (status_attr->store == NULL) {
+    return -EPERM;
+  }
+
+  return status_attr->store(status_attr->attr.name, status_attr->data,
+                            buffer, count);
+}
+
+
 void
 status_remove_all_files(void)
 {
@@ -26,11 +26,20 @@ struct status_attr_t;
 typedef ssize_t (*status_attr_show_t)(const char *, void *, char *buffer);
 
 
+/// Typedef for functions changing attributes' values. Return number of bytes
+/// consumed or error code.
+typedef ssize_t (*status_attr_store_t)(const char *, void *,
+                                       const char *buffer, size_t count);
+
+
 /// Structure representing an attribute in status directory.
 struct status_attr_t {
   struct attribute   attr;   /**< Holds attribute name and mode. */
   status_attr_show_t show;   /**< Function to be called when one reads
                               *   attribute's file. */
+  status_attr_store_t store; /**< Function to be called when one writes
+                              *   attribute's file; NULL for read-only
+                              *   attributes. */
 
   bool               has_file;  /**< Indicates whether file has been
                                  * created for this attribute or not. */
@@ -53,6 +62,27 @@ struct status_attr_t {
                   .mode = S_IRUGO,                            \
                 },                                            \
     .show     = _show,                                        \
+    .store    = NULL,                                         \
+    .has_file = false,                                        \
+    .data     = _data,                                        \
+  }
+
+
+/**
+ * Initializer for writable status_attr_t structures. Files of such
+ * attributes are writable by owner.
+ *
+ * @param _name  attribute name
+ * @param _show  function to be called when one reads attribute's file
+ * @param _store function to be called when one writes attribute's file
+ * @param _data  private data
+ */
+#define STATUS_ATTR_RW(_name, _show, _store, _data)           \
+  { .attr     = { .name = __stringify(_name),                 \
+                  .mode = S_IRUGO | S_IWUSR,                  \
+                },                                            \
+    .show     = _show,                                        \
+    .store    = _store,                                       \
     .has_file = false,                                        \
     .data     = _data,                                        \
   }
@@ -90,6 +120,7 @@ status_attr_init(struct status_attr_t *status_attr,
   status_attr->attr.mode = S_IRUGO;
 
   status_attr->show      = show;
+  status_attr->store     = NULL;
   status_attr->has_file  = false;
   status_attr->data      = data;
 }
@@ -1,49 +1,188 @@
 #include <linux/random.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
 
 #include "utils/random.h"
 
 
+/// Per-CPU pool of random bytes refilled from the kernel generator in bulk.
+struct random_pool_t {
+  u8           bytes[RANDOM_POOL_SIZE]; /**< Random bytes. */
+  unsigned int avail;                   /**< Number of bytes not consumed
+                                         * yet (at the end of #bytes). */
+};
+
+
+/// Random pools. Zero-initialized pools are empty and get refilled on the
+/// first use.
+static DEFINE_PER_CPU(struct random_pool_t, random_pools);
+
+
+/**
+ * Takes random bytes from the local pool refilling it if needed.
+ *
+ * @param buffer buffer to fill
+ * @param count  number of bytes; must not exceed #RANDOM_POOL_SIZE
+ */
+static void
+random_pool_take(void *buffer, unsigned int count)
+{
+  struct random_pool_t *pool = &get_cpu_var(random_pools);
+
+  if (pool->avail < count) {
+    get_random_bytes(pool->bytes, RANDOM_POOL_SIZE);
+    pool->avail = RANDOM_POOL_SIZE;
+  }
+
+  pool->avail -= count;
+  memcpy(buffer, &pool->bytes[pool->avail], count);
+
+  /* wipe consumed bytes so that they can't be recovered later */
+  memset(&pool->bytes[pool->avail], 0, count);
+
+  put_cpu_var(random_pools);
+}
+
+
 u8
 get_random_u8(void)
 {
-  u8 buffer[1];
-  get_random_bytes(buffer, 1);
+  u8 ret;
+  random_pool_take(&ret, sizeof(ret));
 
-  return buffer[0];
+  return ret;
 }
 
 
 u16
 get_random_u16(void)
 {
-  u8 buffer[2];
-  get_random_bytes(buffer, 2);
+  u16 ret;
+  random_pool_take(&ret, sizeof(ret));
 
-  return (buffer[0] << 8) | buffer[1];
+  return ret;
 }
 
 
 u32
 get_random_u32(void)
 {
-  u8 buffer[4];
-  get_random_bytes(buffer, 4);
+  u32 ret;
+  random_pool_take(&ret, sizeof(ret));
 
-  return (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+  return ret;
 }
 
 
-unsigned int
-get_random_int(void)
+u32
+get_random_range(u32 range)
+{
+  return random_stream_range(NULL, range);
+}
+
+
+/**
+ * Advances splitmix64 generator used to expand seeds.
+ *
+ * @param x generator state
+ *
+ * @return next value
+ */
+static u64
+random_splitmix64(u64 *x)
+{
+  u64 z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+
+void
+random_stream_init(struct random_stream_t *stream, u64 seed, u32 id)
 {
-  int i;
-  unsigned int ret = 0;
+  u64 x;
+  u64 v;
 
-  for (i = 0; i < sizeof(int); ++i) {
-    ret <<= 8;
+  memset(stream, 0, sizeof(*stream));
 
-    ret |= get_random_u8();
+  if (seed == 0) {
+    return;
   }
 
+  /* streams with different ids start from unrelated points of splitmix64
+   * sequence, so their states are independent */
+  x = seed ^ ((u64) id << 32 | id);
+
+  v = random_splitmix64(&x);
+  stream->state[0] = v;
+  stream->state[1] = v >> 32;
+  v = random_splitmix64(&x);
+  stream->state[2] = v;
+  stream->state[3] = v >> 32;
+
+  stream->seeded = true;
+}
+
+
+u32
+random_stream_u32(struct random_stream_t *stream)
+{
+  u32 *s;
+  u32  ret;
+  u32  t;
+
+  if (stream == NULL || !stream->seeded) {
+    return get_random_u32();
+  }
+
+  /* xoshiro128** */
+  s   = stream->state;
+  ret = rol32(s[1] * 5, 7) * 9;
+  t   = s[1] << 9;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3]  = rol32(s[3], 11);
+
   return ret;
 }
+
+
+u32
+random_stream_range(struct random_stream_t *stream, u32 range)
+{
+  u64 product;
+  u32 threshold;
+
+  if (range == 0) {
+    return 0;
+  }
+
+  /* Lemire's multiply-shift: high half of random * range is uniform over
+   * [0, range) once products with low half below 2^32 % range are
+   * rejected */
+  product = (u64) random_stream_u32(stream) * range;
+  if ((u32) product < range) {
+    threshold = -range % range;
+
+    while ((u32) product < threshold) {
+      product = (u64) random_stream_u32(stream) * range;
+    }
+  }
+
+  return product >> 32;
+}
+
+
+unsigned int
+get_random_int(void)
+{
+  return get_random_u32();
+}
@@ -3,7 +3,9 @@
  * @author Aliaksiej Artamonaŭ <aliaksiej.artamonau@gmail.com>
  * @date   Tue Sep 28 22:02:41 2010
  *
- * @brief  Utility function to obtain certain random values.
+ * @brief  Utility function to obtain certain random values. Values are
+ * served from per-CPU pools that are refilled from the kernel generator
+ * #RANDOM_POOL_SIZE bytes at a time.
  *
  *
  */
@@ -12,6 +14,13 @@
 #define _RANDOM_H_
 
 
+#include <linux/types.h>
+
+
+/// Size of per-CPU random pool (bytes).
+#define RANDOM_POOL_SIZE 64
+
+
 /**
  * Returns random u8 value.
  *
@@ -39,6 +48,18 @@ u32
 get_random_u32(void);
 
 
+/**
+ * Returns random value uniformly distributed over [0, range) without modulo
+ * bias.
+ *
+ * @param range number of possible values
+ *
+ * @return random value; 0 if @a range is zero
+ */
+u32
+get_random_range(u32 range);
+
+
 /**
  * Returns random boolean value.
  *
@@ -51,6 +72,67 @@ get_random_bool(void)
 }
 
 
+/// Stream of random values. Seeded stream is a deterministic xoshiro128**
+/// generator, so it yields the same sequence for the same seed; unseeded
+/// stream draws from per-CPU pools. Not thread-safe: users must serialize
+/// access to seeded streams.
+struct random_stream_t {
+  u32  state[4];                /**< Generator state. */
+  bool seeded;                  /**< Whether the stream is deterministic. */
+};
+
+
+/**
+ * Initializes random stream.
+ *
+ * @param stream stream to initialize
+ * @param seed   seed shared by all the streams; zero makes the stream draw
+ *               from per-CPU pools
+ * @param id     stream identifier; streams with the same seed and different
+ *               identifiers are independent
+ */
+void
+random_stream_init(struct random_stream_t *stream, u64 seed, u32 id);
+
+
+/**
+ * Returns random u32 value from the stream.
+ *
+ * @param stream random stream; NULL stands for per-CPU pools
+ *
+ * @return random u32 value
+ */
+u32
+random_stream_u32(struct random_stream_t *stream);
+
+
+/**
+ * Returns random value from the stream uniformly distributed over [0, range)
+ * without modulo bias.
+ *
+ * @param stream random stream; NULL stands for per-CPU pools
+ * @param range  number of possible values
+ *
+ * @return random value; 0 if @a range is zero
+ */
+u32
+random_stream_range(struct random_stream_t *stream, u32 range);
+
+
+/**
+ * Returns random boolean value from the stream.
+ *
+ * @param stream random stream; NULL stands for per-CPU pools
+ *
+ * @return random boolean value
+ */
+static inline bool
+random_stream_bool(struct random_stream_t *stream)
+{
+  return random_stream_u32(stream) & 0x1 ? true : false;
+}
+
+
 /**
  * Returns random integer value.
  *
@@ -25,6 +25,14 @@ enum rps_sign_t {
 #define RPS_SIGNS_COUNT __RPS_SIGN_LAST
 
 
+/// Result of rock-paper-scissors game.
+enum rps_result_t {
+  RPS_WINNER_FIRST,             /**< First player won. */
+  RPS_WINNER_SECOND,            /**< Second player won. */
+  RPS_DRAW,                     /**< Draw. */
+};
+
+
 #ifdef __KERNEL__
 
 
@@ -39,14 +47,6 @@ const char *
 rps_sign_to_str(enum rps_sign_t sign);
 
 
-/// Result of rock-paper-scissors game.
-enum rps_result_t {
-  RPS_WINNER_FIRST,             /**< First player won. */
-  RPS_WINNER_SECOND,            /**< Second player won. */
-  RPS_DRAW,                     /**< Draw. */
-};
-
-
 /**
  * Determines who is the winner in rock-paper-scissors game.
  *